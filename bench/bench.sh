@@ -0,0 +1,25 @@
+#!/bin/sh
+# Throughput of the lexer, the parser and the whole compiler on generated
+# programs, see bench/gen.c for the shapes.
+#
+#       bench/bench.sh [bindir]
+#
+# bindir holds gen, run, lex, parse and scc (make bench builds them).
+# SIZES and SHAPES override the defaults.
+
+BIN=${1:-bench/bin}
+SIZES=${SIZES:-"1000 10000 100000 1000000"}
+SHAPES=${SHAPES:-"mixed nest expr funcs locals"}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+printf "%-16s %9s %9s %12s %11s\n" "run" "lines" "seconds" "lines/sec" "peak rss"
+for shape in $SHAPES; do
+    for size in $SIZES; do
+        src="$TMP/$shape-$size.c"
+        "$BIN/gen" "$shape" "$size" > "$src" || exit 1
+        for tool in lex parse scc; do
+            "$BIN/run" "$tool/$shape" "$src" "$BIN/$tool" || exit 1
+        done
+    done
+done
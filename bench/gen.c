@@ -0,0 +1,298 @@
+/* Generate a C program in the subset scc accepts, for benchmarks.
+ *
+ *      gen <shape> <lines> [seed]
+ *
+ * shapes:
+ *      mixed   functions of 30-60 lines using every supported construct
+ *      nest    blocks and loops nested 64 deep
+ *      expr    long expressions spanning many lines
+ *      funcs   many small functions calling each other
+ *      locals  functions with hundreds of local variables
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NINTS 8
+#define NEST_DEPTH 64
+#define EXPR_TERMS 400
+#define NLOCALS 400
+
+static unsigned long seed = 1;
+static long lines;
+static int nfuncs;
+
+static unsigned rnd(unsigned n)
+{
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    return (unsigned) (seed >> 33) % n;
+}
+
+#define LINE(indent, fmt, ...) \
+    do { \
+        printf("%*s" fmt "\n", (indent) * 4, "", ##__VA_ARGS__); \
+        lines++; \
+    } while (0)
+
+/* int-typed operand */
+static void operand(void)
+{
+    switch (rnd(8)) {
+    case 0:
+        printf("%u", rnd(100));
+        break;
+    case 1:
+        printf("arr[%u]", rnd(8));
+        break;
+    case 2:
+        printf("*p");
+        break;
+    case 3:
+        if (nfuncs > 0) {
+            printf("f%d(x%u, %u)", (int) rnd(nfuncs), rnd(NINTS), rnd(10));
+            break;
+        }
+        /* fall through */
+    default:
+        printf("x%u", rnd(NINTS));
+        break;
+    }
+}
+
+static void expr(int terms)
+{
+    static const char *ops[] = {"+", "-", "*", "&", "|", "^", "+", "-"};
+    int i;
+
+    operand();
+    for (i = 1; i < terms; i++) {
+        if (rnd(6) == 0)
+            printf(" %% %u", rnd(9) + 1);
+        printf(" %s ", ops[rnd(8)]);
+        operand();
+    }
+}
+
+static void cond(void)
+{
+    static const char *rel[] = {"<", ">", "<=", ">=", "==", "!="};
+
+    printf("x%u %s ", rnd(NINTS), rel[rnd(6)]);
+    operand();
+    if (rnd(3) == 0) {
+        printf(rnd(2) ? " && " : " || ");
+        printf("x%u", rnd(NINTS));
+    }
+}
+
+static void assign(int indent)
+{
+    printf("%*sx%u = ", indent * 4, "", rnd(NINTS));
+    expr(1 + rnd(4));
+    printf(";\n");
+    lines++;
+}
+
+static void stmt(int indent, int depth);
+
+static void body(int indent, int depth, int n)
+{
+    while (n-- > 0)
+        stmt(indent, depth);
+}
+
+static void stmt(int indent, int depth)
+{
+    switch (depth > 0 ? rnd(10) : 0) {
+    case 1:
+        printf("%*sif (", indent * 4, "");
+        cond();
+        printf(") {\n");
+        lines++;
+        body(indent + 1, depth - 1, 1 + rnd(3));
+        LINE(indent, "} else {");
+        body(indent + 1, depth - 1, 1 + rnd(2));
+        LINE(indent, "}");
+        break;
+    case 2:
+        LINE(indent, "for (i = 0; i < %u; i++) {", rnd(10) + 1);
+        body(indent + 1, depth - 1, 1 + rnd(3));
+        LINE(indent, "}");
+        break;
+    case 3:
+        LINE(indent, "i = %u;", rnd(10));
+        LINE(indent, "while (i > 0) {");
+        body(indent + 1, depth - 1, 1 + rnd(2));
+        LINE(indent + 1, "i--;");
+        LINE(indent, "}");
+        break;
+    case 4:
+        LINE(indent, "do {");
+        body(indent + 1, depth - 1, 1 + rnd(2));
+        LINE(indent, "} while (i-- > 0);");
+        break;
+    case 5:
+        LINE(indent, "d = d * x%u + %u.5;", rnd(NINTS), rnd(10));
+        LINE(indent, "g = g - d / %u.0f;", rnd(9) + 1);
+        LINE(indent, "x%u = d;", rnd(NINTS));
+        break;
+    case 6:
+        LINE(indent, "p = &arr[%u];", rnd(8));
+        LINE(indent, "*p = x%u;", rnd(NINTS));
+        LINE(indent, "s[%u] = 'a';", rnd(8));
+        break;
+    case 7:
+        printf("%*sx%u = x%u > x%u ? ", indent * 4, "", rnd(NINTS), rnd(NINTS), rnd(NINTS));
+        operand();
+        printf(" : -x%u;\n", rnd(NINTS));
+        lines++;
+        break;
+    default:
+        assign(indent);
+        break;
+    }
+}
+
+static void prologue(void)
+{
+    int i;
+
+    LINE(0, "int f%d(int a, int b)", nfuncs);
+    LINE(0, "{");
+    for (i = 0; i < NINTS; i++)
+        LINE(1, "int x%d = a + %d;", i, i);
+    LINE(1, "int i;");
+    LINE(1, "int arr[8];");
+    LINE(1, "int *p = &x0;");
+    LINE(1, "char s[8];");
+    LINE(1, "double d = 1.5;");
+    LINE(1, "float g = 2.5f;");
+    LINE(1, "for (i = 0; i < 8; i++)");
+    LINE(2, "arr[i] = b + i;");
+}
+
+static void epilogue(void)
+{
+    LINE(1, "return x0 + x%u;", rnd(NINTS));
+    LINE(0, "}");
+    LINE(0, "");
+    nfuncs++;
+}
+
+static void gen_mixed(void)
+{
+    prologue();
+    body(1, 3, 10 + rnd(10));
+    epilogue();
+}
+
+static void gen_nest(void)
+{
+    int i;
+
+    prologue();
+    for (i = 0; i < NEST_DEPTH; i++) {
+        switch (i % 4) {
+        case 0:
+            LINE(i + 1, "if (x%d < %u) {", i % NINTS, rnd(100));
+            break;
+        case 1:
+            LINE(i + 1, "for (i = 0; i < 2; i++) {");
+            break;
+        case 2:
+            LINE(i + 1, "while (x%d-- > 0) {", i % NINTS);
+            break;
+        default:
+            LINE(i + 1, "{");
+            break;
+        }
+        assign(i + 2);
+    }
+    for (i = NEST_DEPTH - 1; i >= 0; i--)
+        LINE(i + 1, "}");
+    epilogue();
+}
+
+static void gen_expr(void)
+{
+    int i;
+
+    prologue();
+    printf("    x0 = ");
+    for (i = 0; i < EXPR_TERMS / 8; i++) {
+        expr(8);
+        printf(i == EXPR_TERMS / 8 - 1 ? ";\n" : "\n        + ");
+        lines++;
+    }
+    epilogue();
+}
+
+static void gen_funcs(void)
+{
+    LINE(0, "int f%d(int a, int b)", nfuncs);
+    LINE(0, "{");
+    if (nfuncs > 0)
+        LINE(1, "return f%d(b, a) + a * %u;", (int) rnd(nfuncs), rnd(10));
+    else
+        LINE(1, "return a + b;");
+    LINE(0, "}");
+    LINE(0, "");
+    nfuncs++;
+}
+
+static void gen_locals(void)
+{
+    int i;
+
+    LINE(0, "int f%d(int a, int b)", nfuncs);
+    LINE(0, "{");
+    for (i = 0; i < NLOCALS; i++)
+        LINE(1, "int v%d = a + %d;", i, i);
+    for (i = 0; i < NLOCALS; i++)
+        LINE(1, "b = b + v%d;", i);
+    LINE(1, "return b;");
+    LINE(0, "}");
+    LINE(0, "");
+    nfuncs++;
+}
+
+static struct {
+    const char *name;
+    void (*gen)(void);
+} shapes[] = {
+    {"mixed", gen_mixed},
+    {"nest", gen_nest},
+    {"expr", gen_expr},
+    {"funcs", gen_funcs},
+    {"locals", gen_locals},
+};
+
+int main(int argc, char *argv[])
+{
+    size_t i;
+    long target;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <shape> <lines> [seed]\n", argv[0]);
+        return 1;
+    }
+    target = atol(argv[2]);
+    if (argc > 3)
+        seed = strtoul(argv[3], NULL, 10);
+    for (i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++)
+        if (!strcmp(argv[1], shapes[i].name))
+            break;
+    if (i == sizeof(shapes) / sizeof(shapes[0])) {
+        fprintf(stderr, "%s: unknown shape %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    while (lines < target)
+        shapes[i].gen();
+    LINE(0, "int main(void)");
+    LINE(0, "{");
+    LINE(1, "printf(\"%%d\\n\", f%d(%u, %u));", nfuncs - 1, rnd(10), rnd(10));
+    LINE(1, "return 0;");
+    LINE(0, "}");
+    return 0;
+}
@@ -0,0 +1,18 @@
+/* Lexer-only pass for make bench: read stdin, count tokens */
+#include <stdio.h>
+#include "../src/lexer.h"
+
+int main(void)
+{
+    lexer_t lexer;
+    size_t n = 0;
+
+    lexer_init(&lexer, "stdin", stdin);
+    while (get_token(&lexer)) {
+        release_tokens(&lexer);
+        n++;
+    }
+    lexer_close(&lexer);
+    printf("%zu tokens\n", n);
+    return 0;
+}
@@ -0,0 +1,278 @@
+/* Microbenchmarks for dict_t, vector_t and buffer_t, see make microbench.
+ *
+ * Every line reports the time per operation and the number of malloc,
+ * calloc and realloc calls per operation.  The allocator is counted by
+ * linking with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/dict.h"
+#include "../src/vector.h"
+#include "../src/buffer.h"
+
+/* operations per measurement, spread over rounds of n */
+#define OPS 2000000
+
+static size_t nallocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    nallocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    nallocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    nallocs++;
+    return __real_realloc(p, size);
+}
+
+static unsigned long seed = 1;
+
+static unsigned rnd(unsigned n)
+{
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    return (unsigned) (seed >> 33) % n;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the timed loop runs between BEGIN and END, ops operations in total */
+static double start;
+static size_t start_allocs;
+
+#define BEGIN() (start_allocs = nallocs, start = now())
+#define END(name, dist, n, ops) \
+    report(name, dist, n, ops, now() - start, nallocs - start_allocs)
+
+static void report(const char *name, const char *dist, size_t n, size_t ops, double secs, size_t allocs)
+{
+    printf("%-16s %-8s %8zu %8.1f %10.2f %10.4f\n", name, dist, n,
+            secs * 1e9 / ops, ops / secs / 1e6, (double) allocs / ops);
+}
+
+/************************** key distributions *************************/
+static const char *words[] = {
+    "i", "j", "k", "n", "p", "len", "tmp", "buf", "node", "size", "count",
+    "index", "result", "offset", "token", "lexer", "parser", "ctype", "value"
+};
+
+/* v0, v1, ...: generated code */
+static char *key_seq(size_t i)
+{
+    char *s = malloc(16);
+    sprintf(s, "v%zu", i);
+    return s;
+}
+
+/* identifier-like words with a numeric suffix: hand-written code */
+static char *key_ident(size_t i)
+{
+    const char *w = words[rnd(sizeof(words) / sizeof(words[0]))];
+    char *s = malloc(strlen(w) + 16);
+    sprintf(s, "%s%zu", w, i);
+    return s;
+}
+
+/* random letters, 1 to 24 long */
+static char *key_random(size_t i)
+{
+    size_t j, len = 1 + rnd(24);
+    char *s = malloc(len + 16);
+
+    for (j = 0; j < len; j++)
+        s[j] = 'a' + rnd(26);
+    /* keep keys distinct */
+    sprintf(s + len, "_%zu", i);
+    return s;
+}
+
+static struct {
+    const char *name;
+    char *(*make)(size_t i);
+} dists[] = {
+    {"seq", key_seq},
+    {"ident", key_ident},
+    {"random", key_random},
+};
+
+/******************************* dict_t *******************************/
+/* the sizes of a block scope, a function, a file and a generated file */
+static size_t dict_sizes[] = {8, 64, 512, 4096};
+
+static void bench_dict(void)
+{
+    size_t d, s, i, r, n, rounds;
+    char **keys, **misses;
+    size_t *uniform, *hot;
+    dict_t *dict;
+    volatile void *sink;
+
+    for (d = 0; d < sizeof(dists) / sizeof(dists[0]); d++) {
+        for (s = 0; s < sizeof(dict_sizes) / sizeof(dict_sizes[0]); s++) {
+            n = dict_sizes[s];
+            rounds = OPS / n;
+            keys = malloc(sizeof(char *) * n);
+            misses = malloc(sizeof(char *) * n);
+            /* lookup orders, drawn outside the timed loops */
+            uniform = malloc(sizeof(size_t) * n);
+            hot = malloc(sizeof(size_t) * n);
+            for (i = 0; i < n; i++) {
+                keys[i] = dists[d].make(i);
+                misses[i] = dists[d].make(i + n);
+                uniform[i] = rnd(n);
+                /* most lookups go to a few names, like locals in a loop */
+                hot[i] = rnd(rnd(n) + 1);
+            }
+
+            BEGIN();
+            for (r = 0; r < rounds; r++) {
+                dict = make_dict(NULL);
+                for (i = 0; i < n; i++)
+                    dict_insert(dict, keys[i], keys[i], true);
+                free_dict(dict, NULL, NULL);
+            }
+            END("dict insert", dists[d].name, n, rounds * n);
+
+            dict = make_dict(NULL);
+            for (i = 0; i < n; i++)
+                dict_insert(dict, keys[i], keys[i], true);
+
+            BEGIN();
+            for (r = 0; r < rounds; r++)
+                for (i = 0; i < n; i++)
+                    sink = dict_lookup(dict, keys[uniform[i]]);
+            END("dict lookup", dists[d].name, n, rounds * n);
+
+            BEGIN();
+            for (r = 0; r < rounds; r++)
+                for (i = 0; i < n; i++)
+                    sink = dict_lookup(dict, keys[hot[i]]);
+            END("dict lookup hot", dists[d].name, n, rounds * n);
+
+            BEGIN();
+            for (r = 0; r < rounds; r++)
+                for (i = 0; i < n; i++)
+                    sink = dict_lookup(dict, misses[uniform[i]]);
+            END("dict miss", dists[d].name, n, rounds * n);
+
+            /* delete and put back, the table keeps its size */
+            BEGIN();
+            for (r = 0; r < rounds; r++)
+                for (i = 0; i < n; i++) {
+                    sink = dict_delete(dict, keys[i]);
+                    dict_insert(dict, keys[i], keys[i], true);
+                }
+            END("dict del+ins", dists[d].name, n, rounds * n);
+            (void) sink;
+
+            free_dict(dict, NULL, NULL);
+            for (i = 0; i < n; i++) {
+                free(keys[i]);
+                free(misses[i]);
+            }
+            free(keys);
+            free(misses);
+            free(uniform);
+            free(hot);
+        }
+    }
+}
+
+/****************************** vector_t ******************************/
+static size_t vector_sizes[] = {4, 64, 4096, 1 << 20};
+
+static void bench_vector(void)
+{
+    size_t s, i, r, n, rounds;
+    vector_t *vec;
+    volatile void *sink;
+
+    for (s = 0; s < sizeof(vector_sizes) / sizeof(vector_sizes[0]); s++) {
+        n = vector_sizes[s];
+        rounds = OPS / n > 0 ? OPS / n : 1;
+
+        BEGIN();
+        for (r = 0; r < rounds; r++) {
+            vec = make_vector();
+            for (i = 0; i < n; i++)
+                vector_append(vec, (void *) i);
+            free_vector(vec, NULL);
+        }
+        END("vector append", "-", n, rounds * n);
+
+        vec = make_vector();
+        BEGIN();
+        for (r = 0; r < rounds; r++) {
+            for (i = 0; i < n; i++)
+                vector_append(vec, (void *) i);
+            for (i = 0; i < n; i++)
+                sink = vector_pop(vec);
+        }
+        END("vector push/pop", "-", n, rounds * n * 2);
+        free_vector(vec, NULL);
+        (void) sink;
+    }
+}
+
+/****************************** buffer_t ******************************/
+static size_t buffer_sizes[] = {16, 256, 4096, 1 << 20};
+
+static void bench_buffer(void)
+{
+    size_t s, i, r, n, rounds;
+    buffer_t *buffer;
+    char c = 'x';
+    long l = 0;
+
+    for (s = 0; s < sizeof(buffer_sizes) / sizeof(buffer_sizes[0]); s++) {
+        n = buffer_sizes[s];
+        rounds = OPS / n > 0 ? OPS / n : 1;
+
+        /* byte at a time, like string literals in the lexer */
+        BEGIN();
+        for (r = 0; r < rounds; r++) {
+            buffer = make_buffer();
+            for (i = 0; i < n; i++)
+                buffer_push(buffer, &c, 1);
+            free_buffer(buffer);
+        }
+        END("buffer push 1", "-", n, rounds * n);
+
+        BEGIN();
+        for (r = 0; r < rounds; r++) {
+            buffer = make_buffer();
+            for (i = 0; i < n / 8; i++)
+                buffer_push(buffer, &l, sizeof(l));
+            free_buffer(buffer);
+        }
+        END("buffer push 8", "-", n / 8, rounds * (n / 8));
+    }
+}
+
+int main(void)
+{
+    printf("%-16s %-8s %8s %8s %10s %10s\n", "op", "keys", "n", "ns/op", "Mops/s", "allocs/op");
+    bench_dict();
+    bench_vector();
+    bench_buffer();
+    return 0;
+}
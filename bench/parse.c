@@ -0,0 +1,19 @@
+/* Parser-only pass for make bench: read stdin, count definitions */
+#include <stdio.h>
+#include "../src/parser.h"
+
+int main(void)
+{
+    lexer_t lexer;
+    parser_t parser;
+    size_t n = 0;
+
+    lexer_init(&lexer, "stdin", stdin);
+    parser_init(&parser, &lexer);
+    while (get_node(&parser))
+        n++;
+    parser_close(&parser);
+    lexer_close(&lexer);
+    printf("%zu definitions\n", n);
+    return 0;
+}
@@ -0,0 +1,69 @@
+/* Run a command on a generated file for make bench and report its speed.
+ *
+ *      run <label> <input> <command> [args...]
+ *
+ * The command reads input on stdin, its stdout is discarded.  Prints
+ * lines, seconds, lines/sec and the peak RSS of the child.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+static long count_lines(const char *fname)
+{
+    FILE *fp = fopen(fname, "r");
+    long n = 0;
+    int c;
+
+    if (!fp) {
+        perror(fname);
+        exit(1);
+    }
+    while ((c = getc(fp)) != EOF)
+        if (c == '\n')
+            n++;
+    fclose(fp);
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    struct timespec start, end;
+    struct rusage usage;
+    double secs;
+    long lines;
+    pid_t pid;
+    int status;
+
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <label> <input> <command> [args...]\n", argv[0]);
+        return 1;
+    }
+    lines = count_lines(argv[2]);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((pid = fork()) == 0) {
+        int in = open(argv[2], O_RDONLY), out = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0 || dup2(in, 0) < 0 || dup2(out, 1) < 0)
+            _exit(127);
+        execv(argv[3], argv + 3);
+        _exit(127);
+    }
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) {
+        perror("run");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s: %s failed on %s\n", argv[0], argv[3], argv[2]);
+        return 1;
+    }
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-16s %9ld %9.3f %12.0f %9ldKB\n", argv[1], lines, secs, lines / secs, usage.ru_maxrss);
+    return 0;
+}
@@ -0,0 +1,63 @@
+#!/bin/sh
+# Time from source to finished run of the native path (scc, then as and
+# ld through gcc, then the program) against scc --run and scc --vm.
+#
+#       bench/vm.sh [scc] [programs...]
+#
+# Defaults to bench/bin/scc on test/nqueen.c and test/heart.c (make
+# vmbench builds it).  RUNS overrides the number of runs averaged.
+
+SCC=$(realpath "${1:-bench/bin/scc}") || exit 1
+[ $# -gt 0 ] && shift
+PROGS=${*:-"test/nqueen.c test/heart.c"}
+RUNS=${RUNS:-20}
+CC=${CC:-gcc}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+now() {
+    date +%s%N
+}
+
+# milliseconds per run from nanoseconds of all runs
+ms() {
+    echo "$1" | awk -v runs="$RUNS" '{ printf "%.3f", $1 / runs / 1e6 }'
+}
+
+printf "%-12s %-10s %10s\n" "program" "path" "ms/run"
+for prog in $PROGS; do
+    name=$(basename "$prog" .c)
+    cp "$prog" "$TMP/$name.c" || exit 1
+    cd "$TMP" || exit 1
+    scc=0 asld=0 exec=0 run=0 vm=0
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        t0=$(now)
+        "$SCC" "$name.c" || exit 1
+        t1=$(now)
+        $CC -no-pie -o "$name" "$name.s" 2>/dev/null || exit 1
+        t2=$(now)
+        "./$name" > native.out
+        t3=$(now)
+        "$SCC" --run "$name.c" > run.out
+        t4=$(now)
+        "$SCC" --vm "$name.c" > vm.out
+        t5=$(now)
+        scc=$((scc + t1 - t0))
+        asld=$((asld + t2 - t1))
+        exec=$((exec + t3 - t2))
+        run=$((run + t4 - t3))
+        vm=$((vm + t5 - t4))
+        i=$((i + 1))
+    done
+    for out in run.out vm.out; do
+        cmp -s native.out "$out" || { echo "$name: $out differs from the native output" >&2; exit 1; }
+    done
+    printf "%-12s %-10s %10s\n" "$name" "scc" "$(ms $scc)"
+    printf "%-12s %-10s %10s\n" "$name" "as+ld" "$(ms $asld)"
+    printf "%-12s %-10s %10s\n" "$name" "exec" "$(ms $exec)"
+    printf "%-12s %-10s %10s\n" "$name" "native" "$(ms $((scc + asld + exec)))"
+    printf "%-12s %-10s %10s\n" "$name" "--run" "$(ms $run)"
+    printf "%-12s %-10s %10s\n" "$name" "--vm" "$(ms $vm)"
+    cd - > /dev/null || exit 1
+done
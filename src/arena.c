@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN(n) (((n) + 15) & ~(size_t) 15)
+
+arena_t *make_arena(void)
+{
+    return calloc(1, sizeof(arena_t));
+}
+
+static void arena_grow(arena_t *arena, size_t size)
+{
+    arena_block_t *block, **prev;
+
+    if (size < ARENA_BLOCK_SIZE)
+        size = ARENA_BLOCK_SIZE;
+    for (prev = &arena->spare; (block = *prev); prev = &block->next)
+        if (block->size >= size)
+            break;
+    if (block) {
+        *prev = block->next;
+        size = block->size;
+    } else {
+        block = malloc(sizeof(arena_block_t) + size);
+        block->size = size;
+        arena->reserved += size;
+        arena->nblocks++;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->ptr = block->data;
+    arena->end = block->data + size;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    void *p;
+
+    assert(arena);
+    size = ARENA_ALIGN(size);
+    if (size > (size_t) (arena->end - arena->ptr))
+        arena_grow(arena, size);
+    p = arena->ptr;
+    arena->ptr += size;
+    arena->nallocs++;
+    arena->used += size;
+    return p;
+}
+
+void *arena_calloc(arena_t *arena, size_t size)
+{
+    return memset(arena_alloc(arena, size), 0, size);
+}
+
+void arena_reset(arena_t *arena)
+{
+    arena_block_t *block, *next;
+
+    assert(arena);
+    for (block = arena->blocks; block; block = next) {
+        next = block->next;
+        block->next = arena->spare;
+        arena->spare = block;
+    }
+    arena->blocks = NULL;
+    arena->ptr = arena->end = NULL;
+    arena->nallocs = arena->used = 0;
+}
+
+void arena_report(FILE *fp, const char *name, arena_t *arena)
+{
+    assert(fp && arena);
+    fprintf(fp, "%s: arena %zu allocations, %zu bytes used, %zu bytes in %zu blocks\n",
+            name, arena->nallocs, arena->used, arena->reserved, arena->nblocks);
+}
+
+void free_arena(arena_t *arena)
+{
+    arena_block_t *block, *next;
+
+    assert(arena);
+    for (block = arena->blocks; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+    for (block = arena->spare; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+    free(arena);
+}
@@ -0,0 +1,35 @@
+#ifndef ARENA_H__
+#define ARENA_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+typedef struct arena_block_t {
+    struct arena_block_t *next;
+    size_t size;
+    _Alignas(16) char data[];
+} arena_block_t;
+
+/* Bump-pointer allocator, everything is released at once by free_arena */
+typedef struct arena_t {
+    arena_block_t *blocks;
+    char *ptr;
+    char *end;
+    /* blocks given back by arena_reset, used again before malloc */
+    arena_block_t *spare;
+    /* statistics */
+    size_t nallocs;
+    size_t used;
+    size_t reserved;
+    size_t nblocks;
+} arena_t;
+
+arena_t *make_arena(void);
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_calloc(arena_t *arena, size_t size);
+/* forget everything allocated, keep the blocks for what comes next */
+void arena_reset(arena_t *arena);
+void arena_report(FILE *fp, const char *name, arena_t *arena);
+void free_arena(arena_t *arena);
+
+#endif
@@ -12,7 +12,7 @@ buffer_t *make_buffer(void)
 
 void buffer_push(buffer_t *buffer, const void *v, size_t size)
 {
-    assert(buffer && size >= 0);
+    assert(buffer);
     if (buffer->top + size > buffer->size) {
         if (buffer->size == 0)
             buffer->size = BUFFER_INIT_SIZE;
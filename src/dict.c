@@ -3,51 +3,146 @@
 #include <string.h>
 #include "dict.h"
 
-static size_t hash(const char *s)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+size_t dict_hash(const char *s, size_t len)
 {
     size_t r = 2166136261;
-    for (; *s; s++) {
+    const char *end = s + len;
+
+    for (; s < end; s++) {
         r ^= *s;
         r *= 16777619;
     }
     return r;
 }
 
-#define DICT_INIT_SIZE 8
+#define DICT_INIT_SIZE 16
+
+/* h1 picks the group, h2 is the tag kept in ctrl */
+#define H1(h) ((h) >> 7)
+#define H2(h) ((signed char) ((h) & 0x7f))
+
+/* bit i of the result is set when ctrl[i] matches */
+#ifdef __SSE2__
+static inline unsigned group_match(const signed char *ctrl, signed char tag)
+{
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+}
+
+/* empty and deleted slots are the only ones with the sign bit set */
+static inline unsigned group_match_free(const signed char *ctrl)
+{
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) ctrl));
+}
+#else
+static inline unsigned group_match(const signed char *ctrl, signed char tag)
+{
+    unsigned i, mask = 0;
+
+    for (i = 0; i < DICT_GROUP; i++)
+        if (ctrl[i] == tag)
+            mask |= 1u << i;
+    return mask;
+}
+
+static inline unsigned group_match_free(const signed char *ctrl)
+{
+    unsigned i, mask = 0;
+
+    for (i = 0; i < DICT_GROUP; i++)
+        if (ctrl[i] < 0)
+            mask |= 1u << i;
+    return mask;
+}
+#endif
+
+static inline unsigned group_match_empty(const signed char *ctrl)
+{
+    return group_match(ctrl, DICT_EMPTY);
+}
+
+/* Triangular probing over the groups visits each of them once when the
+ * number of groups is a power of 2.  A group with an empty slot ends the
+ * probe sequence: no key was ever pushed past it.
+ */
+#define FOR_EACH_GROUP(dict, h, g, n) \
+    for ((g) = H1(h) & ((dict)->mask / DICT_GROUP), (n) = 0; ; \
+            (n)++, (g) = ((g) + (n)) & ((dict)->mask / DICT_GROUP))
+
+static void dict_alloc(dict_t *dict, size_t size)
+{
+    dict->mask = size - 1;
+    dict->used = dict->deleted = 0;
+    dict->ctrl = malloc(size);
+    memset(dict->ctrl, DICT_EMPTY, size);
+    dict->table = malloc(sizeof(dict_entry_t) * size);
+}
 
 dict_t *make_dict(dict_t *link)
 {
     dict_t *dict = malloc(sizeof(*dict));
     dict->link = link;
-    dict->used = 0;
-    dict->mask = DICT_INIT_SIZE - 1;
-    dict->table = calloc(DICT_INIT_SIZE, sizeof(dict_entry_t));
+    dict_alloc(dict, DICT_INIT_SIZE);
     return dict;
 }
 
-#define PROBE(i) ((i) + 1)
+static inline int first_bit(unsigned mask)
+{
+    return __builtin_ctz(mask);
+}
 
-static dict_entry_t *lookup(dict_t *dict, const char *key, size_t h)
+/* slot of key or -1 */
+static long lookup(dict_t *dict, const char *key, size_t h)
 {
-    size_t i;
+    size_t g, n, i;
+    unsigned match;
+    signed char *ctrl;
     dict_entry_t *e;
 
-    for (i = h & dict->mask; ; i = PROBE(i) & dict->mask) {
-        e = &dict->table[i];
-        if (!e->key || (e->hash == h && (e->key == key || !strcmp(e->key, key))))
-            return e;
+    FOR_EACH_GROUP(dict, h, g, n) {
+        ctrl = dict->ctrl + g * DICT_GROUP;
+        for (match = group_match(ctrl, H2(h)); match; match &= match - 1) {
+            i = g * DICT_GROUP + first_bit(match);
+            e = &dict->table[i];
+            if (e->hash == h && (e->key == key || !strcmp(e->key, key)))
+                return i;
+        }
+        if (group_match_empty(ctrl))
+            return -1;
+    }
+}
+
+/* first empty or deleted slot on the probe sequence of h */
+static size_t find_free(dict_t *dict, size_t h)
+{
+    size_t g, n;
+    unsigned match;
+
+    FOR_EACH_GROUP(dict, h, g, n) {
+        match = group_match_free(dict->ctrl + g * DICT_GROUP);
+        if (match)
+            return g * DICT_GROUP + first_bit(match);
     }
 }
 
 void *dict_lookup(dict_t *dict, const char *key)
 {
-    dict_entry_t *e;
+    assert(key);
+    return dict_lookup_hash(dict, key, dict_hash(key, strlen(key)));
+}
+
+void *dict_lookup_hash(dict_t *dict, const char *key, size_t h)
+{
+    long i;
 
     assert(dict && key);
     while (dict) {
-        e = lookup(dict, key, hash(key));
-        if (e->key)
-            return e->val;
+        if ((i = lookup(dict, key, h)) >= 0)
+            return dict->table[i].val;
         dict = dict->link;
     }
     return NULL;
@@ -55,60 +150,95 @@ void *dict_lookup(dict_t *dict, const char *key)
 
 static void dict_resize(dict_t *dict, size_t new_size)
 {
-    dict_entry_t *e, *old = dict->table;
-    dict->table = calloc(new_size, sizeof(dict_entry_t));
-    dict->mask = new_size - 1;
-    size_t i = dict->used;
-    dict->used = 0;
+    signed char *old_ctrl = dict->ctrl;
+    dict_entry_t *old = dict->table;
+    size_t i, j, old_size = dict->mask + 1, used = dict->used;
 
-    for (e = old; i > 0; e++) {
-        if (e->key) {
-            dict_insert(dict, e->key, e->val, 0);
-            i--;
-        }
+    dict_alloc(dict, new_size);
+    /* keys are distinct and hashes are kept, just find free slots */
+    for (i = 0; i < old_size; i++) {
+        if (old_ctrl[i] < 0)
+            continue;
+        j = find_free(dict, old[i].hash);
+        dict->ctrl[j] = old_ctrl[i];
+        dict->table[j] = old[i];
     }
+    dict->used = used;
+    free(old_ctrl);
     free(old);
 }
 
 bool dict_insert(dict_t *dict, char *key, void *val, bool flag)
 {
-    dict_entry_t *e;
-    size_t h;
+    assert(key);
+    return dict_insert_hash(dict, key, dict_hash(key, strlen(key)), val, flag);
+}
+
+bool dict_insert_hash(dict_t *dict, char *key, size_t h, void *val, bool flag)
+{
+    long i;
+    size_t j;
 
     assert(dict && key);
-    h = hash(key);
-    e = lookup(dict, key, h);
-    if (!e->key) {
-        e->hash = h;
-        e->key = key;
-        e->val = val;
-        dict->used++;
-    } else {
+    if ((i = lookup(dict, key, h)) >= 0) {
         if (flag)
             return false;
-        else
-            e->val = val;
+        dict->table[i].val = val;
+        return true;
     }
 
-    if (dict->used * 3 >= (dict->mask + 1) * 2)
-        dict_resize(dict, (dict->mask + 1) * 2);
+    /* keep 1/8 of the slots empty so every probe sequence ends */
+    if ((dict->used + dict->deleted + 1) * 8 > (dict->mask + 1) * 7)
+        dict_resize(dict, (dict->used + 1) * 2 > dict->mask + 1 ? (dict->mask + 1) * 2 : dict->mask + 1);
+    j = find_free(dict, h);
+    if (dict->ctrl[j] == DICT_DELETED)
+        dict->deleted--;
+    dict->ctrl[j] = H2(h);
+    dict->table[j].hash = h;
+    dict->table[j].key = key;
+    dict->table[j].val = val;
+    dict->used++;
     return true;
 }
 
+void *dict_delete(dict_t *dict, const char *key)
+{
+    assert(key);
+    return dict_delete_hash(dict, key, dict_hash(key, strlen(key)));
+}
+
+void *dict_delete_hash(dict_t *dict, const char *key, size_t h)
+{
+    long i;
+
+    assert(dict && key);
+    if ((i = lookup(dict, key, h)) < 0)
+        return NULL;
+    /* a group that still has an empty slot never continued a probe */
+    if (group_match_empty(dict->ctrl + (i & ~(long) (DICT_GROUP - 1)))) {
+        dict->ctrl[i] = DICT_EMPTY;
+    } else {
+        dict->ctrl[i] = DICT_DELETED;
+        dict->deleted++;
+    }
+    dict->used--;
+    return dict->table[i].val;
+}
+
 void free_dict(dict_t *dict, void (*free_key)(char *), void (*free_val)(void *))
 {
-    dict_entry_t *e;
+    size_t i;
 
     assert(dict);
-    for (e = dict->table; dict->used > 0; e++) {
-        if (e->key) {
-            if (free_key)
-                (*free_key)(e->key);
-            if (free_val)
-                (*free_val)(e->val);
-            dict->used--;
-        }
+    for (i = 0; i <= dict->mask && (free_key || free_val); i++) {
+        if (dict->ctrl[i] < 0)
+            continue;
+        if (free_key)
+            (*free_key)(dict->table[i].key);
+        if (free_val)
+            (*free_val)(dict->table[i].val);
     }
+    free(dict->ctrl);
     free(dict->table);
     free(dict);
 }
@@ -10,20 +10,40 @@ typedef struct dict_entry_t {
     void *val;
 } dict_entry_t;
 
+/* Open addressing in groups of DICT_GROUP slots. ctrl holds one byte per
+ * slot: DICT_EMPTY, DICT_DELETED or the low 7 bits of the hash of the key
+ * stored there, so a whole group is matched at once and entries are only
+ * touched on a tag hit.
+ */
+#define DICT_GROUP 16
+#define DICT_EMPTY ((signed char) -128)
+#define DICT_DELETED ((signed char) -2)
+
 typedef struct dict_t {
     struct dict_t *link;
     size_t used;
+    /* tombstones left by dict_delete */
+    size_t deleted;
+    /* number of slots - 1, a multiple of DICT_GROUP - 1 */
     size_t mask;
+    signed char *ctrl;
     dict_entry_t *table;
 } dict_t;
 
+size_t dict_hash(const char *s, size_t len);
 dict_t *make_dict(dict_t *link);
 void *dict_lookup(dict_t *dict, const char *key);
+/* lookup with a precomputed hash, e.g. intern_hash(key) */
+void *dict_lookup_hash(dict_t *dict, const char *key, size_t hash);
 /* flag == true: insert if key is not in dict, if key is in dict, return false
  * flag == false: insert no matter whether key is in dict
  * succecc return true
  */
 bool dict_insert(dict_t *dict, char *key, void *val, bool flag);
+bool dict_insert_hash(dict_t *dict, char *key, size_t hash, void *val, bool flag);
+/* remove key from dict itself (not its links), return its value or NULL */
+void *dict_delete(dict_t *dict, const char *key);
+void *dict_delete_hash(dict_t *dict, const char *key, size_t hash);
 void free_dict(dict_t *dict, void (*free_key)(char *), void (*free_val)(void *));
 
 #endif
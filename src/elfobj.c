@@ -0,0 +1,602 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "elfobj.h"
+#include "encode.h"
+#include "util.h"
+
+#define ELF_INIT_SIZE 64
+
+#define ALIGN(n, a) (((n) + (a) - 1) / (a) * (a))
+
+/* dict values are counts + 1, NULL is not found */
+#define TO_VAL(n) ((void *) (uintptr_t) ((n) + 1))
+#define FROM_VAL(v) ((size_t) (uintptr_t) (v) - 1)
+
+enum {
+    ITEM_BYTES,
+    ITEM_JUMP,
+    ITEM_LABEL
+};
+
+#define GROW(array, n, size) \
+    do { \
+        if ((n) == (size)) { \
+            (size) = (size) ? (size) * 2 : ELF_INIT_SIZE; \
+            (array) = realloc(array, sizeof(*(array)) * (size)); \
+        } \
+    } while (0)
+
+void elf_init(elf_t *elf)
+{
+    assert(elf);
+    memset(elf, 0, sizeof(*elf));
+    elf->text = make_buffer();
+    elf->rodata = make_buffer();
+    elf->bytes = make_buffer();
+    elf->rodata_align = 1;
+    elf->labels = make_dict(NULL);
+    elf->symbols = make_dict(NULL);
+}
+
+/* .L labels stay out of the symbol table */
+static bool is_local(const char *label)
+{
+    return label[0] == '.' && label[1] == 'L';
+}
+
+/* symbols are numbered by their first mention, like as does */
+static size_t elf_symbol(elf_t *elf, const char *name)
+{
+    elf_sym_t *sym;
+    void *val;
+
+    if ((val = dict_lookup(elf->symbols, name)))
+        return FROM_VAL(val);
+    GROW(elf->syms, elf->nsyms, elf->syms_size);
+    sym = &elf->syms[elf->nsyms];
+    sym->name = strdup(name);
+    sym->defined = sym->func = false;
+    sym->value = 0;
+    dict_insert(elf->symbols, sym->name, TO_VAL(elf->nsyms), false);
+    return elf->nsyms++;
+}
+
+static size_t rodata_label(elf_t *elf, const char *label)
+{
+    void *val;
+
+    if (!(val = dict_lookup(elf->labels, label)))
+        errorf("undefined label %s\n", label);
+    return FROM_VAL(val);
+}
+
+static elf_item_t *new_item(elf_t *elf, int kind)
+{
+    elf_item_t *item;
+
+    GROW(elf->items, elf->nitems, elf->items_size);
+    item = &elf->items[elf->nitems++];
+    memset(item, 0, sizeof(*item));
+    item->kind = kind;
+    return item;
+}
+
+static void put_data(buffer_t *buf, long v, size_t size)
+{
+    unsigned char bytes[8];
+    size_t i;
+
+    for (i = 0; i < size; i++, v >>= 8)
+        bytes[i] = v & 0xff;
+    buffer_push(buf, bytes, size);
+}
+
+static void add_data(elf_t *elf, inst_t *inst)
+{
+    buffer_t *rodata = elf->rodata;
+    operand_t *arg = &inst->args[0];
+
+    if (!elf->in_rodata)
+        errorf("data outside of .rodata\n");
+    switch (inst->op) {
+    case OP_ALIGN:
+        while (rodata->top % arg->imm)
+            put_data(rodata, 0, 1);
+        if ((size_t) arg->imm > elf->rodata_align)
+            elf->rodata_align = arg->imm;
+        break;
+    case OP_LONG:
+        put_data(rodata, arg->imm, 4);
+        break;
+    case OP_QUAD:
+        put_data(rodata, arg->imm, 8);
+        break;
+    case OP_STRING:
+        buffer_push(rodata, arg->label, arg->imm);
+        put_data(rodata, 0, 1);
+        break;
+    }
+}
+
+static void add_label(elf_t *elf, dict_t *labels, const char *label)
+{
+    elf_item_t *item;
+
+    if (elf->in_rodata) {
+        if (dict_lookup(elf->labels, label))
+            errorf("label %s redefined\n", label);
+        dict_insert(elf->labels, strdup(label), TO_VAL(elf->rodata->top), false);
+        return;
+    }
+    item = new_item(elf, ITEM_LABEL);
+    item->label = label;
+    if (!is_local(label))
+        item->target = elf_symbol(elf, label);
+    else if (!dict_insert(labels, (char *) label, TO_VAL(elf->nitems - 1), true))
+        errorf("label %s redefined\n", label);
+}
+
+static void add_inst(elf_t *elf, inst_t *inst)
+{
+    unsigned char bytes[ENCODE_MAX];
+    elf_item_t *item;
+    fixup_t fix;
+    int len;
+
+    if (elf->in_rodata)
+        errorf("instruction outside of .text\n");
+    if (inst->op >= OP_JMP && inst->op <= OP_JNP) {
+        item = new_item(elf, ITEM_JUMP);
+        item->op = inst->op;
+        item->len = JUMP_SHORT;
+        item->label = inst->args[0].label;
+        return;
+    }
+    len = encode_inst(bytes, inst, &fix);
+    item = new_item(elf, ITEM_BYTES);
+    item->len = len;
+    item->start = elf->bytes->top;
+    buffer_push(elf->bytes, bytes, len);
+    item->type = fix.type;
+    item->pos = fix.pos;
+    switch (fix.type) {
+    case R_X86_64_NONE:
+        break;
+    case R_X86_64_PLT32:
+        item->target = elf_symbol(elf, fix.label) + 1;
+        item->addend = -(len - fix.pos);
+        break;
+    case R_X86_64_PC32:
+        /* the field is relative to the end of the instruction */
+        item->target = SYM_RODATA;
+        item->addend = rodata_label(elf, fix.label) - (len - fix.pos);
+        elf->rodata_sym = true;
+        break;
+    default:
+        item->target = SYM_RODATA;
+        item->addend = rodata_label(elf, fix.label);
+        elf->rodata_sym = true;
+        break;
+    }
+}
+
+/* jumps start short and only grow, so this ends with the same sizes as as */
+static void relax(elf_t *elf)
+{
+    elf_item_t *item, *items = elf->items;
+    size_t i, addr;
+    long disp;
+    bool changed;
+
+    do {
+        for (i = addr = 0; i < elf->nitems; i++) {
+            items[i].addr = addr;
+            addr += items[i].len;
+        }
+        changed = false;
+        for (i = 0; i < elf->nitems; i++) {
+            item = &items[i];
+            if (item->kind != ITEM_JUMP || item->len != JUMP_SHORT)
+                continue;
+            disp = (long) items[item->target].addr - (long) (item->addr + JUMP_SHORT);
+            if (disp < -128 || disp > 127) {
+                item->len = JUMP_NEAR(item->op);
+                changed = true;
+            }
+        }
+    } while (changed);
+}
+
+static void add_rela(elf_t *elf, size_t offset, elf_item_t *item)
+{
+    Elf64_Rela *rela;
+
+    GROW(elf->relas, elf->nrelas, elf->relas_size);
+    rela = &elf->relas[elf->nrelas++];
+    rela->r_offset = offset;
+    rela->r_info = ELF64_R_INFO(item->target, item->type);
+    rela->r_addend = item->addend;
+}
+
+void elf_add(elf_t *elf, code_t *code)
+{
+    unsigned char bytes[ENCODE_MAX];
+    elf_item_t *item;
+    inst_t *inst;
+    size_t i, base;
+    void *val;
+
+    assert(elf && code);
+    elf->locals = make_dict(NULL);
+    elf->nitems = 0;
+    elf->bytes->top = 0;
+    for (i = 0; i < code->ninsts; i++) {
+        inst = &code->insts[i];
+        switch (inst->op) {
+        case OP_TEXT:
+            elf->in_rodata = false;
+            break;
+        case OP_RODATA:
+            elf->in_rodata = elf->has_rodata = true;
+            break;
+        case OP_ALIGN:
+        case OP_LONG:
+        case OP_QUAD:
+        case OP_STRING:
+            add_data(elf, inst);
+            break;
+        case OP_GLOBL:
+            elf_symbol(elf, inst->args[0].label);
+            break;
+        case OP_TYPE_FUNC:
+            elf->syms[elf_symbol(elf, inst->args[0].label)].func = true;
+            break;
+        case OP_LABEL:
+            add_label(elf, elf->locals, inst->args[0].label);
+            break;
+
+        default:
+            add_inst(elf, inst);
+            break;
+        }
+    }
+
+    for (i = 0; i < elf->nitems; i++) {
+        item = &elf->items[i];
+        if (item->kind != ITEM_JUMP)
+            continue;
+        if (!(val = dict_lookup(elf->locals, item->label)))
+            errorf("undefined label %s\n", item->label);
+        item->target = FROM_VAL(val);
+    }
+    free_dict(elf->locals, NULL, NULL);
+    elf->locals = NULL;
+    relax(elf);
+
+    base = elf->text->top;
+    for (i = 0; i < elf->nitems; i++) {
+        item = &elf->items[i];
+        switch (item->kind) {
+        case ITEM_BYTES:
+            if (item->type != R_X86_64_NONE)
+                add_rela(elf, base + item->addr + item->pos, item);
+            buffer_push(elf->text, elf->bytes->stack + item->start, item->len);
+            break;
+        case ITEM_JUMP:
+            encode_jump(bytes, item->op,
+                    (long) elf->items[item->target].addr - (long) (item->addr + item->len), item->len);
+            buffer_push(elf->text, bytes, item->len);
+            break;
+        case ITEM_LABEL:
+            if (!is_local(item->label)) {
+                if (elf->syms[item->target].defined)
+                    errorf("symbol %s redefined\n", item->label);
+                elf->syms[item->target].defined = true;
+                elf->syms[item->target].value = base + item->addr;
+            }
+            break;
+        }
+    }
+}
+
+/***************************** elf_write ******************************/
+/* compare from the last character, a tail sorts before the longer string */
+static int tail_cmp(const void *a, const void *b, void *strs)
+{
+    const char **cmp_strs = strs;
+    const char *s = cmp_strs[*(const size_t *) a], *t = cmp_strs[*(const size_t *) b];
+    size_t i = strlen(s), j = strlen(t);
+
+    while (i > 0 && j > 0) {
+        i--;
+        j--;
+        if (s[i] != t[j])
+            return (unsigned char) s[i] - (unsigned char) t[j];
+    }
+    return (i > 0) - (j > 0);
+}
+
+/* Build a string table into buf and return the offset of each string.  A
+ * string that is the tail of a longer one points into it, the same table
+ * as ld's string merging gives.
+ */
+static size_t *make_strtab(const char **strs, size_t n, buffer_t *buf)
+{
+    size_t *order = malloc(sizeof(size_t) * (n + 1));
+    size_t *tail = malloc(sizeof(size_t) * (n + 1));
+    size_t *offs = malloc(sizeof(size_t) * (n + 1));
+    size_t i, j, e = n, elen = 0, len;
+
+    for (i = 0; i < n; i++)
+        order[i] = i;
+    qsort_r(order, n, sizeof(size_t), tail_cmp, strs);
+    /* from the longest, the earlier ones are tails or start a new run */
+    for (i = n; i-- > 0;) {
+        j = order[i];
+        len = strlen(strs[j]);
+        if (e < n && elen > len && !strcmp(strs[e] + elen - len, strs[j])) {
+            tail[j] = e;
+        } else {
+            tail[j] = n;
+            e = j;
+            elen = len;
+        }
+    }
+
+    put_data(buf, 0, 1);
+    for (i = 0; i < n; i++)
+        if (tail[i] == n) {
+            offs[i] = buf->top;
+            buffer_push(buf, strs[i], strlen(strs[i]) + 1);
+        }
+    for (i = 0; i < n; i++)
+        if (tail[i] != n)
+            offs[i] = offs[tail[i]] + strlen(strs[tail[i]]) - strlen(strs[i]);
+    free(order);
+    free(tail);
+    return offs;
+}
+
+/* pad with zeros to offset */
+static void out_pad(out_t *out, size_t *pos, size_t offset)
+{
+    static const char zeros[16];
+
+    assert(offset - *pos <= sizeof(zeros));
+    out_mem(out, zeros, offset - *pos);
+    *pos = offset;
+}
+
+static void out_section(out_t *out, size_t *pos, Elf64_Shdr *sh, const void *data)
+{
+    if (sh->sh_type == SHT_NOBITS || sh->sh_size == 0)
+        return;
+    out_pad(out, pos, sh->sh_offset);
+    out_mem(out, data, sh->sh_size);
+    *pos += sh->sh_size;
+}
+
+enum {
+    SEC_TEXT,
+    SEC_RELA_TEXT,
+    SEC_DATA,
+    SEC_BSS,
+    SEC_RODATA,
+    SEC_SYMTAB,
+    SEC_STRTAB,
+    SEC_SHSTRTAB,
+    SEC_NUM
+};
+
+static const char *sec_names[SEC_NUM] = {
+    [SEC_TEXT] = ".text",
+    [SEC_RELA_TEXT] = ".rela.text",
+    [SEC_DATA] = ".data",
+    [SEC_BSS] = ".bss",
+    [SEC_RODATA] = ".rodata",
+    [SEC_SYMTAB] = ".symtab",
+    [SEC_STRTAB] = ".strtab",
+    [SEC_SHSTRTAB] = ".shstrtab",
+};
+
+/* where as puts them: the contents, the tables, then the relocations */
+static const int file_order[SEC_NUM] = {
+    SEC_TEXT, SEC_DATA, SEC_BSS, SEC_RODATA,
+    SEC_SYMTAB, SEC_STRTAB, SEC_RELA_TEXT, SEC_SHSTRTAB
+};
+
+void elf_write(elf_t *elf, out_t *out)
+{
+    /* section index of each SEC_*, 0 if it is left out */
+    int idx[SEC_NUM], nsecs = 1, i, nlocals;
+    Elf64_Shdr shdrs[SEC_NUM + 1], *sh;
+    const char *names[SEC_NUM], **sym_names;
+    const void *data[SEC_NUM + 1];
+    buffer_t *strtab, *shstrtab;
+    size_t *offs, j, n, pos, offset;
+    Elf64_Sym *syms, *sym;
+    Elf64_Rela *rela;
+    Elf64_Ehdr ehdr;
+    elf_sym_t *s;
+
+    assert(elf && out);
+    for (i = 0; i < SEC_NUM; i++)
+        idx[i] = 0;
+    for (i = 0; i < SEC_NUM; i++)
+        if ((i != SEC_RELA_TEXT || elf->nrelas) && (i != SEC_RODATA || elf->has_rodata))
+            idx[i] = nsecs++;
+
+    /* symbols: the .rodata section if a relocation needs it, then globals */
+    nlocals = 1 + elf->rodata_sym;
+    syms = calloc(nlocals + elf->nsyms, sizeof(Elf64_Sym));
+    if (elf->rodata_sym) {
+        syms[1].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+        syms[1].st_shndx = idx[SEC_RODATA];
+    }
+    sym_names = malloc(sizeof(char *) * (elf->nsyms + 1));
+    for (j = 0; j < elf->nsyms; j++)
+        sym_names[j] = elf->syms[j].name;
+    strtab = make_buffer();
+    offs = make_strtab(sym_names, elf->nsyms, strtab);
+    for (j = 0; j < elf->nsyms; j++) {
+        s = &elf->syms[j];
+        sym = &syms[nlocals + j];
+        sym->st_name = offs[j];
+        sym->st_info = ELF64_ST_INFO(STB_GLOBAL, s->func ? STT_FUNC : STT_NOTYPE);
+        sym->st_shndx = s->defined ? idx[SEC_TEXT] : SHN_UNDEF;
+        sym->st_value = s->value;
+    }
+    free(offs);
+    free(sym_names);
+
+    for (j = 0; j < elf->nrelas; j++) {
+        rela = &elf->relas[j];
+        n = ELF64_R_SYM(rela->r_info);
+        n = (n == SYM_RODATA) ? 1 : nlocals + n - 1;
+        rela->r_info = ELF64_R_INFO(n, ELF64_R_TYPE(rela->r_info));
+    }
+
+    /* as enters the names of the sections it makes itself first */
+    n = 0;
+    names[n++] = sec_names[SEC_SYMTAB];
+    names[n++] = sec_names[SEC_STRTAB];
+    names[n++] = sec_names[SEC_SHSTRTAB];
+    for (i = 0; i < SEC_SYMTAB; i++)
+        if (idx[i])
+            names[n++] = sec_names[i];
+    shstrtab = make_buffer();
+    offs = make_strtab(names, n, shstrtab);
+
+    memset(shdrs, 0, sizeof(shdrs));
+    memset(data, 0, sizeof(data));
+    for (i = 0; i < SEC_NUM; i++) {
+        if (!idx[i])
+            continue;
+        sh = &shdrs[idx[i]];
+        for (j = 0; j < n; j++)
+            if (names[j] == sec_names[i])
+                sh->sh_name = offs[j];
+        sh->sh_addralign = 1;
+        switch (i) {
+        case SEC_TEXT:
+            sh->sh_type = SHT_PROGBITS;
+            sh->sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+            sh->sh_size = elf->text->top;
+            data[idx[i]] = elf->text->stack;
+            break;
+        case SEC_RELA_TEXT:
+            sh->sh_type = SHT_RELA;
+            sh->sh_flags = SHF_INFO_LINK;
+            sh->sh_size = elf->nrelas * sizeof(Elf64_Rela);
+            sh->sh_link = idx[SEC_SYMTAB];
+            sh->sh_info = idx[SEC_TEXT];
+            sh->sh_addralign = 8;
+            sh->sh_entsize = sizeof(Elf64_Rela);
+            data[idx[i]] = elf->relas;
+            break;
+        case SEC_DATA:
+            sh->sh_type = SHT_PROGBITS;
+            sh->sh_flags = SHF_WRITE | SHF_ALLOC;
+            break;
+        case SEC_BSS:
+            sh->sh_type = SHT_NOBITS;
+            sh->sh_flags = SHF_WRITE | SHF_ALLOC;
+            break;
+        case SEC_RODATA:
+            sh->sh_type = SHT_PROGBITS;
+            sh->sh_flags = SHF_ALLOC;
+            sh->sh_size = elf->rodata->top;
+            sh->sh_addralign = elf->rodata_align;
+            data[idx[i]] = elf->rodata->stack;
+            break;
+        case SEC_SYMTAB:
+            sh->sh_type = SHT_SYMTAB;
+            sh->sh_size = (nlocals + elf->nsyms) * sizeof(Elf64_Sym);
+            sh->sh_link = idx[SEC_STRTAB];
+            sh->sh_info = nlocals;
+            sh->sh_addralign = 8;
+            sh->sh_entsize = sizeof(Elf64_Sym);
+            data[idx[i]] = syms;
+            break;
+        case SEC_STRTAB:
+            sh->sh_type = SHT_STRTAB;
+            sh->sh_size = strtab->top;
+            data[idx[i]] = strtab->stack;
+            break;
+        case SEC_SHSTRTAB:
+            sh->sh_type = SHT_STRTAB;
+            sh->sh_size = shstrtab->top;
+            data[idx[i]] = shstrtab->stack;
+            break;
+        }
+    }
+    free(offs);
+
+    offset = sizeof(Elf64_Ehdr);
+    for (i = 0; i < SEC_NUM; i++) {
+        if (!idx[file_order[i]])
+            continue;
+        sh = &shdrs[idx[file_order[i]]];
+        offset = ALIGN(offset, sh->sh_addralign);
+        sh->sh_offset = offset;
+        if (sh->sh_type != SHT_NOBITS)
+            offset += sh->sh_size;
+    }
+
+    memset(&ehdr, 0, sizeof(ehdr));
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_NONE;
+    ehdr.e_type = ET_REL;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_shoff = ALIGN(offset, 8);
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shnum = nsecs;
+    ehdr.e_shstrndx = idx[SEC_SHSTRTAB];
+
+    out_mem(out, (const char *) &ehdr, sizeof(ehdr));
+    pos = sizeof(ehdr);
+    for (i = 0; i < SEC_NUM; i++) {
+        if (idx[file_order[i]])
+            out_section(out, &pos, &shdrs[idx[file_order[i]]], data[idx[file_order[i]]]);
+    }
+    out_pad(out, &pos, ehdr.e_shoff);
+    out_mem(out, (const char *) shdrs, sizeof(Elf64_Shdr) * nsecs);
+
+    free(syms);
+    free_buffer(strtab);
+    free_buffer(shstrtab);
+}
+
+static void free_key(char *key)
+{
+    free(key);
+}
+
+void elf_close(elf_t *elf)
+{
+    size_t i;
+
+    assert(elf);
+    free_buffer(elf->text);
+    free_buffer(elf->rodata);
+    free_buffer(elf->bytes);
+    /* syms own the keys of symbols */
+    free_dict(elf->labels, free_key, NULL);
+    free_dict(elf->symbols, NULL, NULL);
+    /* left by an error in elf_add */
+    if (elf->locals)
+        free_dict(elf->locals, NULL, NULL);
+    for (i = 0; i < elf->nsyms; i++)
+        free(elf->syms[i].name);
+    free(elf->syms);
+    free(elf->relas);
+    free(elf->items);
+}
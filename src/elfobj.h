@@ -0,0 +1,83 @@
+#ifndef ELFOBJ_H__
+#define ELFOBJ_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <elf.h>
+#include "inst.h"
+#include "buffer.h"
+#include "dict.h"
+#include "out.h"
+
+typedef struct elf_sym_t {
+    char *name;
+    bool defined;
+    bool func;
+    /* offset in .text */
+    size_t value;
+} elf_sym_t;
+
+/* the relocation symbol of .rodata, others are symbol index + 1 */
+#define SYM_RODATA 0
+
+/* an encoded instruction, jump or label of the definition being added */
+typedef struct elf_item_t {
+    unsigned char kind;
+    /* of a jump */
+    unsigned char op;
+    unsigned char len;
+    /* relocation of the 32 bit field at pos, R_X86_64_NONE if none */
+    unsigned char type;
+    unsigned char pos;
+    /* of the encoded bytes in elf_t.bytes */
+    size_t start;
+    /* offset in the definition */
+    size_t addr;
+    /* item of a jump target, symbol of a label or a relocation */
+    size_t target;
+    long addend;
+    /* jump target until it is resolved */
+    const char *label;
+} elf_item_t;
+
+/* A relocatable object written without as(1): .text, .rodata, the
+ * symbols and the relocations of .text.
+ */
+typedef struct elf_t {
+    buffer_t *text;
+    buffer_t *rodata;
+    /* a .section .rodata was seen */
+    bool has_rodata;
+    /* the current section */
+    bool in_rodata;
+    size_t rodata_align;
+    /* a relocation refers to the .rodata section symbol */
+    bool rodata_sym;
+    /* .rodata labels, offset + 1 */
+    dict_t *labels;
+    /* index + 1 in syms */
+    dict_t *symbols;
+    /* .L labels of the definition being added, item index + 1 */
+    dict_t *locals;
+    elf_sym_t *syms;
+    size_t nsyms;
+    size_t syms_size;
+    /* r_info holds SYM_RODATA or index + 1 in syms until elf_write */
+    Elf64_Rela *relas;
+    size_t nrelas;
+    size_t relas_size;
+    /* scratch of elf_add */
+    elf_item_t *items;
+    size_t nitems;
+    size_t items_size;
+    buffer_t *bytes;
+} elf_t;
+
+void elf_init(elf_t *elf);
+/* encode the instructions and directives of a definition */
+void elf_add(elf_t *elf, code_t *code);
+/* write the object file */
+void elf_write(elf_t *elf, out_t *out);
+void elf_close(elf_t *elf);
+
+#endif
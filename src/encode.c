@@ -0,0 +1,424 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <elf.h>
+#include "encode.h"
+#include "util.h"
+
+/* condition codes of jcc and setcc */
+static const unsigned char cc[OP_NUM] = {
+    [OP_JE] = 0x4,
+    [OP_JNE] = 0x5,
+    [OP_JP] = 0xa,
+    [OP_JNP] = 0xb,
+    [OP_SETL] = 0xc,
+    [OP_SETG] = 0xf,
+    [OP_SETLE] = 0xe,
+    [OP_SETGE] = 0xd,
+    [OP_SETE] = 0x4,
+    [OP_SETNE] = 0x5,
+    [OP_SETA] = 0x7,
+    [OP_SETAE] = 0x3,
+    [OP_SETNA] = 0x6,
+    [OP_SETNAE] = 0x2,
+    [OP_SETP] = 0xa,
+    [OP_SETNP] = 0xb,
+};
+
+/* opcode of the byte form "op r8, r/m8" and /digit of the immediate forms */
+static const struct {
+    unsigned char opcode;
+    unsigned char digit;
+} alu[OP_NUM] = {
+    [OP_ADD] = {0x00, 0},
+    [OP_OR] = {0x08, 1},
+    [OP_AND] = {0x20, 4},
+    [OP_SUB] = {0x28, 5},
+    [OP_XOR] = {0x30, 6},
+    [OP_CMP] = {0x38, 7},
+};
+
+/* mandatory prefix and opcode, the reg field is the destination */
+static const struct {
+    unsigned char prefix;
+    unsigned short opcode;
+} sse[OP_NUM] = {
+    [OP_MOVSS] = {0xf3, 0x0f10},
+    [OP_MOVSD] = {0xf2, 0x0f10},
+    [OP_ADDSS] = {0xf3, 0x0f58},
+    [OP_ADDSD] = {0xf2, 0x0f58},
+    [OP_SUBSS] = {0xf3, 0x0f5c},
+    [OP_SUBSD] = {0xf2, 0x0f5c},
+    [OP_MULSS] = {0xf3, 0x0f59},
+    [OP_MULSD] = {0xf2, 0x0f59},
+    [OP_DIVSS] = {0xf3, 0x0f5e},
+    [OP_DIVSD] = {0xf2, 0x0f5e},
+    [OP_XORPS] = {0, 0x0f57},
+    [OP_XORPD] = {0x66, 0x0f57},
+    [OP_UCOMISS] = {0, 0x0f2e},
+    [OP_UCOMISD] = {0x66, 0x0f2e},
+    [OP_CVTSI2SS] = {0xf3, 0x0f2a},
+    [OP_CVTSI2SD] = {0xf2, 0x0f2a},
+    [OP_CVTSS2SI] = {0xf3, 0x0f2d},
+    [OP_CVTTSD2SI] = {0xf2, 0x0f2c},
+    [OP_CVTPS2PD] = {0, 0x0f5a},
+    [OP_CVTPD2PS] = {0x66, 0x0f5a},
+};
+
+typedef struct enc_t {
+    unsigned char *start;
+    unsigned char *p;
+    fixup_t *fix;
+} enc_t;
+
+static void put_byte(enc_t *e, int b)
+{
+    *e->p++ = b;
+}
+
+/* little endian */
+static void put_imm(enc_t *e, long v, int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++, v >>= 8)
+        *e->p++ = v & 0xff;
+}
+
+static void put_fixup(enc_t *e, int type, const char *label)
+{
+    e->fix->type = type;
+    e->fix->pos = e->p - e->start;
+    e->fix->label = label;
+    put_imm(e, 0, 4);
+}
+
+static bool fits8(long v)
+{
+    return v >= -128 && v <= 127;
+}
+
+static bool fits32(long v)
+{
+    return v >= -2147483648L && v <= 2147483647L;
+}
+
+/* the value the CPU sees in an immediate of size bytes */
+static long sign_extend(long v, int size)
+{
+    switch (size) {
+    case 1:
+        return (signed char) v;
+    case 2:
+        return (short) v;
+    case 4:
+        return (int) v;
+    }
+    return v;
+}
+
+/* the low 4 bits of the register number */
+static int regnum(int reg)
+{
+    return reg >= REG_XMM0 ? reg - REG_XMM0 : reg;
+}
+
+/* %spl, %bpl, %sil and %dil only exist with a REX prefix */
+static bool need_rex8(int reg)
+{
+    return reg >= REG_SP && reg <= REG_DI;
+}
+
+/* [prefix] [66] [REX] opcode ModRM [SIB] [disp] with reg in the reg field
+ * and rm in r/m.  size 2 adds the operand size prefix, size 8 sets REX.W,
+ * byte_reg says reg is an 8 bit register rather than an opcode extension.
+ */
+static void put_rm(enc_t *e, int prefix, int size, int opcode, int reg, bool byte_reg, operand_t *rm)
+{
+    int rex, r = regnum(reg), b;
+
+    if (prefix)
+        put_byte(e, prefix);
+    if (size == 2)
+        put_byte(e, 0x66);
+    rex = (size == 8) << 3 | (r & 8) >> 1;
+    if (rm->kind == OPND_REG)
+        rex |= (regnum(rm->reg) & 8) >> 3;
+    else if (rm->reg != REG_RIP)
+        rex |= (rm->reg & 8) >> 3;
+    if (rex || (byte_reg && need_rex8(reg)) ||
+            (rm->kind == OPND_REG && rm->size == 1 && need_rex8(rm->reg)))
+        put_byte(e, 0x40 | rex);
+    if (opcode > 0xff)
+        put_byte(e, opcode >> 8);
+    put_byte(e, opcode & 0xff);
+
+    r &= 7;
+    if (rm->kind == OPND_REG) {
+        put_byte(e, 0xc0 | r << 3 | (regnum(rm->reg) & 7));
+        return;
+    }
+    assert(rm->kind == OPND_MEM);
+    if (rm->reg == REG_RIP) {
+        put_byte(e, r << 3 | 5);
+        put_fixup(e, R_X86_64_PC32, rm->label);
+        return;
+    }
+    b = rm->reg & 7;
+    /* (%rbp) and (%r13) have no mod 0 form */
+    if (rm->imm == 0 && b != REG_BP)
+        put_byte(e, r << 3 | b);
+    else if (fits8(rm->imm))
+        put_byte(e, 0x40 | r << 3 | b);
+    else
+        put_byte(e, 0x80 | r << 3 | b);
+    /* %rsp and %r12 as a base need a SIB byte */
+    if (b == REG_SP)
+        put_byte(e, 0x24);
+    if (rm->imm != 0 || b == REG_BP)
+        put_imm(e, rm->imm, fits8(rm->imm) ? 1 : 4);
+}
+
+static void put_digit(enc_t *e, int size, int opcode, int digit, operand_t *rm)
+{
+    put_rm(e, 0, size, opcode, digit, false, rm);
+}
+
+/* opcode + the low bits of reg, with REX.B and REX.W as needed */
+static void put_plus_reg(enc_t *e, int size, int opcode, int reg)
+{
+    int rex = (size == 8) << 3 | (reg & 8) >> 3;
+
+    if (size == 2)
+        put_byte(e, 0x66);
+    if (rex || (size == 1 && need_rex8(reg)))
+        put_byte(e, 0x40 | rex);
+    put_byte(e, opcode + (reg & 7));
+}
+
+static void encode_mov(enc_t *e, int size, operand_t *src, operand_t *dst)
+{
+    int w = size != 1;
+
+    switch (src->kind) {
+    case OPND_IMM:
+        if (dst->kind == OPND_MEM) {
+            put_digit(e, size, 0xc6 + w, 0, dst);
+            put_imm(e, src->imm, size < 4 ? size : 4);
+        } else if (size != 8) {
+            put_plus_reg(e, size, w ? 0xb8 : 0xb0, dst->reg);
+            put_imm(e, src->imm, size);
+        } else if (fits32(src->imm)) {
+            put_digit(e, size, 0xc7, 0, dst);
+            put_imm(e, src->imm, 4);
+        } else {
+            /* movabs */
+            put_plus_reg(e, size, 0xb8, dst->reg);
+            put_imm(e, src->imm, 8);
+        }
+        break;
+    case OPND_ADDR:
+        if (size == 8) {
+            put_digit(e, size, 0xc7, 0, dst);
+            put_fixup(e, R_X86_64_32S, src->label);
+        } else {
+            put_plus_reg(e, size, 0xb8, dst->reg);
+            put_fixup(e, R_X86_64_32, src->label);
+        }
+        break;
+    case OPND_REG:
+        put_rm(e, 0, size, 0x88 + w, src->reg, size == 1, dst);
+        break;
+    case OPND_MEM:
+        put_rm(e, 0, size, 0x8a + w, dst->reg, size == 1, src);
+        break;
+
+    default:
+        errorf("invalid mov operands\n");
+        break;
+    }
+}
+
+static void encode_alu(enc_t *e, int op, int size, operand_t *src, operand_t *dst)
+{
+    int w = size != 1;
+    long imm;
+
+    switch (src->kind) {
+    case OPND_IMM:
+        imm = sign_extend(src->imm, size);
+        /* the shortest form wins, like as does */
+        if (size == 1 && dst->kind == OPND_REG && dst->reg == REG_AX) {
+            put_byte(e, alu[op].opcode + 4);
+            put_imm(e, imm, 1);
+        } else if (size == 1) {
+            put_digit(e, size, 0x80, alu[op].digit, dst);
+            put_imm(e, imm, 1);
+        } else if (fits8(imm)) {
+            put_digit(e, size, 0x83, alu[op].digit, dst);
+            put_imm(e, imm, 1);
+        } else if (dst->kind == OPND_REG && dst->reg == REG_AX) {
+            put_plus_reg(e, size, alu[op].opcode + 5, REG_AX);
+            put_imm(e, imm, size == 2 ? 2 : 4);
+        } else {
+            put_digit(e, size, 0x81, alu[op].digit, dst);
+            put_imm(e, imm, size == 2 ? 2 : 4);
+        }
+        break;
+    case OPND_REG:
+        put_rm(e, 0, size, alu[op].opcode + w, src->reg, size == 1, dst);
+        break;
+    case OPND_MEM:
+        put_rm(e, 0, size, alu[op].opcode + 2 + w, dst->reg, size == 1, src);
+        break;
+
+    default:
+        errorf("invalid operands\n");
+        break;
+    }
+}
+
+static void encode_shift(enc_t *e, int op, int size, operand_t *src, operand_t *dst)
+{
+    int w = size != 1, digit = (op == OP_SAL) ? 4 : 7;
+
+    if (src->kind == OPND_REG) {
+        /* by %cl */
+        put_digit(e, size, 0xd2 + w, digit, dst);
+    } else if (src->imm == 1) {
+        put_digit(e, size, 0xd0 + w, digit, dst);
+    } else {
+        put_digit(e, size, 0xc0 + w, digit, dst);
+        put_imm(e, src->imm, 1);
+    }
+}
+
+static void encode_sse(enc_t *e, int op, operand_t *src, operand_t *dst)
+{
+    int size = 0;
+
+    if (op == OP_CVTSI2SS || op == OP_CVTSI2SD)
+        size = src->size;
+    else if (op == OP_CVTSS2SI || op == OP_CVTTSD2SI)
+        size = dst->size;
+    if (size != 8)
+        size = 0;
+    /* movss/movsd to memory */
+    if (dst->kind == OPND_MEM)
+        put_rm(e, sse[op].prefix, size, sse[op].opcode + 1, src->reg, false, dst);
+    else
+        put_rm(e, sse[op].prefix, size, sse[op].opcode, dst->reg, false, src);
+}
+
+int encode_inst(unsigned char *p, inst_t *inst, fixup_t *fix)
+{
+    enc_t enc = {p, p, fix}, *e = &enc;
+    operand_t *a = &inst->args[0], *b = &inst->args[1];
+    int size = inst->size, w = size != 1;
+
+    assert(p && inst && fix);
+    fix->type = R_X86_64_NONE;
+    switch (inst->op) {
+    case OP_MOV:
+        encode_mov(e, size, a, b);
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_CMP:
+        encode_alu(e, inst->op, size, a, b);
+        break;
+    case OP_IMUL:
+        put_rm(e, 0, size, 0x0faf, b->reg, false, a);
+        break;
+    case OP_IDIV:
+        put_digit(e, size, 0xf6 + w, 7, a);
+        break;
+    case OP_NEG:
+        put_digit(e, size, 0xf6 + w, 3, a);
+        break;
+    case OP_NOT:
+        put_digit(e, size, 0xf6 + w, 2, a);
+        break;
+    case OP_SAL:
+    case OP_SAR:
+        encode_shift(e, inst->op, size, a, b);
+        break;
+    case OP_TEST:
+        put_rm(e, 0, size, 0x84 + w, a->reg, size == 1, b);
+        break;
+    case OP_LEA:
+        put_rm(e, 0, size, 0x8d, b->reg, false, a);
+        break;
+    case OP_PUSH:
+        put_plus_reg(e, 0, 0x50, a->reg);
+        break;
+    case OP_POP:
+        put_plus_reg(e, 0, 0x58, a->reg);
+        break;
+    case OP_MOVZB:
+        put_rm(e, 0, b->size, 0x0fb6, b->reg, false, a);
+        break;
+    case OP_CLTQ:
+        put_byte(e, 0x48);
+        put_byte(e, 0x98);
+        break;
+    case OP_CLTD:
+        put_byte(e, 0x99);
+        break;
+    case OP_SETL:
+    case OP_SETG:
+    case OP_SETLE:
+    case OP_SETGE:
+    case OP_SETE:
+    case OP_SETNE:
+    case OP_SETA:
+    case OP_SETAE:
+    case OP_SETNA:
+    case OP_SETNAE:
+    case OP_SETP:
+    case OP_SETNP:
+        put_digit(e, 0, 0x0f90 | cc[inst->op], 0, a);
+        break;
+    case OP_CALL:
+        put_byte(e, 0xe8);
+        put_fixup(e, R_X86_64_PLT32, a->label);
+        break;
+    case OP_LEAVE:
+        put_byte(e, 0xc9);
+        break;
+    case OP_RET:
+        put_byte(e, 0xc3);
+        break;
+
+    default:
+        if (inst->op >= OP_MOVSS && inst->op <= OP_CVTPD2PS)
+            encode_sse(e, inst->op, a, b);
+        else
+            errorf("can't encode instruction %d\n", inst->op);
+        break;
+    }
+    assert(e->p - p <= ENCODE_MAX);
+    return e->p - p;
+}
+
+int encode_jump(unsigned char *p, int op, long disp, int len)
+{
+    enc_t enc = {p, p, NULL}, *e = &enc;
+
+    assert(op >= OP_JMP && op <= OP_JNP);
+    if (len == JUMP_SHORT) {
+        assert(fits8(disp));
+        put_byte(e, op == OP_JMP ? 0xeb : 0x70 | cc[op]);
+        put_imm(e, disp, 1);
+    } else if (op == OP_JMP) {
+        put_byte(e, 0xe9);
+        put_imm(e, disp, 4);
+    } else {
+        put_byte(e, 0x0f);
+        put_byte(e, 0x80 | cc[op]);
+        put_imm(e, disp, 4);
+    }
+    return e->p - p;
+}
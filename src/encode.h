@@ -0,0 +1,28 @@
+#ifndef ENCODE_H__
+#define ENCODE_H__
+
+#include "inst.h"
+
+/* the longest x86-64 instruction */
+#define ENCODE_MAX 15
+
+/* jmp and jcc with an 8 bit displacement */
+#define JUMP_SHORT 2
+/* and with a 32 bit one */
+#define JUMP_NEAR(op) ((op) == OP_JMP ? 5 : 6)
+
+/* a 32 bit field of an encoded instruction that refers to a label */
+typedef struct fixup_t {
+    /* R_X86_64_*, R_X86_64_NONE if there is none */
+    int type;
+    /* of the field in the instruction */
+    int pos;
+    const char *label;
+} fixup_t;
+
+/* encode inst at p and return its length, the same bytes as as(1) */
+int encode_inst(unsigned char *p, inst_t *inst, fixup_t *fix);
+/* encode a jump of len bytes, disp counts from the end of it */
+int encode_jump(unsigned char *p, int op, long disp, int len);
+
+#endif
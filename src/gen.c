@@ -1,55 +1,54 @@
-#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <assert.h>
 #include "gen.h"
 #include "util.h"
 
-static char suffix[9] = {0, 'b', 'w', 0, 'l', 0, 0, 0, 'q'};
-static char *arg_regs[9][6] = {
-    {NULL},
-    {"%dil", "%sil", "%dl", "%cl", "%r8b", "%r9b"}, /* 1 */
-    {"%di",  "%si",  "%dx", "%cx", "%r8w", "%r9w"}, /* 2 */
-    {NULL},
-    {"%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d"}, /* 4 */
-    {NULL}, {NULL}, {NULL},
-    {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"} /* 8 */
-};
-static char *rax[9] = {NULL, "%al", "%ax", NULL, "%eax", NULL, NULL, NULL, "%rax"};
-static char *rcx[9] = {NULL, "%cl", "%cx", NULL, "%ecx", NULL, NULL, NULL, "%rcx"};
+static int arg_regs[6] = {REG_DI, REG_SI, REG_DX, REG_CX, REG_R8, REG_R9};
 
 #if 0
 static char *caller_saves[] = {"%r10", "%r11", NULL};
 static char *callee_saves[] = {"%rbx", "%r12", "%r13", "%r14", "%r15", NULL};
 #endif
 
-static int offset;
+#define NODE(id) AST_NODE(gen->ast, id)
+#define KID(list, i) AST_KID(gen->ast, list, i)
 
-#define EMIT(fmt, ...) fprintf(fp, "\t" fmt "\n", ##__VA_ARGS__)
-#define EMIT_LABEL(label) fprintf(fp, "%s:\n", label)
-#define EMIT_INST(inst, size, fmt, ...) \
-    fprintf(fp, "\t%s%c    " fmt "\n", inst, suffix[size], ##__VA_ARGS__)
+#define EMIT0(op) code_append(gen->code, op, 0, NONE(), NONE())
+#define EMIT1(op, size, a) code_append(gen->code, op, size, a, NONE())
+#define EMIT2(op, size, a, b) code_append(gen->code, op, size, a, b)
+#define EMIT_LABEL(label) EMIT1(OP_LABEL, 0, LABEL(label))
 
-#define PUSH(fmt, ...) \
+#define RAX(size) REG(REG_AX, size)
+#define RCX(size) REG(REG_CX, size)
+/* -off(%rbp) */
+#define RBP(off) MEM(REG_BP, -(off))
+/* the float or double form of an SSE instruction */
+#define SSE(op, ctype) ((op) + ((ctype) != ctype_float))
+
+#define PUSH(reg) \
     do { \
-        fprintf(fp, "\tpushq   " fmt "\n", ##__VA_ARGS__); \
-        offset += 8; \
+        EMIT1(OP_PUSH, 8, REG(reg, 8)); \
+        gen->offset += 8; \
     } while (0)
-#define POP(fmt, ...) \
+#define POP(reg) \
     do { \
-        fprintf(fp, "\tpopq    " fmt "\n", ##__VA_ARGS__); \
-        offset -= 8; \
+        EMIT1(OP_POP, 8, REG(reg, 8)); \
+        gen->offset -= 8; \
     } while (0)
 
 #define PUSH_XMM(n) \
     do { \
-        EMIT("subq    $8, %%rsp"); \
-        EMIT("movsd   %%xmm%d, (%%rsp)", n); \
-        offset += 8; \
+        EMIT2(OP_SUB, 8, IMM(8), REG(REG_SP, 8)); \
+        EMIT2(OP_MOVSD, 0, XMM(n), MEM(REG_SP, 0)); \
+        gen->offset += 8; \
     } while (0)
 #define POP_XMM(n) \
     do { \
-        EMIT("movsd   (%%rsp), %%xmm%d", n); \
-        EMIT("addq    $8, %%rsp"); \
-        offset -= 8; \
+        EMIT2(OP_MOVSD, 0, MEM(REG_SP, 0), XMM(n)); \
+        EMIT2(OP_ADD, 8, IMM(8), REG(REG_SP, 8)); \
+        gen->offset -= 8; \
     } while (0)
 
 static bool is_float(ctype_t *ctype)
@@ -65,23 +64,74 @@ static int align(int m, int n)
     return mod == 0 ? m : m - mod + n;
 }
 
-static char *make_jump_label(void)
+/* room for any number, gen_merge renumbers labels in place */
+#define LABEL_SIZE 16
+#define GEN_LABELS_INIT_SIZE 64
+
+/* a label name owned by gen, freed by gen_reset */
+static char *new_name(gen_t *gen)
+{
+    if (gen->nnames == gen->names_size) {
+        gen->names_size = gen->names_size ? gen->names_size * 2 : GEN_LABELS_INIT_SIZE;
+        gen->names = realloc(gen->names, sizeof(char *) * gen->names_size);
+    }
+    return gen->names[gen->nnames++] = malloc(LABEL_SIZE);
+}
+
+static void free_names(gen_t *gen)
+{
+    while (gen->nnames > 0)
+        free(gen->names[--gen->nnames]);
+}
+
+static char *make_label(gen_t *gen, bool data)
+{
+    char *name = new_name(gen);
+
+    if (data)
+        snprintf(name, LABEL_SIZE, ".LC%d", gen->ndata++);
+    else
+        snprintf(name, LABEL_SIZE, ".L%d", gen->njump++);
+    if (gen->local) {
+        if (gen->nlabels == gen->labels_size) {
+            gen->labels_size = gen->labels_size ? gen->labels_size * 2 : GEN_LABELS_INIT_SIZE;
+            gen->labels = realloc(gen->labels, sizeof(gen_label_t) * gen->labels_size);
+        }
+        gen->labels[gen->nlabels++] = (gen_label_t){name, data, -1, 0, 0};
+    }
+    return name;
+}
+
+static char *make_jump_label(gen_t *gen)
 {
-    static int n = 0;
-    return format(".L%d", n++);
+    return make_label(gen, false);
 }
 
-static char *make_data_label(void)
+static char *make_data_label(gen_t *gen)
 {
-    static int n = 0;
-    return format(".LC%d", n++);
+    return make_label(gen, true);
+}
+
+/* the data of constant k was emitted from start on, under the last label */
+static void mark_const(gen_t *gen, int k, size_t start)
+{
+    gen_label_t *label;
+
+    if (!gen->local)
+        return;
+    label = &gen->labels[gen->nlabels - 1];
+    assert(label->name == gen->consts[k]);
+    label->konst = k;
+    label->start = start;
+    label->end = gen->code->ninsts;
 }
 
-static void emit_compound_stmt(FILE *fp, node_t *node);
-static void emit_assign(FILE *fp, node_t *dst, char *src);
-static void emit_cmp_0(FILE *fp, node_t *node);
+static void emit_node(gen_t *gen, node_t *node);
+static void emit_compound_stmt(gen_t *gen, node_t *node);
+static void emit_assign(gen_t *gen, node_t *dst, int src);
+static void emit_cmp_0(gen_t *gen, node_t *node);
 
-static void emit_constant(FILE *fp, node_t *node)
+static void emit_constant(gen_t *gen, node_t *node)
 {
     int size;
     union {
@@ -94,151 +144,148 @@ static void emit_constant(FILE *fp, node_t *node)
     assert(node && node->type == NODE_CONSTANT);
     size = node->ctype->size;
     if (!is_float(node->ctype)) {
-        EMIT_INST("mov", size, "$%ld, %s", node->ival, rax[size]);
+        EMIT2(OP_MOV, size, IMM(node->ival), RAX(size));
     } else {
-        EMIT(".section\t.rodata");
-        EMIT(".align %d", node->ctype->size);
-        node->flabel = make_data_label();
+        EMIT0(OP_RODATA);
+        EMIT1(OP_ALIGN, 0, IMM(node->ctype->size));
+        node->flabel = make_data_label(gen);
         EMIT_LABEL(node->flabel);
         if (node->ctype == ctype_float) {
             s.f = node->fval;
-            EMIT(".long   %d", s.i);
-            EMIT(".text");
-            EMIT("movss   %s(%%rip), %%xmm0", node->flabel);
+            EMIT1(OP_LONG, 0, IMM(s.i));
+            EMIT0(OP_TEXT);
+            EMIT2(OP_MOVSS, 0, RIP(node->flabel), XMM(0));
         } else {
             s.d = node->fval;
-            EMIT(".quad   %ld", s.l);
-            EMIT(".text");
-            EMIT("movsd   %s(%%rip), %%xmm0", node->flabel);
+            EMIT1(OP_QUAD, 0, IMM(s.l));
+            EMIT0(OP_TEXT);
+            EMIT2(OP_MOVSD, 0, RIP(node->flabel), XMM(0));
         }
     }
 }
 
-static void emit_string(FILE *fp, node_t *node)
+static void emit_string(gen_t *gen, node_t *node)
 {
     assert(node && node->type == NODE_STRING);
-    EMIT(".section\t.rodata");
-    node->slabel = make_data_label();
+    EMIT0(OP_RODATA);
+    node->slabel = make_data_label(gen);
     EMIT_LABEL(node->slabel);
-    EMIT(".string \"%s\"", unescape(node->sval));
-    EMIT(".text");
-    EMIT_INST("mov", node->ctype->size, "$%s, %s", node->slabel, rax[node->ctype->size]);
+    EMIT1(OP_STRING, 0, STR(node->sval, node->slen));
+    EMIT0(OP_TEXT);
+    EMIT2(OP_MOV, node->ctype->size, ADDR(node->slabel), RAX(node->ctype->size));
 }
 
-static void emit_postfix_inc_dec(FILE *fp, node_t *node)
+static void emit_postfix_inc_dec(gen_t *gen, node_t *node)
 {
-    char *inst;
+    int inst;
     int size;
     int delta;
 
     assert(node && node->type == NODE_POSTFIX);
-    emit(fp, node->operand);
-    inst = (node->unary_op == PUNCT_INC) ? "add" : "sub";
+    emit_node(gen, NODE(node->operand));
+    inst = (node->unary_op == PUNCT_INC) ? OP_ADD : OP_SUB;
     size = node->ctype->size;
-    delta = is_ptr(node->operand->ctype) ? node->operand->ctype->ptr->size : 1;
-    EMIT_INST("mov", size, "%s, %s", rax[size], rcx[size]);
-    EMIT_INST(inst, size, "$%d, %s", delta, rcx[size]);
-    emit_assign(fp, node->operand, "%rcx");
+    delta = is_ptr(NODE(node->operand)->ctype) ? NODE(node->operand)->ctype->ptr->size : 1;
+    EMIT2(OP_MOV, size, RAX(size), RCX(size));
+    EMIT2(inst, size, IMM(delta), RCX(size));
+    emit_assign(gen, NODE(node->operand), REG_CX);
 }
 
-static void emit_prefix_inc_dec(FILE *fp, node_t *node)
+static void emit_prefix_inc_dec(gen_t *gen, node_t *node)
 {
-    char *inst;
+    int inst;
     int size;
     int delta;
 
     assert(node && node->ctype == ctype_int && node->type == NODE_UNARY
             && (node->unary_op == PUNCT_INC || node->unary_op == PUNCT_DEC));
-    emit(fp, node->operand);
-    inst = (node->unary_op == PUNCT_INC) ? "add" : "sub";
+    emit_node(gen, NODE(node->operand));
+    inst = (node->unary_op == PUNCT_INC) ? OP_ADD : OP_SUB;
     size = node->ctype->size;
-    delta = is_ptr(node->operand->ctype) ? node->operand->ctype->ptr->size : 1;
-    EMIT_INST(inst, size, "$%d, %s", delta, rax[size]);
-    emit_assign(fp, node->operand, "%rax");
+    delta = is_ptr(NODE(node->operand)->ctype) ? NODE(node->operand)->ctype->ptr->size : 1;
+    EMIT2(inst, size, IMM(delta), RAX(size));
+    emit_assign(gen, NODE(node->operand), REG_AX);
 }
 
-static char *get_float1_label(FILE *fp, ctype_t *ctype)
+static char *get_float1_label(gen_t *gen, ctype_t *ctype)
 {
-    static char *f1, *d1;
+    int k = ctype == ctype_float ? CONST_FLOAT1 : CONST_DOUBLE1;
+    size_t start = gen->code->ninsts;
 
     assert(ctype == ctype_float || ctype == ctype_double);
+    if (gen->consts[k])
+        return gen->consts[k];
     if (ctype == ctype_float) {
-        if (!f1) {
-            union {
-                int i;
-                float f;
-            } s;
-            s.f = 1.0f;
-            f1 = make_data_label();
-            EMIT(".section\t.rodata");
-            EMIT_LABEL(f1);
-            EMIT(".long   %d", s.i);
-            EMIT(".text");
-        }
-        return f1;
+        union {
+            int i;
+            float f;
+        } s;
+        s.f = 1.0f;
+        gen->consts[k] = make_data_label(gen);
+        EMIT0(OP_RODATA);
+        EMIT_LABEL(gen->consts[k]);
+        EMIT1(OP_LONG, 0, IMM(s.i));
+        EMIT0(OP_TEXT);
     } else {
-        if (!d1) {
-            union {
-                long l;
-                double d;
-            } s;
-            s.d = 1.0;
-            d1 = make_data_label();
-            EMIT(".section\t.rodata");
-            EMIT_LABEL(d1);
-            EMIT(".quad   %ld", s.l);
-            EMIT(".text");
-        }
-        return d1;
+        union {
+            long l;
+            double d;
+        } s;
+        s.d = 1.0;
+        gen->consts[k] = make_data_label(gen);
+        EMIT0(OP_RODATA);
+        EMIT_LABEL(gen->consts[k]);
+        EMIT1(OP_QUAD, 0, IMM(s.l));
+        EMIT0(OP_TEXT);
     }
+    mark_const(gen, k, start);
+    return gen->consts[k];
 }
 
-static void emit_float_postfix_inc_dec(FILE *fp, node_t *node)
+static void emit_float_postfix_inc_dec(gen_t *gen, node_t *node)
 {
-    char *inst, *label;
-    char suffix;
+    int inst;
+    char *label;
 
     assert(node && node->type == NODE_POSTFIX);
-    suffix = (node->ctype == ctype_float) ? 's' : 'd';
-    inst = (node->unary_op == PUNCT_INC) ? "adds" : "subs";
-    emit(fp, node->operand);
-    label = get_float1_label(fp, node->ctype);
+    inst = (node->unary_op == PUNCT_INC) ? OP_ADDSS : OP_SUBSS;
+    emit_node(gen, NODE(node->operand));
+    label = get_float1_label(gen, node->ctype);
     PUSH_XMM(0);
-    EMIT("movs%c   %s(%%rip), %%xmm1", suffix, label);
-    EMIT("%s%c   %%xmm1, %%xmm0", inst, suffix);
-    emit_assign(fp, node->operand, "%xmm0");
+    EMIT2(SSE(OP_MOVSS, node->ctype), 0, RIP(label), XMM(1));
+    EMIT2(SSE(inst, node->ctype), 0, XMM(1), XMM(0));
+    emit_assign(gen, NODE(node->operand), REG_XMM0);
     POP_XMM(0);
 
 }
 
-static void emit_float_prefix_inc_dec(FILE *fp, node_t *node)
+static void emit_float_prefix_inc_dec(gen_t *gen, node_t *node)
 {
-    char *inst, *label;
-    char suffix;
+    int inst;
+    char *label;
 
     assert(node && (node->ctype == ctype_float || node->ctype == ctype_double)
             && node->type == NODE_UNARY && (node->unary_op == PUNCT_INC || node->unary_op == PUNCT_DEC));
-    suffix = (node->ctype == ctype_float) ? 's' : 'd';
-    inst = (node->unary_op == PUNCT_INC) ? "adds" : "subs";
-    emit(fp, node->operand);
-    label = get_float1_label(fp, node->ctype);
-    EMIT("movs%c   %s(%%rip), %%xmm1", suffix, label);
-    EMIT("%s%c   %%xmm1, %%xmm0", inst, suffix);
-    emit_assign(fp, node->operand, "%xmm0");
+    inst = (node->unary_op == PUNCT_INC) ? OP_ADDSS : OP_SUBSS;
+    emit_node(gen, NODE(node->operand));
+    label = get_float1_label(gen, node->ctype);
+    EMIT2(SSE(OP_MOVSS, node->ctype), 0, RIP(label), XMM(1));
+    EMIT2(SSE(inst, node->ctype), 0, XMM(1), XMM(0));
+    emit_assign(gen, NODE(node->operand), REG_XMM0);
 }
 
-static void emit_addr(FILE *fp, node_t *node)
+static void emit_addr(gen_t *gen, node_t *node)
 {
     assert(node && node->type == NODE_UNARY && node->unary_op == '&');
-    switch (node->operand->type) {
+    switch (NODE(node->operand)->type) {
     case NODE_VAR:
-        EMIT_INST("lea", node->ctype->size, "-%d(%%rbp), %s", node->operand->loffset, rax[node->ctype->size]);
+        EMIT2(OP_LEA, node->ctype->size, RBP(NODE(node->operand)->loffset), RAX(node->ctype->size));
         break;
 
     case NODE_UNARY:
         /* Both & and * are ommited */
-        assert(node->operand->unary_op == '*');
-        emit(fp, node->operand->operand);
+        assert(NODE(node->operand)->unary_op == '*');
+        emit_node(gen, NODE(NODE(node->operand)->operand));
         break;
 
     default:
@@ -246,62 +293,51 @@ static void emit_addr(FILE *fp, node_t *node)
     }
 }
 
-static void emit_deref(FILE *fp, node_t *node)
+static void emit_deref(gen_t *gen, node_t *node)
 {
     ctype_t *ctype;
 
     assert(node && node->type == NODE_UNARY && node->unary_op == '*');
-    emit(fp, node->operand);
+    emit_node(gen, NODE(node->operand));
     ctype = node->ctype;
     if (ctype != ctype_float && ctype != ctype_double) {
-        EMIT_INST("mov", ctype->size, "(%s), %s", rax[node->operand->ctype->size], rax[ctype->size]);
+        EMIT2(OP_MOV, ctype->size, MEM(REG_AX, 0), RAX(ctype->size));
     } else {
-        char *inst = (ctype == ctype_float) ? "movss" : "movsd";
-        EMIT("%s   (%s), %%xmm0", inst, rax[node->operand->ctype->size]);
+        EMIT2(SSE(OP_MOVSS, ctype), 0, MEM(REG_AX, 0), XMM(0));
     }
 }
 
-static void emit_float_neg(FILE *fp, node_t *node)
+static void emit_float_neg(gen_t *gen, node_t *node)
 {
-    static char *f, *d;
-    char *label, suffix;
+    int k = node->ctype == ctype_float ? CONST_FLOAT_NEG : CONST_DOUBLE_NEG;
+    size_t start = gen->code->ninsts;
+    char *label;
 
     assert(node && node->type == NODE_UNARY && node->unary_op == '-');
-    if (node->ctype == ctype_float) {
-        if (!f) {
-            EMIT(".section\t.rodata");
-            EMIT(".align 16");
-            f = make_data_label();
-            EMIT_LABEL(f);
-            EMIT(".long   2147483648");
-            EMIT(".long   0");
-            EMIT(".long   0");
-            EMIT(".long   0");
-            EMIT(".text");
-        }
-        label = f;
-        suffix = 's';
-    } else {
-        if (!d) {
-            EMIT(".section\t.rodata");
-            EMIT(".align 16");
-            d = make_data_label();
-            EMIT_LABEL(d);
-            EMIT(".long   0");
-            EMIT(".long   -2147483648");
-            EMIT(".long   0");
-            EMIT(".long   0");
-            EMIT(".text");
+    if (!gen->consts[k]) {
+        EMIT0(OP_RODATA);
+        EMIT1(OP_ALIGN, 0, IMM(16));
+        gen->consts[k] = make_data_label(gen);
+        EMIT_LABEL(gen->consts[k]);
+        if (k == CONST_FLOAT_NEG) {
+            EMIT1(OP_LONG, 0, IMM(2147483648));
+            EMIT1(OP_LONG, 0, IMM(0));
+        } else {
+            EMIT1(OP_LONG, 0, IMM(0));
+            EMIT1(OP_LONG, 0, IMM(-2147483648));
         }
-        label = d;
-        suffix = 'd';
+        EMIT1(OP_LONG, 0, IMM(0));
+        EMIT1(OP_LONG, 0, IMM(0));
+        EMIT0(OP_TEXT);
+        mark_const(gen, k, start);
     }
-    emit(fp, node->operand);
-    EMIT("movs%c   %s(%%rip), %%xmm1", suffix, label);
-    EMIT("xorp%c   %%xmm1, %%xmm0", suffix);
+    label = gen->consts[k];
+    emit_node(gen, NODE(node->operand));
+    EMIT2(SSE(OP_MOVSS, node->ctype), 0, RIP(label), XMM(1));
+    EMIT2(SSE(OP_XORPS, node->ctype), 0, XMM(1), XMM(0));
 }
 
-static void emit_unary(FILE *fp, node_t *node)
+static void emit_unary(gen_t *gen, node_t *node)
 {
     int size;
 
@@ -310,9 +346,9 @@ static void emit_unary(FILE *fp, node_t *node)
     case PUNCT_INC:
     case PUNCT_DEC:
         if (is_float(node->ctype))
-            emit_float_prefix_inc_dec(fp, node);
+            emit_float_prefix_inc_dec(gen, node);
         else
-            emit_prefix_inc_dec(fp, node);
+            emit_prefix_inc_dec(gen, node);
         break;
 
     case '+':
@@ -320,28 +356,28 @@ static void emit_unary(FILE *fp, node_t *node)
 
     case '-':
         if (is_float(node->ctype)) {
-            emit_float_neg(fp, node);
+            emit_float_neg(gen, node);
             break;
         }
         /* fall through */
     case '~':
-        size = node->operand->ctype->size;
-        emit(fp, node->operand);
-        EMIT_INST(node->unary_op == '-' ? "neg" : "not", size, "%s", rax[size]);
+        size = NODE(node->operand)->ctype->size;
+        emit_node(gen, NODE(node->operand));
+        EMIT1(node->unary_op == '-' ? OP_NEG : OP_NOT, size, RAX(size));
         break;
 
     case '!':
-        emit_cmp_0(fp, node->operand);
-        EMIT("%s    %%al", is_float(node->operand->ctype) ? "setnp" : "sete");
-        EMIT("movzbl  %%al, %%eax");
+        emit_cmp_0(gen, NODE(node->operand));
+        EMIT1(is_float(NODE(node->operand)->ctype) ? OP_SETNP : OP_SETE, 0, RAX(1));
+        EMIT2(OP_MOVZB, 0, RAX(1), RAX(4));
         break;
 
     case '&':
-        emit_addr(fp, node);
+        emit_addr(gen, node);
         break;
 
     case '*':
-        emit_deref(fp, node);
+        emit_deref(gen, node);
         break;
 
     default:
@@ -349,21 +385,21 @@ static void emit_unary(FILE *fp, node_t *node)
     }
 }
 
-static void emit_bit_binary(FILE *fp, node_t *node)
+static void emit_bit_binary(gen_t *gen, node_t *node)
 {
-    char *inst;
+    int inst;
     int size;
 
     assert(node && node->type == NODE_BINARY);
     switch (node->binary_op) {
     case '&':
-        inst = "and";
+        inst = OP_AND;
         break;
     case '^':
-        inst = "xor";
+        inst = OP_XOR;
         break;
     case '|':
-        inst = "or";
+        inst = OP_OR;
         break;
     default:
         errorf("invalid bit binary op %c\n", node->binary_op);
@@ -371,11 +407,11 @@ static void emit_bit_binary(FILE *fp, node_t *node)
     }
 
     size = node->ctype->size;
-    emit(fp, node->left);
-    PUSH("%%rax");
-    emit(fp, node->right);
-    POP("%%rcx");
-    EMIT_INST(inst, size, "%s, %s", rcx[size], rax[size]);
+    emit_node(gen, NODE(node->left));
+    PUSH(REG_AX);
+    emit_node(gen, NODE(node->right));
+    POP(REG_CX);
+    EMIT2(inst, size, RCX(size), RAX(size));
 }
 
 static int bit(int n)
@@ -387,65 +423,65 @@ static int bit(int n)
     return i;
 }
 
-static void emit_ptr_arith_binary(FILE *fp, node_t *node)
+static void emit_ptr_arith_binary(gen_t *gen, node_t *node)
 {
     int size;
     int shift_bits;
 
-    assert(is_ptr(node->left->ctype));
-    size = node->left->ctype->size;
-    shift_bits = bit(node->left->ctype->ptr->size);
-    emit(fp, node->left);
-    PUSH("%%rax");
-    emit(fp, node->right);
-    POP("%%rcx");
+    assert(is_ptr(NODE(node->left)->ctype));
+    size = NODE(node->left)->ctype->size;
+    shift_bits = bit(NODE(node->left)->ctype->ptr->size);
+    emit_node(gen, NODE(node->left));
+    PUSH(REG_AX);
+    emit_node(gen, NODE(node->right));
+    POP(REG_CX);
     /* ptr - ptr */
-    if (is_ptr(node->right->ctype)) {
+    if (is_ptr(NODE(node->right)->ctype)) {
         assert(node->binary_op == '-');
-        EMIT_INST("sub", size, "%s, %s", rax[size], rcx[size]);
-        EMIT_INST("mov", size, "%s, %s", rcx[size], rax[size]);
+        EMIT2(OP_SUB, size, RAX(size), RCX(size));
+        EMIT2(OP_MOV, size, RCX(size), RAX(size));
         if (shift_bits)
-            EMIT_INST("sar", size, "$%d, %s", shift_bits, rax[size]);
+            EMIT2(OP_SAR, size, IMM(shift_bits), RAX(size));
     /* ptr +- int */
     } else {
         /* sign extend %eax to %rax */
-        EMIT("cltq");
-        EMIT_INST("sal", size, "$%d, %s", shift_bits, rax[size]);
-        EMIT_INST(node->binary_op == '-' ? "sub" : "add", size, "%s, %s", rax[size], rcx[size]);
-        EMIT_INST("mov", size, "%s, %s", rcx[size], rax[size]);
+        EMIT0(OP_CLTQ);
+        EMIT2(OP_SAL, size, IMM(shift_bits), RAX(size));
+        EMIT2(node->binary_op == '-' ? OP_SUB : OP_ADD, size, RAX(size), RCX(size));
+        EMIT2(OP_MOV, size, RCX(size), RAX(size));
     }
 }
 
-static void emit_arith_binary(FILE *fp, node_t *node)
+static void emit_arith_binary(gen_t *gen, node_t *node)
 {
-    char *inst;
+    int inst;
     int size;
 
     assert(node && node->type == NODE_BINARY);
-    if (is_ptr(node->left->ctype)) {
-        emit_ptr_arith_binary(fp, node);
+    if (is_ptr(NODE(node->left)->ctype)) {
+        emit_ptr_arith_binary(gen, node);
         return;
     }
 
     switch (node->binary_op) {
     case '+':
-        inst = "add";
+        inst = OP_ADD;
         break;
     case '-':
-        inst = "sub";
+        inst = OP_SUB;
         break;
     case '*':
-        inst = "imul";
+        inst = OP_IMUL;
         break;
     case '/':
     case '%':
-        inst = "idiv";
+        inst = OP_IDIV;
         break;
     case PUNCT_LSFT:
-        inst = "sal";
+        inst = OP_SAL;
         break;
     case PUNCT_RSFT:
-        inst = "sar";
+        inst = OP_SAR;
         break;
 
     default:
@@ -455,87 +491,86 @@ static void emit_arith_binary(FILE *fp, node_t *node)
     size = node->ctype->size;
     if (node->binary_op == '/' || node->binary_op == '%' || node->binary_op == '-'
             || node->binary_op == PUNCT_LSFT || node->binary_op == PUNCT_RSFT) {
-        emit(fp, node->left);
-        PUSH("%%rax");
-        emit(fp, node->right);
-        EMIT_INST("mov", size, "%s, %s", rax[size], rcx[size]);
-        POP("%%rax");
+        emit_node(gen, NODE(node->left));
+        PUSH(REG_AX);
+        emit_node(gen, NODE(node->right));
+        EMIT2(OP_MOV, size, RAX(size), RCX(size));
+        POP(REG_AX);
         if (node->binary_op == '-') {
-            EMIT_INST(inst, size, "%s, %s", rcx[size], rax[size]);
+            EMIT2(inst, size, RCX(size), RAX(size));
         } else if (node->binary_op == '/' || node->binary_op == '%') {
-            EMIT("cltd");
-            EMIT_INST(inst, size, "%s", rcx[size]);
+            EMIT0(OP_CLTD);
+            EMIT1(inst, size, RCX(size));
             if (node->binary_op == '%')
-                EMIT_INST("mov", size, "%%edx, %s", rax[size]);
+                EMIT2(OP_MOV, size, REG(REG_DX, 4), RAX(size));
         } else {
-            EMIT_INST(inst, size, "%%cl, %s", rax[size]);
+            EMIT2(inst, size, RCX(1), RAX(size));
         }
     } else {
-        emit(fp, node->left);
-        PUSH("%%rax");
-        emit(fp, node->right);
-        POP("%%rcx");
-        EMIT_INST(inst, size, "%s, %s", rcx[size], rax[size]);
+        emit_node(gen, NODE(node->left));
+        PUSH(REG_AX);
+        emit_node(gen, NODE(node->right));
+        POP(REG_CX);
+        EMIT2(inst, size, RCX(size), RAX(size));
     }
 }
 
-static void emit_float_arith_binary(FILE *fp, node_t *node)
+static void emit_float_arith_binary(gen_t *gen, node_t *node)
 {
-    char suffix, *inst;
+    int inst;
 
     assert(node && node->type == NODE_BINARY);
     switch (node->binary_op) {
     case '+':
-        inst = "adds";
+        inst = OP_ADDSS;
         break;
     case '-':
-        inst = "subs";
+        inst = OP_SUBSS;
         break;
     case '*':
-        inst = "muls";
+        inst = OP_MULSS;
         break;
     case '/':
-        inst = "divs";
+        inst = OP_DIVSS;
         break;
 
     default:
         errorf("invalid arith binary op %c\n", node->binary_op);
     }
 
-    suffix = (node->ctype == ctype_float) ? 's' : 'd';
+    inst = SSE(inst, node->ctype);
     if (node->binary_op == '+' || node->binary_op == '*') {
-        emit(fp, node->left);
+        emit_node(gen, NODE(node->left));
         PUSH_XMM(0);
-        emit(fp, node->right);
+        emit_node(gen, NODE(node->right));
         POP_XMM(1);
-        EMIT("%s%c   %%xmm1, %%xmm0", inst, suffix);
+        EMIT2(inst, 0, XMM(1), XMM(0));
     } else {
-        emit(fp, node->left);
+        emit_node(gen, NODE(node->left));
         PUSH_XMM(0);
-        emit(fp, node->right);
-        EMIT("movs%c   %%xmm0, %%xmm1", suffix);
+        emit_node(gen, NODE(node->right));
+        EMIT2(SSE(OP_MOVSS, node->ctype), 0, XMM(0), XMM(1));
         POP_XMM(0);
-        EMIT("%s%c   %%xmm1, %%xmm0", inst, suffix);
+        EMIT2(inst, 0, XMM(1), XMM(0));
     }
 }
 
-static void emit_cmp_0(FILE *fp, node_t *node)
+static void emit_cmp_0(gen_t *gen, node_t *node)
 {
-    emit(fp, node);
+    emit_node(gen, node);
     if (is_float(node->ctype)) {
-        char suffix = (node->ctype == ctype_float) ? 's' : 'd';
-        EMIT("xorp%c   %%xmm1, %%xmm1", suffix);
-        EMIT("ucomis%c %%xmm0, %%xmm1", suffix);
+        EMIT2(SSE(OP_XORPS, node->ctype), 0, XMM(1), XMM(1));
+        EMIT2(SSE(OP_UCOMISS, node->ctype), 0, XMM(0), XMM(1));
     } else {
         int size = node->ctype->size;
-        EMIT_INST("test", size, "%s, %s", rax[size], rax[size]);
+        EMIT2(OP_TEST, size, RAX(size), RAX(size));
     }
 }
 
-static void emit_log_and_binary(FILE *fp, node_t *node)
+static void emit_log_and_binary(gen_t *gen, node_t *node)
 {
     int size;
-    char *inst;
+    int inst;
     char *f, *done;
 
     /* A && B:
@@ -550,27 +585,27 @@ static void emit_log_and_binary(FILE *fp, node_t *node)
      * done:
      */
     assert(node && node->type == NODE_BINARY && node->binary_op == PUNCT_AND);
-    emit_cmp_0(fp, node->left);
-    inst = is_float(node->left->ctype) ? "jnp" : "je";
-    f = make_jump_label();
-    EMIT("%s      %s", inst, f);
-    emit_cmp_0(fp, node->right);
-    inst = is_float(node->right->ctype) ? "jnp" : "je";
-    EMIT("%s      %s", inst, f);
+    emit_cmp_0(gen, NODE(node->left));
+    inst = is_float(NODE(node->left)->ctype) ? OP_JNP : OP_JE;
+    f = make_jump_label(gen);
+    EMIT1(inst, 0, LABEL(f));
+    emit_cmp_0(gen, NODE(node->right));
+    inst = is_float(NODE(node->right)->ctype) ? OP_JNP : OP_JE;
+    EMIT1(inst, 0, LABEL(f));
 
     size = node->ctype->size;
-    EMIT_INST("mov", size, "$1, %s", rax[size]);
-    done = make_jump_label();
-    EMIT("jmp     %s", done);
+    EMIT2(OP_MOV, size, IMM(1), RAX(size));
+    done = make_jump_label(gen);
+    EMIT1(OP_JMP, 0, LABEL(done));
     EMIT_LABEL(f);
-    EMIT_INST("mov", size, "$0, %s", rax[size]);
+    EMIT2(OP_MOV, size, IMM(0), RAX(size));
     EMIT_LABEL(done);
 }
 
-static void emit_log_or_binary(FILE *fp, node_t *node)
+static void emit_log_or_binary(gen_t *gen, node_t *node)
 {
     int size;
-    char *inst;
+    int inst;
     char *t, *done;
 
     /* A || B:
@@ -585,89 +620,87 @@ static void emit_log_or_binary(FILE *fp, node_t *node)
      * done:
      */
     assert(node && node->type == NODE_BINARY && node->binary_op == PUNCT_OR);
-    emit_cmp_0(fp, node->left);
-    inst = is_float(node->left->ctype) ? "jp" : "jne";
-    t = make_jump_label();
-    EMIT("%s      %s", inst, t);
-    emit_cmp_0(fp, node->right);
-    inst = is_float(node->right->ctype) ? "jp" : "jne";
-    EMIT("%s      %s", inst, t);
+    emit_cmp_0(gen, NODE(node->left));
+    inst = is_float(NODE(node->left)->ctype) ? OP_JP : OP_JNE;
+    t = make_jump_label(gen);
+    EMIT1(inst, 0, LABEL(t));
+    emit_cmp_0(gen, NODE(node->right));
+    inst = is_float(NODE(node->right)->ctype) ? OP_JP : OP_JNE;
+    EMIT1(inst, 0, LABEL(t));
 
     size = node->ctype->size;
-    EMIT_INST("mov", size, "$0, %s", rax[size]);
-    done = make_jump_label();
-    EMIT("jmp     %s", done);
+    EMIT2(OP_MOV, size, IMM(0), RAX(size));
+    done = make_jump_label(gen);
+    EMIT1(OP_JMP, 0, LABEL(done));
     EMIT_LABEL(t);
-    EMIT_INST("mov", size, "$1, %s", rax[size]);
+    EMIT2(OP_MOV, size, IMM(1), RAX(size));
     EMIT_LABEL(done);
 }
 
-static void emit_assign(FILE *fp, node_t *dst, char *src)
+static void emit_assign(gen_t *gen, node_t *dst, int src)
 {
-    assert(dst && src);
+    assert(dst);
     if (is_float(dst->ctype)) {
-        char suffix = (dst->ctype == ctype_float) ? 's' : 'd';
         if (dst->type == NODE_VAR) {
-            EMIT("movs%c   %s, -%d(%%rbp)", suffix, src, dst->loffset);
+            EMIT2(SSE(OP_MOVSS, dst->ctype), 0, XMM(src - REG_XMM0), RBP(dst->loffset));
         } else {
-            emit(fp, dst->operand);
-            EMIT("movs%c   %s, (%%rax)", suffix, src);
+            emit_node(gen, NODE(dst->operand));
+            EMIT2(SSE(OP_MOVSS, dst->ctype), 0, XMM(src - REG_XMM0), MEM(REG_AX, 0));
         }
     } else {
         int size = dst->ctype->size;
         if (dst->type == NODE_VAR) {
-            EMIT_INST("mov", size, "%s, -%d(%%rbp)",
-                    !strcmp(src, "%rax") ? rax[size] : rcx[size], dst->loffset);
+            EMIT2(OP_MOV, size, REG(src, size), RBP(dst->loffset));
         } else {
-            if (!strcmp(src, "%rax")) {
-                PUSH("%%rax");
-                emit(fp, dst->operand);
-                EMIT_INST("mov", 8, "%s, %s", rax[8], rcx[8]);
-                POP("%%rax");
-                EMIT_INST("mov", size, "%s, (%%rcx)", rax[size]);
+            if (src == REG_AX) {
+                PUSH(REG_AX);
+                emit_node(gen, NODE(dst->operand));
+                EMIT2(OP_MOV, 8, RAX(8), RCX(8));
+                POP(REG_AX);
+                EMIT2(OP_MOV, size, RAX(size), MEM(REG_CX, 0));
             } else {
-                assert(!strcmp(src, "%rcx"));
-                emit(fp, dst->operand);
-                EMIT_INST("mov", size, "%s, (%%rax)", rcx[size]);
+                assert(src == REG_CX);
+                emit_node(gen, NODE(dst->operand));
+                EMIT2(OP_MOV, size, RCX(size), MEM(REG_AX, 0));
             }
         }
     }
 }
 
-static void emit_assign_binary(FILE *fp, node_t *node)
+static void emit_assign_binary(gen_t *gen, node_t *node)
 {
-    char *src;
+    int src;
 
     assert(node && node->type == NODE_BINARY && node->binary_op == '=');
-    emit(fp, node->right);
-    src = is_float(node->ctype) ? "%xmm0" : "%rax";
-    emit_assign(fp, node->left, src);
+    emit_node(gen, NODE(node->right));
+    src = is_float(node->ctype) ? REG_XMM0 : REG_AX;
+    emit_assign(gen, NODE(node->left), src);
 }
 
-static void emit_cmp_binary(FILE *fp, node_t *node)
+static void emit_cmp_binary(gen_t *gen, node_t *node)
 {
-    char *inst;
+    int inst;
     int size;
 
     assert(node && node->type == NODE_BINARY);
     switch (node->binary_op) {
     case '<':
-        inst = "setl";
+        inst = OP_SETL;
         break;
     case '>':
-        inst = "setg";
+        inst = OP_SETG;
         break;
     case PUNCT_LE:
-        inst = "setle";
+        inst = OP_SETLE;
         break;
     case PUNCT_GE:
-        inst = "setge";
+        inst = OP_SETGE;
         break;
     case PUNCT_EQ:
-        inst = "sete";
+        inst = OP_SETE;
         break;
     case PUNCT_NE:
-        inst = "setne";
+        inst = OP_SETNE;
         break;
 
     default:
@@ -675,40 +708,39 @@ static void emit_cmp_binary(FILE *fp, node_t *node)
         break;
     }
 
-    emit(fp, node->left);
-    PUSH("%%rax");
-    emit(fp, node->right);
-    POP("%%rcx");
-    size = node->left->ctype->size;
-    EMIT_INST("cmp", size, "%s, %s", rax[size], rcx[size]);
-    EMIT("%s    %%al", inst);
-    EMIT("movzbl  %%al, %%eax");
+    emit_node(gen, NODE(node->left));
+    PUSH(REG_AX);
+    emit_node(gen, NODE(node->right));
+    POP(REG_CX);
+    size = NODE(node->left)->ctype->size;
+    EMIT2(OP_CMP, size, RAX(size), RCX(size));
+    EMIT1(inst, 0, RAX(1));
+    EMIT2(OP_MOVZB, 0, RAX(1), RAX(4));
 }
 
-static void emit_float_cmp_binary(FILE *fp, node_t *node)
+static void emit_float_cmp_binary(gen_t *gen, node_t *node)
 {
-    char *inst;
-    char suffix;
+    int inst;
 
     assert(node && node->type == NODE_BINARY);
     switch (node->binary_op) {
     case '<':
-        inst = "setna";
+        inst = OP_SETNA;
         break;
     case '>':
-        inst = "seta";
+        inst = OP_SETA;
         break;
     case PUNCT_LE:
-        inst = "setnae";
+        inst = OP_SETNAE;
         break;
     case PUNCT_GE:
-        inst = "setae";
+        inst = OP_SETAE;
         break;
     case PUNCT_EQ:
-        inst = "setnp";
+        inst = OP_SETNP;
         break;
     case PUNCT_NE:
-        inst = "setp";
+        inst = OP_SETP;
         break;
 
     default:
@@ -716,62 +748,61 @@ static void emit_float_cmp_binary(FILE *fp, node_t *node)
         break;
     }
 
-    suffix = (node->left->ctype == ctype_float) ? 's' : 'd';
-    emit(fp, node->left);
+    emit_node(gen, NODE(node->left));
     PUSH_XMM(0);
-    emit(fp, node->right);
+    emit_node(gen, NODE(node->right));
     POP_XMM(1);
-    EMIT("ucomis%c %%xmm0, %%xmm1", suffix);
-    EMIT("%s    %%al", inst);
-    EMIT("movzbl  %%al, %%eax");
+    EMIT2(SSE(OP_UCOMISS, NODE(node->left)->ctype), 0, XMM(0), XMM(1));
+    EMIT1(inst, 0, RAX(1));
+    EMIT2(OP_MOVZB, 0, RAX(1), RAX(4));
 }
 
-static void emit_comma_binary(FILE *fp, node_t *node)
+static void emit_comma_binary(gen_t *gen, node_t *node)
 {
     assert(node && node->type == NODE_BINARY && node->binary_op == ',');
-    emit(fp, node->left);
-    emit(fp, node->right);
+    emit_node(gen, NODE(node->left));
+    emit_node(gen, NODE(node->right));
 }
 
-static void emit_binary(FILE *fp, node_t *node)
+static void emit_binary(gen_t *gen, node_t *node)
 {
     assert(node && node->type == NODE_BINARY);
     switch (node->binary_op) {
     case '&': case '|': case '^':
-        emit_bit_binary(fp, node);
+        emit_bit_binary(gen, node);
         break;
 
     case '+': case '-': case '*': case '/':
         if (is_float(node->ctype)) {
-            emit_float_arith_binary(fp, node);
+            emit_float_arith_binary(gen, node);
             break;
         }
         /* fall through */
     case '%': case PUNCT_LSFT: case PUNCT_RSFT:
-        emit_arith_binary(fp, node);
+        emit_arith_binary(gen, node);
         break;
 
     case PUNCT_AND:
-        emit_log_and_binary(fp, node);
+        emit_log_and_binary(gen, node);
         break;
     case PUNCT_OR:
-        emit_log_or_binary(fp, node);
+        emit_log_or_binary(gen, node);
         break;
 
     case '=':
-        emit_assign_binary(fp, node);
+        emit_assign_binary(gen, node);
         break;
 
     case '<': case '>': case PUNCT_LE: case PUNCT_GE: case PUNCT_EQ: case PUNCT_NE:
-        if (is_float(node->left->ctype)) {
-            emit_float_cmp_binary(fp, node);
+        if (is_float(NODE(node->left)->ctype)) {
+            emit_float_cmp_binary(gen, node);
             break;
         }
-        emit_cmp_binary(fp, node);
+        emit_cmp_binary(gen, node);
         break;
 
     case ',':
-        emit_comma_binary(fp, node);
+        emit_comma_binary(gen, node);
         break;
 
     default:
@@ -781,7 +812,7 @@ static void emit_binary(FILE *fp, node_t *node)
 
 }
 
-static void emit_ternary(FILE *fp, node_t *node)
+static void emit_ternary(gen_t *gen, node_t *node)
 {
     char *f, *done;
 
@@ -795,18 +826,18 @@ static void emit_ternary(FILE *fp, node_t *node)
      * done:
      */
     assert(node && node->type == NODE_TERNARY);
-    emit_cmp_0(fp, node->cond);
-    f = make_jump_label();
-    EMIT("%s      %s", is_float(node->ctype) ? "jnp" : "je", f);
-    emit(fp, node->then);
-    done = make_jump_label();
-    EMIT("jmp     %s", done);
+    emit_cmp_0(gen, NODE(node->cond));
+    f = make_jump_label(gen);
+    EMIT1(is_float(node->ctype) ? OP_JNP : OP_JE, 0, LABEL(f));
+    emit_node(gen, NODE(node->then));
+    done = make_jump_label(gen);
+    EMIT1(OP_JMP, 0, LABEL(done));
     EMIT_LABEL(f);
-    emit(fp, node->els);
+    emit_node(gen, NODE(node->els));
     EMIT_LABEL(done);
 }
 
-static void emit_if(FILE *fp, node_t *node)
+static void emit_if(gen_t *gen, node_t *node)
 {
     char *f;
 
@@ -819,21 +850,21 @@ static void emit_if(FILE *fp, node_t *node)
      *      else;
      * done:
      */
-    emit_cmp_0(fp, node->cond);
-    f = make_jump_label();
-    EMIT("%s      %s", is_float(node->cond->ctype) ? "jnp" : "je", f);
-    emit(fp, node->then);
-    if (node->els) {
-        char *done = make_jump_label();
-        EMIT("jmp     %s", done);
+    emit_cmp_0(gen, NODE(node->cond));
+    f = make_jump_label(gen);
+    EMIT1(is_float(NODE(node->cond)->ctype) ? OP_JNP : OP_JE, 0, LABEL(f));
+    emit_node(gen, NODE(node->then));
+    if (NODE(node->els)) {
+        char *done = make_jump_label(gen);
+        EMIT1(OP_JMP, 0, LABEL(done));
         EMIT_LABEL(f);
-        emit(fp, node->els);
+        emit_node(gen, NODE(node->els));
         EMIT_LABEL(done);
     } else
         EMIT_LABEL(f);
 }
 
-static void emit_for(FILE *fp, node_t *node)
+static void emit_for(gen_t *gen, node_t *node)
 {
     char *test, *loop;
 
@@ -847,22 +878,22 @@ static void emit_for(FILE *fp, node_t *node)
      *      if (cond)
      *          goto loop;
      */
-    emit(fp, node->for_init);
-    test = make_jump_label();
-    EMIT("jmp     %s", test);
-    loop = make_jump_label();
+    emit_node(gen, NODE(node->for_init));
+    test = make_jump_label(gen);
+    EMIT1(OP_JMP, 0, LABEL(test));
+    loop = make_jump_label(gen);
     EMIT_LABEL(loop);
-    emit(fp, node->for_body);
-    emit(fp, node->for_step);
+    emit_node(gen, NODE(node->for_body));
+    emit_node(gen, NODE(node->for_step));
     EMIT_LABEL(test);
-    if (node->for_cond) {
-        emit_cmp_0(fp, node->for_cond);
-        EMIT("%s      %s", is_float(node->for_cond->ctype) ? "jp" : "jne", loop);
+    if (NODE(node->for_cond)) {
+        emit_cmp_0(gen, NODE(node->for_cond));
+        EMIT1(is_float(NODE(node->for_cond)->ctype) ? OP_JP : OP_JNE, 0, LABEL(loop));
     } else
-        EMIT("jmp     %s", loop);
+        EMIT1(OP_JMP, 0, LABEL(loop));
 }
 
-static void emit_do_while(FILE *fp, node_t *node)
+static void emit_do_while(gen_t *gen, node_t *node)
 {
     char *loop;
 
@@ -872,14 +903,14 @@ static void emit_do_while(FILE *fp, node_t *node)
      *      if (cond)
      *          goto loop;
      */
-    loop = make_jump_label();
+    loop = make_jump_label(gen);
     EMIT_LABEL(loop);
-    emit(fp, node->while_body);
-    emit_cmp_0(fp, node->while_cond);
-    EMIT("%s      %s", is_float(node->while_cond->ctype) ? "jp" : "jne", loop);
+    emit_node(gen, NODE(node->while_body));
+    emit_cmp_0(gen, NODE(node->while_cond));
+    EMIT1(is_float(NODE(node->while_cond)->ctype) ? OP_JP : OP_JNE, 0, LABEL(loop));
 }
 
-static void emit_while(FILE *fp, node_t *node)
+static void emit_while(gen_t *gen, node_t *node)
 {
     char *loop, *test;
 
@@ -891,147 +922,140 @@ static void emit_while(FILE *fp, node_t *node)
      *      if (cond)
      *          goto loop;
      */
-    test = make_jump_label();
-    EMIT("jmp     %s", test);
-    loop = make_jump_label();
+    test = make_jump_label(gen);
+    EMIT1(OP_JMP, 0, LABEL(test));
+    loop = make_jump_label(gen);
     EMIT_LABEL(loop);
-    emit(fp, node->while_body);
+    emit_node(gen, NODE(node->while_body));
     EMIT_LABEL(test);
-    emit_cmp_0(fp, node->while_cond);
-    EMIT("%s      %s", is_float(node->while_cond->ctype) ? "jp" : "jne", loop);
+    emit_cmp_0(gen, NODE(node->while_cond));
+    EMIT1(is_float(NODE(node->while_cond)->ctype) ? OP_JP : OP_JNE, 0, LABEL(loop));
 }
 
 
-static void set_var_offset(vector_t *vars)
+static void set_var_offset(gen_t *gen, node_t *var)
 {
-    size_t i;
-    node_t *var;
     int size;
 
-    if (!vars)
-        return;
-    for (i = 0; i < vector_len(vars); i++) {
-        var = vector_get(vars, i);
-        assert(var->type == NODE_VAR_DECL);
-        size = var->ctype->size;
-        if (is_array(var->ctype))
-            offset = align(offset + var->ctype->ptr->size * var->ctype->len, size);
-        else
-            offset = align(offset + var->ctype->size, size);
-        var->loffset = offset;
-    }
-    offset = align(offset, 8);
+    assert(var->type == NODE_VAR_DECL);
+    size = var->ctype->size;
+    if (is_array(var->ctype))
+        gen->offset = align(gen->offset + var->ctype->ptr->size * var->ctype->len, size);
+    else
+        gen->offset = align(gen->offset + var->ctype->size, size);
+    var->loffset = gen->offset;
 }
 
-static void emit_func_prologue(FILE *fp, node_t *node)
+static void emit_func_prologue(gen_t *gen, node_t *node)
 {
     size_t i;
     int float_idx, int_idx;
 
-    EMIT(".text");
-    EMIT(".globl  %s", node->func_name);
-    EMIT(".type   %s, @function", node->func_name);
+    EMIT0(OP_TEXT);
+    EMIT1(OP_GLOBL, 0, LABEL(node->func_name));
+    EMIT1(OP_TYPE_FUNC, 0, LABEL(node->func_name));
     EMIT_LABEL(node->func_name);
-    PUSH("%%rbp");
-    EMIT_INST("mov", 8, "%%rsp, %%rbp");
+    PUSH(REG_BP);
+    EMIT2(OP_MOV, 8, REG(REG_SP, 8), REG(REG_BP, 8));
 
-    offset = 0;
-    set_var_offset(node->params);
-    if (offset)
-        EMIT_INST("sub", 8, "$%d, %%rsp", offset);
+    gen->offset = 0;
+    for (i = 0; i < node->params.len; i++)
+        set_var_offset(gen, KID(node->params, i));
+    gen->offset = align(gen->offset, 8);
+    if (gen->offset)
+        EMIT2(OP_SUB, 8, IMM(gen->offset), REG(REG_SP, 8));
 
     /* TODO:
      *       > 6 args
      */
-    for (i = float_idx = int_idx = 0; i < vector_len(node->params); i++) {
-        node_t *var = vector_get(node->params, i);
+    for (i = float_idx = int_idx = 0; i < node->params.len; i++) {
+        node_t *var = KID(node->params, i);
         if (is_float(var->ctype)) {
-            char suffix = (var->ctype == ctype_float) ? 's' : 'd';
-            EMIT("movs%c   %%xmm%d, -%d(%%rbp)", suffix, float_idx++, var->loffset);
+            EMIT2(SSE(OP_MOVSS, var->ctype), 0, XMM(float_idx++), RBP(var->loffset));
         } else {
             int size = var->ctype->size;
-            EMIT_INST("mov", size, "%s, -%d(%%rbp)", arg_regs[size][int_idx++], var->loffset);
+            EMIT2(OP_MOV, size, REG(arg_regs[int_idx++], size), RBP(var->loffset));
         }
         var->type = NODE_VAR;
     }
 }
 
-static void emit_ret(FILE *fp)
+static void emit_ret(gen_t *gen)
 {
-    EMIT("leave");
-    EMIT("ret");
+    EMIT0(OP_LEAVE);
+    EMIT0(OP_RET);
 }
 
-static void emit_func_def(FILE *fp, node_t *node)
+static void emit_func_def(gen_t *gen, node_t *node)
 {
     assert(node && node->type == NODE_FUNC_DEF);
-    emit_func_prologue(fp, node);
-    emit_compound_stmt(fp, node->func_body);
-    emit_ret(fp);
+    emit_func_prologue(gen, node);
+    emit_compound_stmt(gen, NODE(node->func_body));
+    emit_ret(gen);
 }
 
 /* TODO: used to profile */
 #if 0
-static void mov_var(FILE *fp, node_t *node, char *reg)
+static void mov_var(gen_t *gen, node_t *node, operand_t reg)
 {
     int size;
 
-    assert(node && reg);
+    assert(node);
     size = node->ctype->size;
     switch (node->type) {
     case NODE_STRING:
-        EMIT_INST("mov", size, "$%s, %s", node->slabel, reg);
+        EMIT2(OP_MOV, size, ADDR(node->slabel), reg);
         break;
     case NODE_CONSTANT:
-        EMIT_INST("mov", size, "$%d, %s", node->ival, reg);
+        EMIT2(OP_MOV, size, IMM(node->ival), reg);
         break;
     case NODE_VAR_DECL:
-        EMIT_INST("mov", size, "-%d(%%rbp), %s", node->loffset, reg);
+        EMIT2(OP_MOV, size, RBP(node->loffset), reg);
         break;
 
     default:
-        EMIT_INST("mov", size, "%s, %s", rax[size], reg);
+        EMIT2(OP_MOV, size, RAX(size), reg);
     }
 }
 #endif
 
-static void emit_func_call(FILE *fp, node_t *node)
+static void emit_func_call(gen_t *gen, node_t *node)
 {
     int i;
     int float_idx, int_idx;
     node_t *arg;
 
     assert(node && node->type == NODE_FUNC_CALL);
-    for (i = vector_len(node->params) - 1; i >= 0; i--)  {
-        arg = vector_get(node->params, i);
-        emit(fp, arg);
+    for (i = (int) node->params.len - 1; i >= 0; i--)  {
+        arg = KID(node->params, i);
+        emit_node(gen, arg);
         if (is_float(arg->ctype))
             PUSH_XMM(0);
         else
-            PUSH("%%rax");
+            PUSH(REG_AX);
     }
-    for (i = float_idx = int_idx = 0; i < vector_len(node->params); i++) {
-        arg = vector_get(node->params, i);
+    for (i = float_idx = int_idx = 0; i < (int) node->params.len; i++) {
+        arg = KID(node->params, i);
         if (is_float(arg->ctype))
             POP_XMM(float_idx++);
         else
-            POP("%s", arg_regs[8][int_idx++]);
+            POP(arg_regs[int_idx++]);
     }
 
     if (node->is_va)
-        EMIT_INST("mov", 4, "$%d, %s", float_idx, rax[4]);
+        EMIT2(OP_MOV, 4, IMM(float_idx), RAX(4));
     /* size of stack frame is times of 16 bytes */
-    if (offset % 16 != 0) {
+    if (gen->offset % 16 != 0) {
         int temp;
-        temp = align(offset, 16);
-        EMIT("subq    $%d, %%rsp", temp - offset);
-        EMIT("call    %s", node->func_name);
-        EMIT("addq    $%d, %%rsp", temp - offset);
+        temp = align(gen->offset, 16);
+        EMIT2(OP_SUB, 8, IMM(temp - gen->offset), REG(REG_SP, 8));
+        EMIT1(OP_CALL, 0, LABEL(node->func_name));
+        EMIT2(OP_ADD, 8, IMM(temp - gen->offset), REG(REG_SP, 8));
     } else
-        EMIT("call    %s", node->func_name);
+        EMIT1(OP_CALL, 0, LABEL(node->func_name));
 }
 
-static void emit_var_decl(FILE *fp, node_t *node)
+static void emit_var_decl(gen_t *gen, node_t *node)
 {
     assert(node && (node->type == NODE_VAR_DECL || node->type == NODE_VAR));
     /* Avoid emit var to rax when decl */
@@ -1039,211 +1063,218 @@ static void emit_var_decl(FILE *fp, node_t *node)
         node->type = NODE_VAR;
     else {
         if (is_float(node->ctype))
-            EMIT("movs%c   -%d(%%rbp), %%xmm0", (node->ctype == ctype_float) ? 's' : 'd', node->loffset);
+            EMIT2(SSE(OP_MOVSS, node->ctype), 0, RBP(node->loffset), XMM(0));
         else if (is_array(node->ctype))
-            EMIT_INST("lea", node->ctype->size, "-%d(%%rbp), %s", node->loffset, rax[node->ctype->size]);
+            EMIT2(OP_LEA, node->ctype->size, RBP(node->loffset), RAX(node->ctype->size));
         else
-            EMIT_INST("mov", node->ctype->size, "-%d(%%rbp), %s", node->loffset, rax[node->ctype->size]);
+            EMIT2(OP_MOV, node->ctype->size, RBP(node->loffset), RAX(node->ctype->size));
     }
 }
 
-static void emit_var_init(FILE *fp, node_t *node)
+static void emit_var_init(gen_t *gen, node_t *node)
 {
     assert(node && node->type == NODE_VAR_INIT);
-    node->left->type = NODE_VAR;
-    emit(fp, node->right);
-    if (is_float(node->left->ctype)) {
-        EMIT("movs%c   %%xmm0, -%d(%%rbp)", (node->left->ctype == ctype_float) ? 's' : 'd', node->left->loffset);
+    NODE(node->left)->type = NODE_VAR;
+    emit_node(gen, NODE(node->right));
+    if (is_float(NODE(node->left)->ctype)) {
+        EMIT2(SSE(OP_MOVSS, NODE(node->left)->ctype), 0, XMM(0), RBP(NODE(node->left)->loffset));
     } else {
-        int size = node->left->ctype->size;
-        EMIT_INST("mov", size, "%s, -%d(%%rbp)", rax[size], node->left->loffset);
+        int size = NODE(node->left)->ctype->size;
+        EMIT2(OP_MOV, size, RAX(size), RBP(NODE(node->left)->loffset));
     }
 }
 
-static void emit_array_init(FILE *fp, node_t *node)
+static void emit_array_init(gen_t *gen, node_t *node)
 {
     int loffset;
     int size;
     size_t i;
 
     assert(node && node->type == NODE_ARRAY_INIT);
-    node->array->type = NODE_VAR;
-    loffset = node->array->loffset;
-    size = node->array->ctype->ptr->size;
-    for (i = 0; i < vector_len(node->array_init); i++, loffset -= size) {
-        node_t *init = vector_get(node->array_init, i);
-        emit(fp, init);
+    NODE(node->array)->type = NODE_VAR;
+    loffset = NODE(node->array)->loffset;
+    size = NODE(node->array)->ctype->ptr->size;
+    for (i = 0; i < node->array_init.len; i++, loffset -= size) {
+        node_t *init = KID(node->array_init, i);
+        emit_node(gen, init);
         if (is_float(init->ctype))
-            EMIT("movs%c   %%xmm0, -%d(%%rbp)", (init->ctype == ctype_float) ? 's' :'d', loffset);
+            EMIT2(SSE(OP_MOVSS, init->ctype), 0, XMM(0), RBP(loffset));
         else
-            EMIT_INST("mov", size, "%s, -%d(%%rbp)", rax[size], loffset);
+            EMIT2(OP_MOV, size, RAX(size), RBP(loffset));
     }
-    for (; i < node->array->ctype->len; i++, loffset -= size) {
-        EMIT_INST("mov", size, "$0, -%d(%%rbp)", loffset);
+    for (; i < (size_t) NODE(node->array)->ctype->len; i++, loffset -= size) {
+        EMIT2(OP_MOV, size, IMM(0), RBP(loffset));
     }
 }
 
-static vector_t *get_local_var(node_t *node)
+static vector_t *get_local_var(gen_t *gen, node_t *node)
 {
     size_t i;
-    vector_t *vars;
+    vector_t *vars = gen->vars;
 
     assert(node && node->type == NODE_COMPOUND_STMT);
-    if (!node->stmts)
+    if (!node->stmts.len)
         return NULL;
 
-    vars = make_vector();
-    for (i = 0; i < vector_len(node->stmts); i++) {
-        node_t *expr = vector_get(node->stmts, i);
+    vars->top = 0;
+    for (i = 0; i < node->stmts.len; i++) {
+        node_t *expr = KID(node->stmts, i);
         /* init-decl-list */
         if (expr->type == NODE_BINARY && expr->unary_op == ',' && expr->ctype == NULL) {
             /* iterative inorder traversal */
-            vector_t *stack = make_vector();
+            vector_t *stack = gen->stack;
             while (expr) {
                 if (expr->type == NODE_BINARY) {
-                    vector_append(stack, expr);
-                    expr = expr->left;
+                    vector_append(stack, NODE(expr->right));
+                    expr = NODE(expr->left);
                 } else {
                     if (expr->type == NODE_VAR_INIT)
-                        vector_append(vars, expr->left);
+                        vector_append(vars, NODE(expr->left));
                     else if (expr->type == NODE_ARRAY_INIT)
-                        vector_append(vars, expr->array);
+                        vector_append(vars, NODE(expr->array));
                     else
                         vector_append(vars, expr);
-                    expr = vector_len(stack) ? ((node_t *) vector_pop(stack))->right : NULL;
+                    expr = vector_len(stack) ? vector_pop(stack) : NULL;
                 }
             }
-            free_vector(stack, NULL);
         } else if (expr->type == NODE_VAR_INIT)
-            vector_append(vars, expr->left);
+            vector_append(vars, NODE(expr->left));
         else if (expr->type == NODE_VAR_DECL)
             vector_append(vars, expr);
         else if (expr->type == NODE_ARRAY_INIT)
-            vector_append(vars, expr->array);
+            vector_append(vars, NODE(expr->array));
     }
     return vars;
 }
 
-static void emit_compound_stmt(FILE *fp, node_t *node)
+static void emit_compound_stmt(gen_t *gen, node_t *node)
 {
     size_t i;
     int prev_offset;
+    vector_t *vars;
 
     assert(node && node->type == NODE_COMPOUND_STMT);
-    prev_offset = offset;
-    set_var_offset(get_local_var(node));
-    if (offset != prev_offset)
-        EMIT("subq    $%d, %%rsp", offset - prev_offset);
-    for (i = 0; i < vector_len(node->stmts); i++)
-        emit(fp, vector_get(node->stmts, i));
-    if (offset != prev_offset) {
-        EMIT("addq    $%d, %%rsp", offset - prev_offset);
-        offset = prev_offset;
+    prev_offset = gen->offset;
+    vars = get_local_var(gen, node);
+    if (vars) {
+        for (i = 0; i < vector_len(vars); i++)
+            set_var_offset(gen, vector_get(vars, i));
+        gen->offset = align(gen->offset, 8);
+    }
+    if (gen->offset != prev_offset)
+        EMIT2(OP_SUB, 8, IMM(gen->offset - prev_offset), REG(REG_SP, 8));
+    for (i = 0; i < node->stmts.len; i++)
+        emit_node(gen, KID(node->stmts, i));
+    if (gen->offset != prev_offset) {
+        EMIT2(OP_ADD, 8, IMM(gen->offset - prev_offset), REG(REG_SP, 8));
+        gen->offset = prev_offset;
     }
 }
 
-static void emit_return(FILE *fp, node_t *node)
+static void emit_return(gen_t *gen, node_t *node)
 {
     assert(node && node->type == NODE_RETURN);
-    emit(fp, node->expr);
-    emit_ret(fp);
+    emit_node(gen, NODE(node->expr));
+    emit_ret(gen);
 }
 
-static void emit_cast(FILE *fp, node_t *node)
+static void emit_cast(gen_t *gen, node_t *node)
 {
+    (void) gen;
+    (void) node;
 }
 
-static void emit_arith_conv(FILE *fp, node_t *node)
+static void emit_arith_conv(gen_t *gen, node_t *node)
 {
     ctype_t *from, *to;
-    char *inst;
+    int inst;
 
     assert(node && node->type == NODE_ARITH_CONV);
-    emit(fp, node->expr);
-    from = node->expr->ctype;
+    emit_node(gen, NODE(node->expr));
+    from = NODE(node->expr)->ctype;
     to = node->ctype;
     if (from == ctype_int) {
         /* int to float/double */
-        inst = (to == ctype_float) ? "cvtsi2ss" : "cvtsi2sd";
-        EMIT("%s %s, %%xmm0", inst, rax[from->size]);
+        inst = (to == ctype_float) ? OP_CVTSI2SS : OP_CVTSI2SD;
+        EMIT2(inst, 0, RAX(from->size), XMM(0));
     } else if (to == ctype_int) {
         /* float/double to int */
-        inst = (from == ctype_float) ? "cvtss2si" : "cvttsd2si";
-        EMIT("%s %%xmm0, %s", inst, rax[to->size]);
+        inst = (from == ctype_float) ? OP_CVTSS2SI : OP_CVTTSD2SI;
+        EMIT2(inst, 0, XMM(0), RAX(to->size));
     } else {
         /* float to double/double to float */
-        inst = (from == ctype_float) ? "cvtps2pd" : "cvtpd2ps";
-        EMIT("%s %%xmm0, %%xmm0", inst);
+        inst = (from == ctype_float) ? OP_CVTPS2PD : OP_CVTPD2PS;
+        EMIT2(inst, 0, XMM(0), XMM(0));
     }
 }
 
-void emit(FILE *fp, node_t *node)
+static void emit_node(gen_t *gen, node_t *node)
 {
-    assert(fp);
+    assert(gen);
     if (!node)
         return;
 
     switch (node->type) {
     case NODE_CONSTANT:
-        emit_constant(fp, node);
+        emit_constant(gen, node);
         break;
     case NODE_STRING:
-        emit_string(fp, node);
+        emit_string(gen, node);
         break;
     case NODE_POSTFIX:
         if (is_float(node->ctype))
-            emit_float_postfix_inc_dec(fp, node);
+            emit_float_postfix_inc_dec(gen, node);
         else
-            emit_postfix_inc_dec(fp, node);
+            emit_postfix_inc_dec(gen, node);
         break;
     case NODE_UNARY:
-        emit_unary(fp, node);
+        emit_unary(gen, node);
         break;
     case NODE_BINARY:
-        emit_binary(fp, node);
+        emit_binary(gen, node);
         break;
     case NODE_TERNARY:
-        emit_ternary(fp, node);
+        emit_ternary(gen, node);
         break;
     case NODE_IF:
-        emit_if(fp, node);
+        emit_if(gen, node);
         break;
     case NODE_FOR:
-        emit_for(fp, node);
+        emit_for(gen, node);
         break;
     case NODE_DO_WHILE:
-        emit_do_while(fp, node);
+        emit_do_while(gen, node);
         break;
     case NODE_WHILE:
-        emit_while(fp, node);
+        emit_while(gen, node);
         break;
     case NODE_FUNC_DEF:
-        emit_func_def(fp, node);
+        emit_func_def(gen, node);
         break;
     case NODE_FUNC_CALL:
-        emit_func_call(fp, node);
+        emit_func_call(gen, node);
         break;
     case NODE_VAR_DECL:
     case NODE_VAR:
-        emit_var_decl(fp, node);
+        emit_var_decl(gen, node);
         break;
     case NODE_VAR_INIT:
-        emit_var_init(fp, node);
+        emit_var_init(gen, node);
         break;
     case NODE_ARRAY_INIT:
-        emit_array_init(fp, node);
+        emit_array_init(gen, node);
         break;
     case NODE_COMPOUND_STMT:
-        emit_compound_stmt(fp, node);
+        emit_compound_stmt(gen, node);
         break;
     case NODE_RETURN:
-        emit_return(fp, node);
+        emit_return(gen, node);
         break;
     case NODE_CAST:
-        emit_cast(fp, node);
+        emit_cast(gen, node);
         break;
     case NODE_ARITH_CONV:
-        emit_arith_conv(fp, node);
+        emit_arith_conv(gen, node);
         break;
 
     default:
@@ -1251,3 +1282,70 @@ void emit(FILE *fp, node_t *node)
         break;
     }
 }
+
+void gen_init(gen_t *gen)
+{
+    memset(gen, 0, sizeof(gen_t));
+    gen->vars = make_vector();
+    gen->stack = make_vector();
+}
+
+void gen_reset(gen_t *gen)
+{
+    gen->offset = gen->njump = gen->ndata = 0;
+    memset(gen->consts, 0, sizeof(gen->consts));
+    free_names(gen);
+    gen->nlabels = 0;
+}
+
+void gen_close(gen_t *gen)
+{
+    free_names(gen);
+    free(gen->labels);
+    free(gen->names);
+    free_vector(gen->vars, NULL);
+    free_vector(gen->stack, NULL);
+    gen->labels = NULL;
+    gen->names = NULL;
+    gen->vars = gen->stack = NULL;
+    gen->nlabels = gen->labels_size = gen->names_size = 0;
+}
+
+void emit(gen_t *gen, code_t *code, ast_t *ast, node_t *node)
+{
+    gen->code = code;
+    gen->ast = ast;
+    emit_node(gen, node);
+}
+
+void gen_merge(gen_t *gen, gen_t *local, code_t *code)
+{
+    gen_label_t *label;
+    size_t i;
+
+    assert(local->local);
+    for (i = 0; i < local->nlabels; i++) {
+        label = &local->labels[i];
+        if (label->konst >= 0 && gen->consts[label->konst]) {
+            strcpy(label->name, gen->consts[label->konst]);
+            continue;
+        }
+        if (label->data)
+            snprintf(label->name, LABEL_SIZE, ".LC%d", gen->ndata++);
+        else
+            snprintf(label->name, LABEL_SIZE, ".L%d", gen->njump++);
+        if (label->konst >= 0) {
+            gen->consts[label->konst] = strcpy(new_name(gen), label->name);
+            label->konst = -1;
+        }
+    }
+    /* from the last, the earlier ones stay where they are */
+    for (i = local->nlabels; i-- > 0;) {
+        label = &local->labels[i];
+        if (label->konst < 0)
+            continue;
+        memmove(code->insts + label->start, code->insts + label->end,
+                sizeof(inst_t) * (code->ninsts - label->end));
+        code->ninsts -= label->end - label->start;
+    }
+}
@@ -1,9 +1,68 @@
 #ifndef GEN_H__
 #define GEN_H__
 
-#include <stdio.h>
+#include "inst.h"
 #include "parser.h"
 
-void emit(FILE *fp, node_t *node);
+/* constants emitted once per file */
+enum {
+    CONST_FLOAT1,
+    CONST_DOUBLE1,
+    CONST_FLOAT_NEG,
+    CONST_DOUBLE_NEG,
+    CONST_NUM
+};
+
+/* a label made while emitting a definition on its own, see gen_merge */
+typedef struct gen_label_t {
+    char *name;
+    /* .LC or .L */
+    bool data;
+    /* the CONST_* it names or -1, and the instructions of its data */
+    int konst;
+    size_t start;
+    size_t end;
+} gen_label_t;
+
+/* State of one translation unit, separate compilations share nothing */
+typedef struct gen_t {
+    /* where the definition being emitted goes and its tree */
+    code_t *code;
+    ast_t *ast;
+    /* bytes of the stack frame in use below %rbp */
+    int offset;
+    /* next .L and .LC label */
+    int njump;
+    int ndata;
+    /* labels of the constants, NULL until first used */
+    char *consts[CONST_NUM];
+    /* label names made since the last gen_reset, the code points at them */
+    char **names;
+    size_t nnames;
+    size_t names_size;
+    /* locals of a compound statement and the walk over its declarations */
+    vector_t *vars;
+    vector_t *stack;
+    /* emitting one definition apart from the file, every label is kept */
+    bool local;
+    gen_label_t *labels;
+    size_t nlabels;
+    size_t labels_size;
+} gen_t;
+
+void gen_init(gen_t *gen);
+/* forget the labels and constants, keep the memory for the next */
+void gen_reset(gen_t *gen);
+void gen_close(gen_t *gen);
+/* append the instructions for node to code */
+void emit(gen_t *gen, code_t *code, ast_t *ast, node_t *node);
+/* Renumber the labels of code, emitted by the local gen_t, as if it had
+ * been emitted into gen, and drop the constants gen already has.  Labels
+ * of constants new to gen are copied into it, code keeps pointing into
+ * local until local is reset.  Merging
+ * the definitions in source order gives the output of emitting them
+ * one after another.
+ */
+void gen_merge(gen_t *gen, gen_t *local, code_t *code);
 
 #endif
@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "inst.h"
+#include "util.h"
+
+#define CODE_INIT_SIZE 256
+
+/* pad: spaces after the mnemonic, 0 pads it to 8 columns */
+static struct {
+    const char *name;
+    char sized;
+    char pad;
+} ops[OP_NUM] = {
+    [OP_MOV] = {"mov", 1, 4},
+    [OP_ADD] = {"add", 1, 4},
+    [OP_SUB] = {"sub", 1, 4},
+    [OP_IMUL] = {"imul", 1, 4},
+    [OP_IDIV] = {"idiv", 1, 4},
+    [OP_SAL] = {"sal", 1, 4},
+    [OP_SAR] = {"sar", 1, 4},
+    [OP_AND] = {"and", 1, 4},
+    [OP_OR] = {"or", 1, 4},
+    [OP_XOR] = {"xor", 1, 4},
+    [OP_NEG] = {"neg", 1, 4},
+    [OP_NOT] = {"not", 1, 4},
+    [OP_TEST] = {"test", 1, 4},
+    [OP_CMP] = {"cmp", 1, 4},
+    [OP_LEA] = {"lea", 1, 4},
+    [OP_PUSH] = {"pushq", 0, 0},
+    [OP_POP] = {"popq", 0, 0},
+    [OP_MOVZB] = {"movzbl", 0, 0},
+    [OP_CLTQ] = {"cltq", 0, 0},
+    [OP_CLTD] = {"cltd", 0, 0},
+    [OP_JMP] = {"jmp", 0, 0},
+    [OP_JE] = {"je", 0, 6},
+    [OP_JNE] = {"jne", 0, 6},
+    [OP_JP] = {"jp", 0, 6},
+    [OP_JNP] = {"jnp", 0, 6},
+    [OP_SETL] = {"setl", 0, 4},
+    [OP_SETG] = {"setg", 0, 4},
+    [OP_SETLE] = {"setle", 0, 4},
+    [OP_SETGE] = {"setge", 0, 4},
+    [OP_SETE] = {"sete", 0, 4},
+    [OP_SETNE] = {"setne", 0, 4},
+    [OP_SETA] = {"seta", 0, 4},
+    [OP_SETAE] = {"setae", 0, 4},
+    [OP_SETNA] = {"setna", 0, 4},
+    [OP_SETNAE] = {"setnae", 0, 4},
+    [OP_SETP] = {"setp", 0, 4},
+    [OP_SETNP] = {"setnp", 0, 4},
+    [OP_CALL] = {"call", 0, 0},
+    [OP_LEAVE] = {"leave", 0, 0},
+    [OP_RET] = {"ret", 0, 0},
+    [OP_MOVSS] = {"movss", 0, 0},
+    [OP_MOVSD] = {"movsd", 0, 0},
+    [OP_ADDSS] = {"addss", 0, 0},
+    [OP_ADDSD] = {"addsd", 0, 0},
+    [OP_SUBSS] = {"subss", 0, 0},
+    [OP_SUBSD] = {"subsd", 0, 0},
+    [OP_MULSS] = {"mulss", 0, 0},
+    [OP_MULSD] = {"mulsd", 0, 0},
+    [OP_DIVSS] = {"divss", 0, 0},
+    [OP_DIVSD] = {"divsd", 0, 0},
+    [OP_XORPS] = {"xorps", 0, 0},
+    [OP_XORPD] = {"xorpd", 0, 0},
+    [OP_UCOMISS] = {"ucomiss", 0, 0},
+    [OP_UCOMISD] = {"ucomisd", 0, 0},
+    [OP_CVTSI2SS] = {"cvtsi2ss", 0, 0},
+    [OP_CVTSI2SD] = {"cvtsi2sd", 0, 0},
+    [OP_CVTSS2SI] = {"cvtss2si", 0, 0},
+    [OP_CVTTSD2SI] = {"cvttsd2si", 0, 0},
+    [OP_CVTPS2PD] = {"cvtps2pd", 0, 0},
+    [OP_CVTPD2PS] = {"cvtpd2ps", 0, 0},
+};
+
+static const char suffix[9] = {0, 'b', 'w', 0, 'l', 0, 0, 0, 'q'};
+
+/* indexed by size, then register */
+static const char *regs[9][16] = {
+    [1] = {"%al", "%cl", "%dl", "%bl", "%spl", "%bpl", "%sil", "%dil",
+        "%r8b", "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b"},
+    [2] = {"%ax", "%cx", "%dx", "%bx", "%sp", "%bp", "%si", "%di",
+        "%r8w", "%r9w", "%r10w", "%r11w", "%r12w", "%r13w", "%r14w", "%r15w"},
+    [4] = {"%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
+        "%r8d", "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d"},
+    [8] = {"%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+        "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"},
+};
+
+void code_init(code_t *code)
+{
+    assert(code);
+    code->insts = NULL;
+    code->ninsts = code->insts_size = 0;
+}
+
+inst_t *code_append(code_t *code, int op, int size, operand_t a, operand_t b)
+{
+    inst_t *inst;
+
+    assert(code && op >= 0 && op < OP_NUM);
+    if (code->ninsts == code->insts_size) {
+        code->insts_size = code->insts_size ? code->insts_size * 2 : CODE_INIT_SIZE;
+        code->insts = realloc(code->insts, sizeof(inst_t) * code->insts_size);
+    }
+    inst = &code->insts[code->ninsts++];
+    inst->op = op;
+    inst->size = size;
+    inst->args[0] = a;
+    inst->args[1] = b;
+    return inst;
+}
+
+void code_reset(code_t *code)
+{
+    assert(code);
+    code->ninsts = 0;
+}
+
+/* room for an instruction without its labels */
+#define INST_MAX 128
+
+static char *put_str(char *p, const char *s)
+{
+    size_t len = strlen(s);
+
+    memcpy(p, s, len);
+    return p + len;
+}
+
+static char *put_reg(char *p, int reg, int size)
+{
+    if (reg >= REG_XMM0) {
+        memcpy(p, "%xmm", 4);
+        return put_long(p + 4, reg - REG_XMM0);
+    }
+    return put_str(p, regs[size][reg]);
+}
+
+static char *put_operand(char *p, operand_t *arg)
+{
+    switch (arg->kind) {
+    case OPND_REG:
+        return put_reg(p, arg->reg, arg->size);
+    case OPND_IMM:
+        *p++ = '$';
+        return put_long(p, arg->imm);
+    case OPND_MEM:
+        if (arg->reg == REG_RIP) {
+            p = put_str(p, arg->label);
+            memcpy(p, "(%rip)", 6);
+            return p + 6;
+        }
+        if (arg->imm)
+            p = put_long(p, arg->imm);
+        *p++ = '(';
+        p = put_reg(p, arg->reg, 8);
+        *p++ = ')';
+        return p;
+    case OPND_ADDR:
+        *p++ = '$';
+        /* fall through */
+    case OPND_LABEL:
+        return put_str(p, arg->label);
+
+    default:
+        errorf("invalid operand kind %d\n", arg->kind);
+        return p;
+    }
+}
+
+static void print_inst(out_t *out, inst_t *inst)
+{
+    size_t need = INST_MAX;
+    char *p, *start;
+    int i, pad;
+
+    for (i = 0; i < 2; i++)
+        if (inst->args[i].label)
+            need += strlen(inst->args[i].label);
+    p = out_reserve(out, need);
+    *p++ = '\t';
+    start = p;
+    p = put_str(p, ops[inst->op].name);
+    if (ops[inst->op].sized)
+        *p++ = suffix[inst->size];
+    if (inst->args[0].kind != OPND_NONE) {
+        pad = ops[inst->op].pad;
+        if (!pad)
+            pad = p - start < 8 ? 8 - (p - start) : 1;
+        memset(p, ' ', pad);
+        p = put_operand(p + pad, &inst->args[0]);
+        if (inst->args[1].kind != OPND_NONE) {
+            *p++ = ',';
+            *p++ = ' ';
+            p = put_operand(p, &inst->args[1]);
+        }
+    }
+    *p++ = '\n';
+    out->len = p - out->buf;
+}
+
+void code_print(out_t *out, code_t *code)
+{
+    size_t i;
+    inst_t *inst;
+    char *s;
+
+    assert(out && code);
+    for (i = 0; i < code->ninsts; i++) {
+        inst = &code->insts[i];
+        switch (inst->op) {
+        case OP_LABEL:
+            out_str(out, inst->args[0].label);
+            out_mem(out, ":\n", 2);
+            break;
+        case OP_TEXT:
+            out_mem(out, "\t.text\n", 7);
+            break;
+        case OP_RODATA:
+            out_mem(out, "\t.section\t.rodata\n", 18);
+            break;
+        case OP_ALIGN:
+            out_format(out, "\t.align %ld\n", inst->args[0].imm);
+            break;
+        case OP_LONG:
+            out_format(out, "\t.long   %ld\n", inst->args[0].imm);
+            break;
+        case OP_QUAD:
+            out_format(out, "\t.quad   %ld\n", inst->args[0].imm);
+            break;
+        case OP_STRING:
+            s = unescape(inst->args[0].label, inst->args[0].imm);
+            out_format(out, "\t.string \"%s\"\n", s);
+            free(s);
+            break;
+        case OP_GLOBL:
+            out_format(out, "\t.globl  %s\n", inst->args[0].label);
+            break;
+        case OP_TYPE_FUNC:
+            out_format(out, "\t.type   %s, @function\n", inst->args[0].label);
+            break;
+
+        default:
+            print_inst(out, inst);
+            break;
+        }
+    }
+}
+
+void code_close(code_t *code)
+{
+    assert(code);
+    free(code->insts);
+}
@@ -0,0 +1,161 @@
+#ifndef INST_H__
+#define INST_H__
+
+#include <stddef.h>
+#include "out.h"
+
+/* registers, numbered as in the instruction encoding */
+enum {
+    REG_AX,
+    REG_CX,
+    REG_DX,
+    REG_BX,
+    REG_SP,
+    REG_BP,
+    REG_SI,
+    REG_DI,
+    REG_R8,
+    REG_R9,
+    REG_R10,
+    REG_R11,
+    REG_R12,
+    REG_R13,
+    REG_R14,
+    REG_R15,
+    REG_XMM0, /* REG_XMM0 + n is %xmmn */
+    REG_RIP = REG_XMM0 + 16
+};
+
+enum {
+    OPND_NONE,
+    OPND_REG, /* %reg of size */
+    OPND_IMM, /* $imm */
+    OPND_MEM, /* imm(%reg) or label(%rip) */
+    OPND_LABEL, /* jump or call target */
+    OPND_ADDR, /* $label */
+    OPND_STR /* imm bytes at label */
+};
+
+enum {
+    /* integer, suffixed with the size of the instruction */
+    OP_MOV,
+    OP_ADD,
+    OP_SUB,
+    OP_IMUL,
+    OP_IDIV,
+    OP_SAL,
+    OP_SAR,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_NEG,
+    OP_NOT,
+    OP_TEST,
+    OP_CMP,
+    OP_LEA,
+    /* integer, fixed size */
+    OP_PUSH,
+    OP_POP,
+    OP_MOVZB,
+    OP_CLTQ,
+    OP_CLTD,
+    OP_JMP,
+    OP_JE,
+    OP_JNE,
+    OP_JP,
+    OP_JNP,
+    OP_SETL,
+    OP_SETG,
+    OP_SETLE,
+    OP_SETGE,
+    OP_SETE,
+    OP_SETNE,
+    OP_SETA,
+    OP_SETAE,
+    OP_SETNA,
+    OP_SETNAE,
+    OP_SETP,
+    OP_SETNP,
+    OP_CALL,
+    OP_LEAVE,
+    OP_RET,
+    /* SSE, the double form right after the float one */
+    OP_MOVSS,
+    OP_MOVSD,
+    OP_ADDSS,
+    OP_ADDSD,
+    OP_SUBSS,
+    OP_SUBSD,
+    OP_MULSS,
+    OP_MULSD,
+    OP_DIVSS,
+    OP_DIVSD,
+    OP_XORPS,
+    OP_XORPD,
+    OP_UCOMISS,
+    OP_UCOMISD,
+    OP_CVTSI2SS,
+    OP_CVTSI2SD,
+    OP_CVTSS2SI,
+    OP_CVTTSD2SI,
+    OP_CVTPS2PD,
+    OP_CVTPD2PS,
+    /* labels and directives */
+    OP_LABEL, /* args[0] */
+    OP_TEXT,
+    OP_RODATA,
+    OP_ALIGN, /* args[0].imm */
+    OP_LONG, /* args[0].imm */
+    OP_QUAD, /* args[0].imm */
+    OP_STRING, /* args[0] */
+    OP_GLOBL, /* args[0] */
+    OP_TYPE_FUNC, /* args[0] */
+    OP_NUM
+};
+
+typedef struct operand_t {
+    unsigned char kind;
+    /* OPND_REG, base of OPND_MEM */
+    unsigned char reg;
+    /* size of OPND_REG */
+    unsigned char size;
+    /* OPND_IMM, displacement of OPND_MEM, length of OPND_STR */
+    long imm;
+    /* OPND_LABEL, OPND_ADDR, OPND_STR, OPND_MEM relative to %rip */
+    const char *label;
+} operand_t;
+
+/* operands are in AT&T order, the destination last */
+typedef struct inst_t {
+    unsigned char op;
+    /* of the integer instructions that take a suffix */
+    unsigned char size;
+    operand_t args[2];
+} inst_t;
+
+/* the instructions and directives of one definition */
+typedef struct code_t {
+    inst_t *insts;
+    size_t ninsts;
+    size_t insts_size;
+} code_t;
+
+#define NONE() ((operand_t){OPND_NONE, 0, 0, 0, NULL})
+#define REG(reg, size) ((operand_t){OPND_REG, reg, size, 0, NULL})
+#define XMM(n) ((operand_t){OPND_REG, REG_XMM0 + (n), 8, 0, NULL})
+#define IMM(imm) ((operand_t){OPND_IMM, 0, 0, imm, NULL})
+#define MEM(reg, disp) ((operand_t){OPND_MEM, reg, 8, disp, NULL})
+#define RIP(label) ((operand_t){OPND_MEM, REG_RIP, 8, 0, label})
+#define LABEL(label) ((operand_t){OPND_LABEL, 0, 0, 0, label})
+#define ADDR(label) ((operand_t){OPND_ADDR, 0, 0, 0, label})
+#define STR(s, len) ((operand_t){OPND_STR, 0, 0, len, s})
+
+void code_init(code_t *code);
+inst_t *code_append(code_t *code, int op, int size, operand_t a, operand_t b);
+/* forget the instructions, keep the memory */
+void code_reset(code_t *code);
+/* write code in AT&T syntax */
+void code_print(out_t *out, code_t *code);
+void code_close(code_t *code);
+
+#endif
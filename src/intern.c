@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "intern.h"
+#include "dict.h"
+
+typedef struct intern_t {
+    size_t hash;
+    size_t len;
+    char str[];
+} intern_t;
+
+#define INTERN_INIT_SIZE 256
+#define ENTRY(s) ((intern_t *) ((s) - offsetof(intern_t, str)))
+
+void intern_init(interns_t *interns)
+{
+    assert(interns);
+    interns->table = calloc(INTERN_INIT_SIZE, sizeof(intern_t *));
+    interns->used = 0;
+    interns->mask = INTERN_INIT_SIZE - 1;
+}
+
+void intern_close(interns_t *interns)
+{
+    size_t i;
+
+    assert(interns);
+    for (i = 0; i <= interns->mask; i++)
+        free(interns->table[i]);
+    free(interns->table);
+    interns->table = NULL;
+    interns->used = interns->mask = 0;
+}
+
+static void intern_resize(interns_t *interns, size_t new_size)
+{
+    intern_t **old = interns->table;
+    size_t i, j, old_size = interns->mask + 1, mask = new_size - 1;
+
+    interns->table = calloc(new_size, sizeof(intern_t *));
+    interns->mask = mask;
+    for (i = 0; i < old_size; i++) {
+        if (!old[i])
+            continue;
+        for (j = old[i]->hash & mask; interns->table[j]; j = (j + 1) & mask)
+            ;
+        interns->table[j] = old[i];
+    }
+    free(old);
+}
+
+char *intern(interns_t *interns, const char *s, size_t len)
+{
+    intern_t *e;
+    size_t h, i;
+
+    assert(interns && s);
+    h = dict_hash(s, len);
+    for (i = h & interns->mask; (e = interns->table[i]); i = (i + 1) & interns->mask)
+        if (e->hash == h && e->len == len && !memcmp(e->str, s, len))
+            return e->str;
+
+    e = malloc(sizeof(intern_t) + len + 1);
+    e->hash = h;
+    e->len = len;
+    memcpy(e->str, s, len);
+    e->str[len] = '\0';
+    interns->table[i] = e;
+    if (++interns->used * 3 >= (interns->mask + 1) * 2)
+        intern_resize(interns, (interns->mask + 1) * 2);
+    return e->str;
+}
+
+size_t intern_hash(const char *s)
+{
+    assert(s);
+    return ENTRY(s)->hash;
+}
@@ -0,0 +1,20 @@
+#ifndef INTERN_H__
+#define INTERN_H__
+
+#include <stddef.h>
+
+/* Table of the strings of one translation unit, freed by intern_close */
+typedef struct interns_t {
+    struct intern_t **table;
+    size_t used;
+    size_t mask;
+} interns_t;
+
+void intern_init(interns_t *interns);
+void intern_close(interns_t *interns);
+/* Return the canonical copy of s[0..len), equal strings share one pointer */
+char *intern(interns_t *interns, const char *s, size_t len);
+/* Precomputed dict_hash of a string returned by intern */
+size_t intern_hash(const char *s);
+
+#endif
@@ -0,0 +1,103 @@
+#define _GNU_SOURCE /* MAP_32BIT, RTLD_DEFAULT */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "jit.h"
+#include "util.h"
+
+/* jmp *0(%rip) and the address, rounded up */
+#define STUB_SIZE 16
+
+#define ALIGN(n, a) (((n) + (a) - 1) / (a) * (a))
+
+static void put32(unsigned char *p, long v)
+{
+    int i;
+
+    for (i = 0; i < 4; i++, v >>= 8)
+        p[i] = v & 0xff;
+}
+
+/* calls to libc go through a stub, it may be mapped anywhere */
+static uintptr_t make_stub(unsigned char *p, void *addr)
+{
+    p[0] = 0xff;
+    p[1] = 0x25;
+    put32(p + 2, 0);
+    memcpy(p + 6, &addr, sizeof(addr));
+    return (uintptr_t) p;
+}
+
+int jit_run(elf_t *elf)
+{
+    size_t rodata_off, stubs_off, size, i, n;
+    unsigned char *base;
+    uintptr_t *addrs, s, pc;
+    elf_sym_t *sym;
+    Elf64_Rela *rela;
+    int (*entry)(void);
+    void *val;
+    long v;
+    int status;
+
+    assert(elf);
+    if (!(val = dict_lookup(elf->symbols, "main")) || !elf->syms[(uintptr_t) val - 1].defined)
+        errorf("undefined symbol main\n");
+    sym = &elf->syms[(uintptr_t) val - 1];
+
+    /* .text, .rodata, then a stub for every symbol */
+    rodata_off = ALIGN(elf->text->top, 16);
+    stubs_off = ALIGN(rodata_off + elf->rodata->top, 16);
+    size = ALIGN(stubs_off + elf->nsyms * STUB_SIZE, (size_t) sysconf(_SC_PAGESIZE));
+    /* in the low 2GB, so $label fits in a sign extended 32 bit immediate */
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (base == MAP_FAILED)
+        errorf("mmap failed: %s\n", strerror(errno));
+    memcpy(base, elf->text->stack, elf->text->top);
+    if (elf->rodata->top)
+        memcpy(base + rodata_off, elf->rodata->stack, elf->rodata->top);
+
+    addrs = malloc(sizeof(uintptr_t) * (elf->nsyms + 1));
+    for (i = 0; i < elf->nsyms; i++) {
+        if (elf->syms[i].defined) {
+            addrs[i] = (uintptr_t) base + elf->syms[i].value;
+            continue;
+        }
+        if (!(val = dlsym(RTLD_DEFAULT, elf->syms[i].name)))
+            errorf("undefined symbol %s\n", elf->syms[i].name);
+        addrs[i] = make_stub(base + stubs_off + i * STUB_SIZE, val);
+    }
+
+    for (i = 0; i < elf->nrelas; i++) {
+        rela = &elf->relas[i];
+        n = ELF64_R_SYM(rela->r_info);
+        s = (n == SYM_RODATA) ? (uintptr_t) base + rodata_off : addrs[n - 1];
+        pc = (uintptr_t) base + rela->r_offset;
+        switch (ELF64_R_TYPE(rela->r_info)) {
+        case R_X86_64_PC32:
+        case R_X86_64_PLT32:
+            v = (long) s + rela->r_addend - (long) pc;
+            break;
+
+        default:
+            v = (long) s + rela->r_addend;
+            break;
+        }
+        if (v < INT32_MIN || v > INT32_MAX)
+            errorf("relocation out of range\n");
+        put32(base + rela->r_offset, v);
+    }
+    free(addrs);
+
+    if (mprotect(base, size, PROT_READ | PROT_EXEC))
+        errorf("mprotect failed: %s\n", strerror(errno));
+    entry = (int (*)(void)) (base + sym->value);
+    status = entry();
+    munmap(base, size);
+    return status;
+}
@@ -0,0 +1,11 @@
+#ifndef JIT_H__
+#define JIT_H__
+
+#include "elfobj.h"
+
+/* load the code of elf into executable memory, link it against the
+ * running libc and call main, return what it returns
+ */
+int jit_run(elf_t *elf);
+
+#endif
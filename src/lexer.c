@@ -2,11 +2,17 @@
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "lexer.h"
 #include "util.h"
-#include "dict.h"
+#include "intern.h"
+#include "scan.h"
 #include "buffer.h"
 
+#define TOKEN_BLOCK_SIZE 256
+
 /* buffer helper */
 #define PUTC(buffer, c) \
     do { \
@@ -15,7 +21,7 @@
 
 #define SET_STRING(buffer, s) \
     do { \
-        (s) = malloc(sizeof(char) * (buffer->top + 1)); \
+        (s) = arena_alloc(lexer->arena, sizeof(char) * (buffer->top + 1)); \
         memcpy(s, buffer->stack, buffer->top); \
         s[buffer->top] = '\0'; \
     } while (0)
@@ -23,157 +29,225 @@
 /* i/o functions */
 static int get_c(lexer_t *lexer)
 {
-    int c = getc(lexer->fp);
-
-    if (c == '\n') {
-        lexer->line++;
-        lexer->prev_column = lexer->column;
-        lexer->column = 0;
-    } else
-        lexer->column++;
-    return c;
+    if (lexer->p >= lexer->end)
+        return EOF;
+    return (unsigned char) *lexer->p++;
 }
 
 static void unget_c(int c, lexer_t *lexer)
 {
-    if (c == '\n') {
-        lexer->line--;
-        lexer->column = lexer->prev_column;
-    } else
-        lexer->column--;
-    ungetc(c, lexer->fp);
+    if (c != EOF)
+        lexer->p--;
 }
 
-static bool expect_c(int c, lexer_t *lexer)
-{
-    int c1 = get_c(lexer);
-
-    if (c1 == c)
-        return true;
-    else {
-        unget_c(c1, lexer);
-        return false;
-    }
-}
-
-static dict_t *kw;
+/* character classes, dispatched on by lex_token */
+enum {
+    CC_OTHER,
+    CC_SPACE,
+    CC_DIGIT,
+    CC_IDENT,
+    CC_QUOTE,
+    CC_DQUOTE,
+    CC_PUNCT
+};
+
+static const unsigned char char_class[256] = {
+    [' '] = CC_SPACE, ['\t' ... '\r'] = CC_SPACE,
+    ['0' ... '9'] = CC_DIGIT,
+    ['a' ... 'z'] = CC_IDENT, ['A' ... 'Z'] = CC_IDENT, ['_'] = CC_IDENT,
+    ['\''] = CC_QUOTE,
+    ['\"'] = CC_DQUOTE,
+    ['['] = CC_PUNCT, [']'] = CC_PUNCT, ['('] = CC_PUNCT, [')'] = CC_PUNCT,
+    ['{'] = CC_PUNCT, ['}'] = CC_PUNCT, ['.'] = CC_PUNCT, ['~'] = CC_PUNCT,
+    [':'] = CC_PUNCT, [','] = CC_PUNCT, [';'] = CC_PUNCT, ['?'] = CC_PUNCT,
+    ['+'] = CC_PUNCT, ['-'] = CC_PUNCT, ['*'] = CC_PUNCT, ['/'] = CC_PUNCT,
+    ['%'] = CC_PUNCT, ['&'] = CC_PUNCT, ['|'] = CC_PUNCT, ['^'] = CC_PUNCT,
+    ['='] = CC_PUNCT, ['!'] = CC_PUNCT, ['<'] = CC_PUNCT, ['>'] = CC_PUNCT
+};
+
+/* Punctuator DFA. Every prefix of a punctuator is itself a punctuator, so
+ * following transitions as far as possible yields the longest match and
+ * each state reached accepts punct_accept[state].
+ */
+enum {
+    ST_NONE,
+    ST_START,
+    ST_SINGLE, /* [ ] ( ) { } . ~ : , ; ? */
+    ST_ADD, ST_INC, ST_IADD,
+    ST_BIT_AND, ST_AND, ST_IAND,
+    ST_BIT_OR, ST_OR, ST_IOR,
+    ST_SUB, ST_DEC, ST_ISUB, ST_ARROW,
+    ST_MUL, ST_IMUL,
+    ST_DIV, ST_IDIV,
+    ST_MOD, ST_IMOD,
+    ST_ASSIGN, ST_EQ,
+    ST_NOT, ST_NE,
+    ST_XOR, ST_IXOR,
+    ST_LT, ST_LE, ST_LSFT, ST_ILSFT,
+    ST_GT, ST_GE, ST_RSFT, ST_IRSFT,
+    ST_NUM
+};
+
+static const unsigned char punct_next[ST_NUM][128] = {
+    [ST_START] = {
+        ['['] = ST_SINGLE, [']'] = ST_SINGLE, ['('] = ST_SINGLE, [')'] = ST_SINGLE,
+        ['{'] = ST_SINGLE, ['}'] = ST_SINGLE, ['.'] = ST_SINGLE, ['~'] = ST_SINGLE,
+        [':'] = ST_SINGLE, [','] = ST_SINGLE, [';'] = ST_SINGLE, ['?'] = ST_SINGLE,
+        ['+'] = ST_ADD, ['&'] = ST_BIT_AND, ['|'] = ST_BIT_OR, ['-'] = ST_SUB,
+        ['*'] = ST_MUL, ['/'] = ST_DIV, ['%'] = ST_MOD, ['='] = ST_ASSIGN,
+        ['!'] = ST_NOT, ['^'] = ST_XOR, ['<'] = ST_LT, ['>'] = ST_GT
+    },
+    [ST_ADD] = {['+'] = ST_INC, ['='] = ST_IADD},
+    [ST_BIT_AND] = {['&'] = ST_AND, ['='] = ST_IAND},
+    [ST_BIT_OR] = {['|'] = ST_OR, ['='] = ST_IOR},
+    [ST_SUB] = {['-'] = ST_DEC, ['='] = ST_ISUB, ['>'] = ST_ARROW},
+    [ST_MUL] = {['='] = ST_IMUL},
+    [ST_DIV] = {['='] = ST_IDIV},
+    [ST_MOD] = {['='] = ST_IMOD},
+    [ST_ASSIGN] = {['='] = ST_EQ},
+    [ST_NOT] = {['='] = ST_NE},
+    [ST_XOR] = {['='] = ST_IXOR},
+    [ST_LT] = {['='] = ST_LE, ['<'] = ST_LSFT},
+    [ST_LSFT] = {['='] = ST_ILSFT},
+    [ST_GT] = {['='] = ST_GE, ['>'] = ST_RSFT},
+    [ST_RSFT] = {['='] = ST_IRSFT}
+};
+
+/* ST_SINGLE accepts the character itself */
+static const int punct_accept[ST_NUM] = {
+    [ST_ADD] = '+', [ST_INC] = PUNCT_INC, [ST_IADD] = PUNCT_IADD,
+    [ST_BIT_AND] = '&', [ST_AND] = PUNCT_AND, [ST_IAND] = PUNCT_IAND,
+    [ST_BIT_OR] = '|', [ST_OR] = PUNCT_OR, [ST_IOR] = PUNCT_IOR,
+    [ST_SUB] = '-', [ST_DEC] = PUNCT_DEC, [ST_ISUB] = PUNCT_ISUB, [ST_ARROW] = PUNCT_ARROW,
+    [ST_MUL] = '*', [ST_IMUL] = PUNCT_IMUL,
+    [ST_DIV] = '/', [ST_IDIV] = PUNCT_IDIV,
+    [ST_MOD] = '%', [ST_IMOD] = PUNCT_IMOD,
+    [ST_ASSIGN] = '=', [ST_EQ] = PUNCT_EQ,
+    [ST_NOT] = '!', [ST_NE] = PUNCT_NE,
+    [ST_XOR] = '^', [ST_IXOR] = PUNCT_IXOR,
+    [ST_LT] = '<', [ST_LE] = PUNCT_LE, [ST_LSFT] = PUNCT_LSFT, [ST_ILSFT] = PUNCT_ILSFT,
+    [ST_GT] = '>', [ST_GE] = PUNCT_GE, [ST_RSFT] = PUNCT_RSFT, [ST_IRSFT] = PUNCT_IRSFT
+};
 
 /* type functions */
-int is_keyword(const char *s)
+
+/* Keywords are told apart by length and first character and confirmed by
+ * memcmp, so there is no table to build, free or share between files.
+ */
+static int is_keyword(const char *s, size_t len)
 {
-    int ret;
-
-    if (!kw) {
-        kw = make_dict(NULL);
-        dict_insert(kw, "void", (void *) KW_VOID, true);
-        dict_insert(kw, "char", (void *) KW_CHAR, true);
-        dict_insert(kw, "int", (void *) KW_INT, true);
-        dict_insert(kw, "float", (void *) KW_FLOAT, true);
-        dict_insert(kw, "double", (void *) KW_DOUBLE, true);
-        dict_insert(kw, "for", (void *) KW_FOR, true);
-        dict_insert(kw, "do", (void *) KW_DO, true);
-        dict_insert(kw, "while", (void *) KW_WHILE, true);
-        dict_insert(kw, "if", (void *) KW_IF, true);
-        dict_insert(kw, "else", (void *) KW_ELSE, true);
-        dict_insert(kw, "return", (void *) KW_RETURN, true);
+#define KW(word, keyword) (memcmp(s, word, len) ? 0 : (keyword))
+    switch (len) {
+    case 2:
+        if (s[0] == 'd')
+            return KW("do", KW_DO);
+        if (s[0] == 'i')
+            return KW("if", KW_IF);
+        break;
+    case 3:
+        if (s[0] == 'f')
+            return KW("for", KW_FOR);
+        if (s[0] == 'i')
+            return KW("int", KW_INT);
+        break;
+    case 4:
+        if (s[0] == 'v')
+            return KW("void", KW_VOID);
+        if (s[0] == 'c')
+            return KW("char", KW_CHAR);
+        if (s[0] == 'e')
+            return KW("else", KW_ELSE);
+        break;
+    case 5:
+        if (s[0] == 'f')
+            return KW("float", KW_FLOAT);
+        if (s[0] == 'w')
+            return KW("while", KW_WHILE);
+        break;
+    case 6:
+        if (s[0] == 'd')
+            return KW("double", KW_DOUBLE);
+        if (s[0] == 'r')
+            return KW("return", KW_RETURN);
+        break;
+    default:
+        break;
     }
-    /* triky */
-    ret = (long) dict_lookup(kw, s);
-    return ret ? ret : 0;
+    return 0;
+#undef KW
 }
 
 
 /* token constructors */
 #define NEW_TOKEN(token, tp) \
     do { \
-        (token) = malloc(sizeof(*(token))); \
-        (token)->type = (tp); \
+        (token).type = (tp); \
     } while (0)
 
-static token_t *make_number(char *s)
+static token_t make_number(const char *s, size_t len)
 {
-    token_t *token;
+    token_t token;
 
     NEW_TOKEN(token, TK_NUMBER);
-    token->sval = s;
+    token.sval = s;
+    token.len = len;
+    token.copied = false;
     return token;
 }
 
-static token_t *make_char(int c)
+static token_t make_char(int c)
 {
-    token_t *token;
+    token_t token;
 
     NEW_TOKEN(token, TK_CHAR);
-    token->ival = c;
+    token.ival = c;
     return token;
 }
 
-static token_t *make_string(char *s)
+static token_t make_string(const char *s, size_t len, bool copied)
 {
-    token_t *token;
+    token_t token;
 
     NEW_TOKEN(token, TK_STRING);
-    token->sval = s;
+    token.sval = s;
+    token.len = len;
+    token.copied = copied;
     return token;
 }
 
-static token_t *make_keyword(int type)
+static token_t make_keyword(int type)
 {
-    token_t *token;
+    token_t token;
 
     NEW_TOKEN(token, TK_KEYWORD);
-    token->ival = type;
+    token.ival = type;
     return token;
 }
 
-static token_t *make_id(char *s)
+static token_t make_id(const char *s, size_t len)
 {
-    token_t *token;
+    token_t token;
 
     NEW_TOKEN(token, TK_ID);
-    token->sval = s;
+    token.sval = s;
+    token.len = len;
+    token.copied = false;
     return token;
 }
 
-static token_t *make_punct(int c)
+static token_t make_punct(int c)
 {
-    token_t *token;
+    token_t token;
 
     NEW_TOKEN(token, TK_PUNCT);
-    token->ival = c;
+    token.ival = c;
     return token;
 }
 
-static token_t *make_punct_2(lexer_t *lexer, int punct_type, int expect1, int punct_type1)
-{
-    if (expect_c(expect1, lexer))
-        return make_punct(punct_type1);
-    else
-        return make_punct(punct_type);
-}
-
-static token_t *make_punct_3(lexer_t *lexer, int punct_type, int expect1, int punct_type1, int expect2, int punct_type2)
-{
-    int c = get_c(lexer);
-
-    if (c == expect1)
-        return make_punct(punct_type1);
-    else if (c == expect2)
-        return make_punct(punct_type2);
-    else {
-        unget_c(c, lexer);
-        return make_punct(punct_type);
-    }
-}
-
 /* lex functions*/
 static void lex_whitespace(lexer_t *lexer)
 {
-    int c;
-
-    while (isspace(c = get_c(lexer)))
-        ;
-    unget_c(c, lexer);
+    lexer->p = scan_space(lexer->p, lexer->end);
 }
 
 static int lex_escape(int c)
@@ -203,7 +277,7 @@ static int lex_escape(int c)
     }
 }
 
-static token_t *lex_char(lexer_t *lexer)
+static token_t lex_char(lexer_t *lexer)
 {
     int c = get_c(lexer);
 
@@ -211,241 +285,350 @@ static token_t *lex_char(lexer_t *lexer)
         int temp = get_c(lexer);
         c = lex_escape(temp);
         if (c == -1)
-            errorf("unknown escape sequence: \'\\%c\' in %s:%d:%d\n", temp, lexer->fname, lexer->line, lexer->column);
+            errorf("unknown escape sequence: \'\\%c\' in %s:%d:%d\n", temp, lexer->fname, lexer_line(lexer), lexer_column(lexer));
     }
     if (get_c(lexer) != '\'')
-        errorf("missing terminating \' character in %s:%d:%d\n", lexer->fname, lexer->line, lexer->column);
+        errorf("missing terminating \' character in %s:%d:%d\n", lexer->fname, lexer_line(lexer), lexer_column(lexer));
     return make_char(c);
 }
 
-static token_t *lex_string(lexer_t *lexer)
+/* Run the punctuator DFA forward from the current position, no pushback */
+static token_t lex_punct(lexer_t *lexer)
+{
+    const char *p = lexer->p;
+    int state = ST_START, next;
+
+    while (p < lexer->end && (unsigned char) *p < 128
+            && (next = punct_next[state][(unsigned char) *p])) {
+        state = next;
+        p++;
+    }
+    assert(state != ST_START);
+    lexer->p = p;
+    return make_punct(state == ST_SINGLE ? p[-1] : punct_accept[state]);
+}
+
+/* A string literal without escape sequences is returned as a slice of the
+ * source, otherwise the decoded literal is copied to the arena.
+ */
+static token_t lex_string(lexer_t *lexer)
 {
     int c;
     char *s;
-    buffer_t *string = make_buffer();
+    buffer_t *string = lexer->string;
+    const char *start;
 
-    for (c = get_c(lexer);; c = get_c(lexer))
-        switch(c) {
-        case '\"':
+    string->top = 0;
+    for (;;) {
+        start = lexer->p;
+        lexer->p = scan_string(lexer->p, lexer->end);
+        c = get_c(lexer);
+        if (c == EOF)
+            errorf("missing terminating \" character in %s:%d:%d\n", lexer->fname, lexer_line(lexer), lexer_column(lexer));
+        /* nothing decoded yet, no escapes */
+        if (c == '\"' && !string->top)
+            return make_string(start, lexer->p - 1 - start, false);
+
+        if (lexer->p - 1 > start)
+            buffer_push(string, start, lexer->p - 1 - start);
+        if (c == '\"') {
+            size_t len = string->top;
             SET_STRING(string, s);
-            free_buffer(string);
-            return make_string(s);
-
-        case '\\': {
-            int temp = get_c(lexer);
-            c = lex_escape(temp);
-            if (c == -1)
-                errorf("unknown escape sequence \'\\%c\' in %s:%d:%d\n", temp, lexer->fname, lexer->line, lexer->column);
-            PUTC(string, c);
-            break;
+            return make_string(s, len, true);
         }
 
-        default:
-            if (c == EOF)
-                errorf("missing terminating \" character in %s:%d:%d\n", lexer->fname, lexer->line, lexer->column);
-            PUTC(string, c);
-            break;
-        }
+        /* c == '\\' */
+        int temp = get_c(lexer);
+        c = lex_escape(temp);
+        if (c == -1)
+            errorf("unknown escape sequence \'\\%c\' in %s:%d:%d\n", temp, lexer->fname, lexer_line(lexer), lexer_column(lexer));
+        PUTC(string, c);
+    }
 }
 
-static token_t *lex_id(lexer_t *lexer, int c)
+static token_t lex_id(lexer_t *lexer, int c)
 {
-    buffer_t *id = make_buffer();
-    char *s;
+    const char *start = lexer->p - 1;
+    size_t len;
 
     assert(isalpha(c) || c == '_');
-    PUTC(id, c);
-    for (c = get_c(lexer); isalnum(c) || c == '_'; c = get_c(lexer))
-        PUTC(id, c);
-    unget_c(c, lexer);
-
-    SET_STRING(id, s);
-    free_buffer(id);
-    c = is_keyword(s);
-    if (c) {
-        free(s);
+    lexer->p = scan_ident(lexer->p, lexer->end);
+
+    len = lexer->p - start;
+    c = is_keyword(start, len);
+    if (c)
         return make_keyword(c);
-    } else
-        return make_id(s);
+    else
+        return make_id(intern(&lexer->interns, start, len), len);
 }
 
 /* Read a number literal.
  * It only supports int, float and double. Different base numbers are not supported.
  */
-static token_t *lex_number(lexer_t *lexer, char c)
+static token_t lex_number(lexer_t *lexer, char c)
 {
-    buffer_t *num = make_buffer();
-    char *s;
+    const char *start = lexer->p - 1;
 
     assert(isdigit(c));
-    PUTC(num, c);
-    for (c = get_c(lexer); isdigit(c); c = get_c(lexer))
-        PUTC(num, c);
+    lexer->p = scan_digit(lexer->p, lexer->end);
+    c = get_c(lexer);
     if (c == 'f')
-        errorf("invalid suffix \"f\" on integer constant int %s:%d:%d\n", lexer->fname, lexer->line, lexer->column);
+        errorf("invalid suffix \"f\" on integer constant int %s:%d:%d\n", lexer->fname, lexer_line(lexer), lexer_column(lexer));
     if (c == '.') {
-        PUTC(num, c);
         c = get_c(lexer);
         if (!isdigit(c))
-            errorf("expected digit after '.' in %s:%d:%d\n", lexer->fname, lexer->line, lexer->column);
-        for (; isdigit(c); c = get_c(lexer))
-            PUTC(num, c);
+            errorf("expected digit after '.' in %s:%d:%d\n", lexer->fname, lexer_line(lexer), lexer_column(lexer));
+        lexer->p = scan_digit(lexer->p, lexer->end);
+        c = get_c(lexer);
     }
     if (c == 'e' || c == 'E') {
-        PUTC(num, c);
         c = get_c(lexer);
-        if (c == '-' || c == '+') {
-            PUTC(num, c);
+        if (c == '-' || c == '+')
             c = get_c(lexer);
-        }
         if (!isdigit(c))
-            errorf("expected digit after 'e' or 'E' in %s:%d:%d\n", lexer->fname, lexer->line, lexer->column);
-        for (; isdigit(c); c = get_c(lexer))
-            PUTC(num, c);
+            errorf("expected digit after 'e' or 'E' in %s:%d:%d\n", lexer->fname, lexer_line(lexer), lexer_column(lexer));
+        lexer->p = scan_digit(lexer->p, lexer->end);
+        c = get_c(lexer);
     }
-    if (c == 'f' || c == 'F')
-        PUTC(num, c);
-    else
+    if (c != 'f' && c != 'F')
         unget_c(c, lexer);
 
-    SET_STRING(num, s);
-    free_buffer(num);
-    return make_number(s);
+    return make_number(start, lexer->p - start);
 }
 
-/* lexer interface */
-void lexer_init(lexer_t *lexer, const char *fname, FILE *fp)
+/* Map a regular file into memory, or read anything else (pipes, ttys)
+ * into one contiguous malloc'd buffer.  Either is the source the tokens
+ * point into, close_source gives it back.
+ */
+static void read_source(lexer_t *lexer, FILE *fp)
 {
-    assert(lexer && fname);
-    lexer->fp = fp ? fp : fopen(fname, "r");
-    if (!lexer->fp)
+    struct stat st;
+    buffer_t *buf;
+    char chunk[4096];
+    size_t n;
+
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (src != MAP_FAILED) {
+            lexer->src = src;
+            lexer->size = st.st_size;
+            lexer->mapped = true;
+            return;
+        }
+    }
+
+    buf = make_buffer();
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        buffer_push(buf, chunk, n);
+    if (ferror(fp)) {
+        free_buffer(buf);
+        errorf("Can't read file %s\n", lexer->fname);
+    }
+    lexer->src = buf->stack;
+    lexer->size = buf->top;
+    lexer->mapped = false;
+    free(buf);
+}
+
+static void open_source(lexer_t *lexer, const char *fname, FILE *fp)
+{
+    FILE *in;
+
+    in = fp ? fp : fopen(fname, "r");
+    if (!in)
         errorf("Can't open file %s\n", fname);
     lexer->fname = fname;
-    lexer->line = 1;
-    lexer->column = lexer->prev_column = 0;
-    lexer->untoken = NULL;
+    read_source(lexer, in);
+    if (!fp)
+        fclose(in);
+    lexer->p = lexer->src;
+    lexer->end = lexer->src + lexer->size;
 }
 
-token_t *get_token(lexer_t *lexer)
+static void close_source(lexer_t *lexer)
 {
-    int c;
+    if (lexer->mapped)
+        munmap(lexer->src, lexer->size);
+    else
+        free(lexer->src);
+    lexer->src = NULL;
+    lexer->p = lexer->end = NULL;
+    lexer->size = 0;
+}
+
+/* lexer interface */
+void lexer_init(lexer_t *lexer, const char *fname, FILE *fp)
+{
+    assert(lexer && fname);
+    lexer->src = NULL;
+    open_source(lexer, fname, fp);
+    lexer->arena = make_arena();
+    lexer->string = make_buffer();
+    intern_init(&lexer->interns);
+    lexer->stats = NULL;
+    lexer->blocks = NULL;
+    lexer->nblocks = 0;
+    lexer->ntokens = lexer->pos = 0;
+}
 
+void lexer_close(lexer_t *lexer)
+{
     assert(lexer);
-    if (lexer->untoken) {
-        token_t *temp = lexer->untoken;
-        lexer->untoken = NULL;
-        return temp;
-    }
+    free(lexer->blocks);
+    free_arena(lexer->arena);
+    free_buffer(lexer->string);
+    intern_close(&lexer->interns);
+    lexer->arena = NULL;
+    lexer->string = NULL;
+    lexer->blocks = NULL;
+    lexer->nblocks = lexer->ntokens = lexer->pos = 0;
+    close_source(lexer);
+}
 
-    lex_whitespace(lexer);
-    c = get_c(lexer);
-    switch (c) {
-    case '[': case ']': case '(': case ')': case '{': case '}': case '.':
-    case '~': case ':': case ',': case ';': case '?':
-        return make_punct(c);
+void lexer_reset(lexer_t *lexer, const char *fname, FILE *fp)
+{
+    assert(lexer && fname);
+    if (lexer->src)
+        close_source(lexer);
+    /* the token blocks were in the arena */
+    arena_reset(lexer->arena);
+    lexer->nblocks = lexer->ntokens = lexer->pos = 0;
+    lexer->stats = NULL;
+    open_source(lexer, fname, fp);
+}
 
-    case '+':
-        return make_punct_3(lexer, '+', '+', PUNCT_INC, '=', PUNCT_IADD);
+/* Line and column are only needed by diagnostics, so they are derived from
+ * the current position on demand instead of being tracked per character.
+ */
+unsigned int lexer_line(lexer_t *lexer)
+{
+    const char *s;
+    unsigned int line = 1;
 
-    case '&':
-        return make_punct_3(lexer, '&', '&', PUNCT_AND, '=', PUNCT_IAND);
+    assert(lexer);
+    for (s = lexer->src; (s = memchr(s, '\n', lexer->p - s)); s++)
+        line++;
+    return line;
+}
 
-    case '|':
-        return make_punct_3(lexer, '|', '|', PUNCT_OR, '=', PUNCT_IOR);
+unsigned int lexer_column(lexer_t *lexer)
+{
+    const char *s;
 
-    case '-':
-        c = get_c(lexer);
-        if (c == '-')
-            return make_punct(PUNCT_DEC);
-        else if (c == '=')
-            return make_punct(PUNCT_ISUB);
-        else if (c == '>')
-            return make_punct(PUNCT_ARROW);
-        else {
-            unget_c(c, lexer);
-            return make_punct('-');
-        }
+    assert(lexer);
+    for (s = lexer->p; s > lexer->src && s[-1] != '\n'; s--)
+        ;
+    return lexer->p - s;
+}
 
-    case '*':
-        return make_punct_2(lexer, '*', '=', PUNCT_IMUL);
+static token_t lex_token(lexer_t *lexer)
+{
+    token_t token;
+    int c;
 
-    case '/':
-        return make_punct_2(lexer, '/', '=', PUNCT_IDIV);
+    for (;;) {
+        if (lexer->p >= lexer->end) {
+            NEW_TOKEN(token, TK_EOF);
+            return token;
+        }
+        switch (char_class[(unsigned char) *lexer->p]) {
+        case CC_SPACE:
+            lex_whitespace(lexer);
+            break;
 
-    case '%':
-        return make_punct_2(lexer, '%', '=', PUNCT_IMOD);
+        case CC_PUNCT:
+            return lex_punct(lexer);
 
-    case '=':
-        return make_punct_2(lexer, '=', '=', PUNCT_EQ);
+        case CC_DIGIT:
+            return lex_number(lexer, get_c(lexer));
 
-    case '!':
-        return make_punct_2(lexer, '!', '=', PUNCT_NE);
+        case CC_IDENT:
+            return lex_id(lexer, get_c(lexer));
 
-    case '^':
-        return make_punct_2(lexer, '^', '=', PUNCT_IXOR);
+        case CC_QUOTE:
+            get_c(lexer);
+            return lex_char(lexer);
 
-    case '<':
-        c = get_c(lexer);
-        if (c == '=')
-            return make_punct(PUNCT_LE);
-        else if (c == '<')
-            return make_punct_2(lexer, PUNCT_LSFT, '=', PUNCT_ILSFT);
-        else {
-            unget_c(c, lexer);
-            return make_punct('<');
-        }
+        case CC_DQUOTE:
+            get_c(lexer);
+            return lex_string(lexer);
 
-    case '>':
-        c = get_c(lexer);
-        if (c == '=')
-            return make_punct(PUNCT_GE);
-        else if (c == '>')
-            return make_punct_2(lexer, PUNCT_RSFT, '=', PUNCT_IRSFT);
-        else {
-            unget_c(c, lexer);
-            return make_punct('>');
+        default:
+            c = get_c(lexer);
+            errorf("Unknown char %c in %s:%d:%d\n", c, lexer->fname, lexer_line(lexer), lexer_column(lexer));
+            break;
         }
+    }
+}
 
-    case '\'':
-        return lex_char(lexer);
-
-    case '\"':
-        return lex_string(lexer);
+/* Tokens are kept by value in fixed-size blocks which never move, so a
+ * token pointer stays valid until release_tokens. Tokens between pos and
+ * ntokens are lexed ahead for peek_nth_token.
+ */
+#define TOKEN(lexer, i) (&(lexer)->blocks[(i) / TOKEN_BLOCK_SIZE][(i) % TOKEN_BLOCK_SIZE])
 
-    default:
-        if (isdigit(c))
-            return lex_number(lexer, c);
-        else if (isalpha(c) || c == '_')
-            return lex_id(lexer, c);
-        else if (c == EOF) {
-            free_dict(kw, NULL, NULL);
-            return NULL;
-        } else {
-            errorf("Unknown char %c in %s:%d:%d\n", c, lexer->fname, lexer->line, lexer->column);
-            return NULL;
+static token_t *nth_token(lexer_t *lexer, size_t n)
+{
+    int phase;
+
+    if (lexer->pos + n < lexer->ntokens)
+        return TOKEN(lexer, lexer->pos + n);
+    phase = STATS_SWITCH(lexer->stats, PHASE_LEX);
+    while (lexer->pos + n >= lexer->ntokens) {
+        if (lexer->ntokens == lexer->nblocks * TOKEN_BLOCK_SIZE) {
+            lexer->blocks = realloc(lexer->blocks, sizeof(token_t *) * (lexer->nblocks + 1));
+            lexer->blocks[lexer->nblocks++] = arena_alloc(lexer->arena, sizeof(token_t) * TOKEN_BLOCK_SIZE);
         }
+        *TOKEN(lexer, lexer->ntokens) = lex_token(lexer);
+        lexer->ntokens++;
     }
+    STATS_SWITCH(lexer->stats, phase);
+    return TOKEN(lexer, lexer->pos + n);
+}
+
+token_t *get_token(lexer_t *lexer)
+{
+    token_t *token;
+
+    assert(lexer);
+    token = nth_token(lexer, 0);
+    if (token->type == TK_EOF)
+        return NULL;
+    lexer->pos++;
+    return token;
 }
 
 void unget_token(token_t *token, lexer_t *lexer)
 {
-    assert(lexer && !lexer->untoken);
-    lexer->untoken = token;
+    assert(lexer && lexer->pos > 0 && TOKEN(lexer, lexer->pos - 1) == token);
+    lexer->pos--;
 }
 
 token_t *peek_token(lexer_t *lexer)
 {
+    return peek_nth_token(lexer, 0);
+}
+
+/* n == 0 is the next token, return NULL past the end of file */
+token_t *peek_nth_token(lexer_t *lexer, size_t n)
+{
+    size_t i;
+
     assert(lexer);
-    if (!lexer->untoken)
-        lexer->untoken = get_token(lexer);
-    return lexer->untoken;
+    for (i = 0; i <= n; i++)
+        if (nth_token(lexer, i)->type == TK_EOF)
+            return NULL;
+    return TOKEN(lexer, lexer->pos + n);
 }
 
-void free_token(token_t *token, bool free_sval)
+/* Drop every token returned by get_token so far, the blocks are reused */
+void release_tokens(lexer_t *lexer)
 {
-    assert(token);
-    if ((token->type == TK_ID || token->type == TK_NUMBER || token->type == TK_STRING)
-            && free_sval)
-        free(token->sval);
-    free(token);
+    size_t i;
+
+    assert(lexer);
+    for (i = lexer->pos; i < lexer->ntokens; i++)
+        *TOKEN(lexer, i - lexer->pos) = *TOKEN(lexer, i);
+    lexer->ntokens -= lexer->pos;
+    lexer->pos = 0;
 }
@@ -3,6 +3,10 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include "arena.h"
+#include "buffer.h"
+#include "intern.h"
+#include "stats.h"
 
 /* token type */
 enum {
@@ -11,7 +15,9 @@ enum {
     TK_NUMBER,
     TK_CHAR,
     TK_STRING,
-    TK_PUNCT
+    TK_PUNCT,
+    /* internal, get_token returns NULL at end of file */
+    TK_EOF
 };
 
 /* keywords */
@@ -61,28 +67,55 @@ enum {
 typedef struct token_t {
     int type;
     union {
-        /* string, identifier and number */
-        char *sval;
+        /* string and number: a slice of the source buffer, or of an arena
+         * copy for string literals with escape sequences
+         * identifier: the interned spelling
+         */
+        struct {
+            const char *sval;
+            size_t len;
+            bool copied;
+        };
         /* char, punctuator and keyword */
         int ival;
     };
 } token_t;
 
 typedef struct lexer_t {
-    token_t *untoken;
-    /* file */
-    FILE *fp;
+    /* translation unit storage: tokens, string literals and the AST */
+    arena_t *arena;
+    /* identifier spellings, owned by the lexer so files share nothing */
+    interns_t interns;
+    /* phase accounting, NULL unless a report was asked for */
+    stats_t *stats;
+    /* token pool, see get_token */
+    token_t **blocks;
+    size_t nblocks;
+    size_t ntokens;
+    size_t pos;
+    /* a string literal with escapes is decoded here before the arena */
+    buffer_t *string;
+    /* source file, mapped or read into memory as a whole */
     const char *fname;
-    unsigned int line;
-    unsigned int column;
-    unsigned int prev_column;
+    char *src;
+    size_t size;
+    bool mapped;
+    /* current position */
+    const char *p;
+    const char *end;
 } lexer_t;
 
 void lexer_init(lexer_t *lexer, const char *fname, FILE *fp);
+/* read another file, keeping the identifiers and the memory of the last */
+void lexer_reset(lexer_t *lexer, const char *fname, FILE *fp);
+void lexer_close(lexer_t *lexer);
+unsigned int lexer_line(lexer_t *lexer);
+unsigned int lexer_column(lexer_t *lexer);
 token_t *get_token(lexer_t *lexer);
 void unget_token(token_t *token, lexer_t *lexer);
 token_t *peek_token(lexer_t *lexer);
-void free_token(token_t *token, bool free_sval);
+token_t *peek_nth_token(lexer_t *lexer, size_t n);
+void release_tokens(lexer_t *lexer);
 
 #endif
 
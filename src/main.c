@@ -1,14 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <libgen.h>
-#include "vector.h"
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include "lexer.h"
 #include "parser.h"
 #include "gen.h"
+#include "elfobj.h"
+#include "jit.h"
+#include "vm.h"
+#include "pool.h"
 #include "util.h"
 
-FILE *fopen_out(const char *fname)
+/* foo.c -> foo.s or foo.o in the current directory */
+FILE *fopen_out(const char *fname, char suffix)
 {
     char *in;
     char *out;
@@ -20,7 +32,7 @@ FILE *fopen_out(const char *fname)
     in = strdup(fname);
     out = basename(in);
     len = strlen(out);
-    out[len - 1] = 's';
+    out[len - 1] = suffix;
     fp = fopen(out, "w");
     free(in);
     if (!fp)
@@ -28,41 +40,565 @@ FILE *fopen_out(const char *fname)
     return fp;
 }
 
-void compile(const char *fname, FILE *in)
-{
-    size_t i;
+static bool mem_report;
+static bool time_report;
+/* -c: write an object file instead of assembly */
+static bool object;
+/* --run: run the program in memory instead */
+static bool run;
+/* --vm: run it on the bytecode interpreter */
+static bool interpret;
+static int run_status;
+/* -j: threads, the files and the definitions of each are spread on them */
+static int jobs = 1;
+static pool_t *pool;
+/* --server: compile the requests of clients, --client: send them there */
+static bool server;
+static bool client;
+
+/* Everything a compile needs but the output format.  A thread of the
+ * server keeps one for all its requests, so the identifiers, the types and
+ * the memory of the last request are there for the next.
+ */
+typedef struct context_t {
     lexer_t lexer;
     parser_t parser;
-    vector_t *ast;
+    gen_t gen;
+    code_t code;
+    out_t *out;
+} context_t;
+
+static void context_init(context_t *ctx, const char *fname, FILE *in, int fd)
+{
+    lexer_init(&ctx->lexer, fname, in);
+    parser_init(&ctx->parser, &ctx->lexer);
+    gen_init(&ctx->gen);
+    code_init(&ctx->code);
+    ctx->out = make_out(fd);
+}
+
+static void context_reset(context_t *ctx, const char *fname, FILE *in)
+{
+    lexer_reset(&ctx->lexer, fname, in);
+    parser_reset(&ctx->parser);
+    gen_reset(&ctx->gen);
+    code_reset(&ctx->code);
+    ctx->out->len = 0;
+}
+
+static void context_close(context_t *ctx)
+{
+    code_close(&ctx->code);
+    gen_close(&ctx->gen);
+    free_out(ctx->out);
+    parser_close(&ctx->parser);
+    lexer_close(&ctx->lexer);
+}
+
+/* into elf for an object file or a run, else as assembly */
+static void write_code(code_t *code, out_t *out, elf_t *elf)
+{
+    if (elf)
+        elf_add(elf, code);
+    else
+        code_print(out, code);
+    /* many small definitions share one write */
+    if (out->len >= OUT_FLUSH_SIZE)
+        out_flush(out);
+}
+
+/* definitions parsed before they are emitted on the pool together */
+#define EMIT_BATCH 256
+
+/* a batch of definitions of a file */
+typedef struct unit_t {
+    ast_t *ast;
+    node_t *defs[EMIT_BATCH];
+    gen_t gens[EMIT_BATCH];
+    code_t codes[EMIT_BATCH];
+    /* seconds of each, only for -ftime-report */
+    double times[EMIT_BATCH];
+    bool timed;
+} unit_t;
+
+static void emit_def(void *arg, size_t i)
+{
+    unit_t *unit = arg;
+    double start = unit->timed ? stats_clock() : 0;
+
+    gen_reset(&unit->gens[i]);
+    code_reset(&unit->codes[i]);
+    emit(&unit->gens[i], &unit->codes[i], unit->ast, unit->defs[i]);
+    if (unit->timed)
+        unit->times[i] = stats_clock() - start;
+}
+
+/* Emit each definition on its own on the pool, a batch at a time, and
+ * merge them into gen in source order, which gives the serial output.
+ */
+static void emit_parallel(parser_t *parser, gen_t *gen, stats_t *sp, out_t *out, elf_t *elf)
+{
+    unit_t *unit = malloc(sizeof(unit_t));
+    size_t i, n;
+
+    unit->ast = &parser->ast;
+    unit->timed = sp != NULL;
+    for (i = 0; i < EMIT_BATCH; i++) {
+        gen_init(&unit->gens[i]);
+        unit->gens[i].local = true;
+        code_init(&unit->codes[i]);
+    }
+    /* the nodes of a definition are not reused until its batch is written */
+    parser->keep = true;
+    do {
+        STATS_SWITCH(sp, PHASE_PARSE);
+        for (n = 0; n < EMIT_BATCH && (unit->defs[n] = get_node(parser)); n++)
+            ;
+        STATS_SWITCH(sp, PHASE_CODEGEN);
+        pool_for(pool, n, emit_def, unit);
+        for (i = 0; i < n; i++) {
+            STATS_SWITCH(sp, PHASE_CODEGEN);
+            gen_merge(gen, &unit->gens[i], &unit->codes[i]);
+            if (sp)
+                stats_add_func(sp, unit->defs[i]->func_name, unit->times[i]);
+            STATS_SWITCH(sp, PHASE_OUTPUT);
+            write_code(&unit->codes[i], out, elf);
+        }
+        release_defs(parser, unit->defs, n);
+    } while (n == EMIT_BATCH);
+    parser->keep = false;
+    for (i = 0; i < EMIT_BATCH; i++) {
+        gen_close(&unit->gens[i]);
+        code_close(&unit->codes[i]);
+    }
+    free(unit);
+}
+
+/* Parse and emit the file of ctx, onto vm when there is one */
+static void translate(context_t *ctx, stats_t *sp, elf_t *elf, vm_t *vm)
+{
     node_t *node;
-    FILE *out;
 
-    ast = make_vector();
-    out = (in == stdin) ? stdout : fopen_out(fname);
+    /* without a pool each definition is emitted as soon as it is parsed */
+    if (pool && !vm) {
+        emit_parallel(&ctx->parser, &ctx->gen, sp, ctx->out, elf);
+        return;
+    }
+    for (;;) {
+        STATS_SWITCH(sp, PHASE_PARSE);
+        if (!(node = get_node(&ctx->parser)))
+            break;
+        STATS_SWITCH(sp, PHASE_CODEGEN);
+        if (vm)
+            vm_add(vm, &ctx->parser.ast, node);
+        else
+            emit(&ctx->gen, &ctx->code, &ctx->parser.ast, node);
+        if (sp)
+            stats_func(sp, node->func_name);
+        STATS_SWITCH(sp, PHASE_OUTPUT);
+        if (!vm)
+            write_code(&ctx->code, ctx->out, elf);
+        code_reset(&ctx->code);
+    }
+}
+
+/* Compile one file, reports go to err.  Everything but the options lives
+ * in this call, so files can be compiled on several threads at once.
+ */
+void compile(const char *fname, FILE *in, FILE *err)
+{
+    context_t ctx;
+    FILE *fp;
+    elf_t elf;
+    vm_t vm;
+    stats_t stats, *sp = NULL;
+
+    fp = (in == stdin || run || interpret) ? stdout : fopen_out(fname, object ? 'o' : 's');
+    if (object || run)
+        elf_init(&elf);
+    if (interpret)
+        vm_init(&vm);
+
+    context_init(&ctx, fname, in, fileno(fp));
+    if (mem_report || time_report) {
+        sp = &stats;
+        stats_init(sp, ctx.lexer.arena);
+        ctx.lexer.stats = sp;
+    }
+    translate(&ctx, sp, (object || run) ? &elf : NULL, interpret ? &vm : NULL);
+    STATS_SWITCH(sp, PHASE_OUTPUT);
+    if (object)
+        elf_write(&elf, ctx.out);
+    out_flush(ctx.out);
+    STATS_SWITCH(sp, PHASE_NONE);
+    if (run)
+        run_status = jit_run(&elf);
+    if (object || run)
+        elf_close(&elf);
+    if (interpret) {
+        run_status = vm_run(&vm);
+        vm_close(&vm);
+    }
+
+    if (time_report)
+        stats_time_report(err, fname, sp);
+    if (mem_report) {
+        stats_mem_report(err, fname, sp);
+        arena_report(err, fname, ctx.lexer.arena);
+    }
+    if (sp)
+        stats_close(sp);
+    context_close(&ctx);
+
+    if (in != stdin)
+        fclose(in);
+    if (fp != stdout)
+        fclose(fp);
+}
+
+typedef struct job_t {
+    const char *fname;
+    /* the reports of the file, printed in the order of the files */
+    char *report;
+    size_t report_len;
+} job_t;
+
+static job_t *job_list;
+static int njobs;
+
+static void compile_job(void *arg, size_t i)
+{
+    job_t *job = &job_list[i];
+    FILE *err = open_memstream(&job->report, &job->report_len);
+
+    (void) arg;
+    compile(job->fname, fopen(job->fname, "r"), err);
+    fclose(err);
+}
+
+static void compile_files(void)
+{
+    int i;
+
+    pool_for(pool, njobs, compile_job, NULL);
+    for (i = 0; i < njobs; i++) {
+        fwrite(job_list[i].report, 1, job_list[i].report_len, stderr);
+        free(job_list[i].report);
+    }
+}
+
+static int parse_jobs(const char *s)
+{
+    char *end;
+    long n = strtol(s, &end, 10);
+
+    if (!*s || *end || n < 1 || n > 1024)
+        errorf("invalid number of jobs %s\n", s);
+    return n;
+}
+
+/* The protocol of --server and --client, one request a connection:
+ *
+ *      path asm|obj <name>\n<absolute path>\n
+ *      source asm|obj <name>\n<the source up to the end of the stream>
+ *
+ * name is the file as it was given to the client, diagnostics use it.
+ *
+ * answered by "ok <length>\n" and the assembly or the object file, or by
+ * "error <length>\n" and the diagnostics.
+ */
+
+/* $SCC_SOCKET, else a socket per user in /tmp */
+static void socket_addr(struct sockaddr_un *addr)
+{
+    const char *path = getenv("SCC_SOCKET");
+    char buf[64];
+
+    if (!path) {
+        snprintf(buf, sizeof(buf), "/tmp/scc-%d.sock", (int) getuid());
+        path = buf;
+    }
+    if (strlen(path) >= sizeof(addr->sun_path))
+        errorf("socket path is too long: %s\n", path);
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+}
+
+/* -1 if nobody listens */
+static int connect_server(struct sockaddr_un *addr)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0)
+        errorf("Can't create socket\n");
+    if (connect(fd, (struct sockaddr *) addr, sizeof(*addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const char *p, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, p, len)) < 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* a thread of the server */
+typedef struct server_t {
+    int sock;
+    /* made by the first request, reset by the others */
+    context_t ctx;
+    bool warm;
+} server_t;
+
+static void reply(int fd, const char *status, const char *data, size_t len)
+{
+    char head[64];
+    int n = snprintf(head, sizeof(head), "%s %zu\n", status, len);
+
+    /* a client that went away gets nothing */
+    if (send_all(fd, head, n))
+        send_all(fd, data, len);
+}
 
-    lexer_init(&lexer, fname, in);
-    parser_init(&parser, &lexer);
-    while ((node = get_node(&parser)))
-        vector_append(ast, node);
-    for (i = 0; i < vector_len(ast); i++)
-        emit(out, vector_get(ast, i));
+/* errorf comes back here with the diagnostics instead of exiting */
+static void serve_request(server_t *srv, int fd)
+{
+    FILE *conn = fdopen(fd, "r");
+    FILE *volatile in = NULL;
+    volatile bool obj = false;
+    volatile bool failed = false;
+    char *line = NULL, *path = NULL, *format, *name;
+    char *diag;
+    size_t size = 0, path_size = 0, diag_len;
+    ssize_t len;
+    volatile ssize_t path_len = 0;
+    elf_t elf;
+    jmp_buf jmp;
 
-    if (in != stdin) {
+    len = getline(&line, &size, conn);
+    if (len > 0 && strncmp(line, "source ", 7))
+        path_len = getline(&path, &path_size, conn);
+    error_out = open_memstream(&diag, &diag_len);
+    error_jmp = &jmp;
+    if (setjmp(jmp) == 0) {
+        if (len < 1 || line[len - 1] != '\n'
+                || !(format = strchr(line, ' ')) || !(name = strchr(format + 1, ' ')))
+            errorf("bad request\n");
+        line[len - 1] = *format++ = *name++ = '\0';
+        if (strcmp(format, "asm") && strcmp(format, "obj"))
+            errorf("bad request\n");
+        if (!strcmp(line, "source"))
+            in = conn;
+        else if (strcmp(line, "path") || path_len < 1 || path[path_len - 1] != '\n')
+            errorf("bad request\n");
+        else {
+            path[path_len - 1] = '\0';
+            if (!(in = fopen(path, "r")))
+                errorf("Can't open file %s\n", name);
+        }
+        if ((obj = !strcmp(format, "obj")))
+            elf_init(&elf);
+        if (srv->warm)
+            context_reset(&srv->ctx, name, in);
+        else {
+            context_init(&srv->ctx, name, in, -1);
+            srv->warm = true;
+        }
+        translate(&srv->ctx, NULL, obj ? &elf : NULL, NULL);
+        if (obj)
+            elf_write(&elf, srv->ctx.out);
+    } else
+        failed = true;
+    error_jmp = NULL;
+    fclose(error_out);
+    error_out = NULL;
+    if (obj)
+        elf_close(&elf);
+    if (in && in != conn)
         fclose(in);
-        fclose(out);
+
+    if (failed)
+        reply(fd, "error", diag, diag_len);
+    else {
+        reply(fd, "ok", srv->ctx.out->buf, srv->ctx.out->len);
+        srv->ctx.out->len = 0;
+    }
+    free(diag);
+    free(line);
+    free(path);
+    fclose(conn);
+}
+
+static void *serve_thread(void *arg)
+{
+    server_t *srv = arg;
+    int fd;
+
+    for (;;)
+        if ((fd = accept(srv->sock, NULL, NULL)) >= 0)
+            serve_request(srv, fd);
+    return NULL;
+}
+
+/* --server: -j threads take the requests, each keeps its own context */
+static void serve(int nthreads)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    server_t *srvs = calloc(nthreads, sizeof(server_t));
+    pthread_t thread;
+    mode_t mask;
+    int sock, fd, i, ret;
+
+    socket_addr(&addr);
+    if ((fd = connect_server(&addr)) >= 0)
+        errorf("a server is already listening on %s\n", addr.sun_path);
+    /* nobody answers, a socket there was left by a server that is gone */
+    if (lstat(addr.sun_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode))
+            errorf("%s exists and is not a socket\n", addr.sun_path);
+        unlink(addr.sun_path);
+    }
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    /* only the owner may connect and have files read for it */
+    mask = umask(077);
+    ret = sock < 0 ? -1 : bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+    umask(mask);
+    if (ret < 0 || listen(sock, SOMAXCONN) < 0)
+        errorf("Can't listen on %s\n", addr.sun_path);
+    signal(SIGPIPE, SIG_IGN);
+    for (i = 0; i < nthreads; i++) {
+        srvs[i].sock = sock;
+        if (i > 0 && pthread_create(&thread, NULL, serve_thread, &srvs[i]))
+            errorf("Can't create thread\n");
     }
-    free_vector(ast, NULL);
+    serve_thread(&srvs[0]);
+}
+
+/* Compile on the server for --client, false when there is none.  Its
+ * diagnostics end the client as they would end a local compile.
+ */
+static bool remote_compile(const char *fname, FILE *in)
+{
+    struct sockaddr_un addr;
+    char path[PATH_MAX], buf[4096];
+    const char *format = object ? "obj" : "asm";
+    char *line = NULL, *data;
+    size_t size = 0, len, n;
+    FILE *conn, *fp;
+    bool ok;
+    int fd;
+
+    /* the local compile says why it can't be read */
+    if (!in || (in != stdin && !realpath(fname, path)))
+        return false;
+    socket_addr(&addr);
+    if ((fd = connect_server(&addr)) < 0)
+        return false;
+    if (in == stdin) {
+        ok = dprintf(fd, "source %s stdin\n", format) > 0;
+        while (ok && (n = fread(buf, 1, sizeof(buf), stdin)) > 0)
+            ok = send_all(fd, buf, n);
+    } else
+        ok = dprintf(fd, "path %s %s\n%s\n", format, fname, path) > 0;
+    if (!ok)
+        errorf("Can't send the request to %s\n", addr.sun_path);
+    shutdown(fd, SHUT_WR);
+
+    conn = fdopen(fd, "r");
+    if (getline(&line, &size, conn) < 1 || sscanf(line, "%*s %zu", &len) != 1)
+        errorf("bad reply from %s\n", addr.sun_path);
+    data = malloc(len + 1);
+    if (fread(data, 1, len, conn) != len)
+        errorf("bad reply from %s\n", addr.sun_path);
+    fclose(conn);
+    ok = !strncmp(line, "ok ", 3);
+    if (ok) {
+        fp = in == stdin ? stdout : fopen_out(fname, object ? 'o' : 's');
+        fwrite(data, 1, len, fp);
+        if (fp != stdout)
+            fclose(fp);
+    } else
+        fwrite(data, 1, len, stderr);
+    free(data);
+    free(line);
+    if (in != stdin)
+        fclose(in);
+    if (!ok)
+        exit(1);
+    return true;
+}
+
+static void compile_file(const char *fname, FILE *in)
+{
+    if (!client || !remote_compile(fname, in))
+        compile(fname, in, stderr);
 }
 
 int main(int argc, char *argv[])
 {
     int i;
 
-    if (argc == 1)
-        compile("stdin", stdin);
+    job_list = calloc(argc, sizeof(job_t));
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-fmem-report"))
+            mem_report = true;
+        else if (!strcmp(argv[i], "-ftime-report"))
+            time_report = true;
+        else if (!strcmp(argv[i], "-c"))
+            object = true;
+        else if (!strcmp(argv[i], "--run"))
+            run = true;
+        else if (!strcmp(argv[i], "--vm"))
+            interpret = true;
+        else if (!strcmp(argv[i], "--server"))
+            server = true;
+        else if (!strcmp(argv[i], "--client"))
+            client = true;
+        else if (!strcmp(argv[i], "-j")) {
+            if (++i == argc)
+                errorf("-j needs a number\n");
+            jobs = parse_jobs(argv[i]);
+        } else if (!strncmp(argv[i], "-j", 2))
+            jobs = parse_jobs(argv[i] + 2);
+        else if (argv[i][0] == '-')
+            errorf("unknown option %s\n", argv[i]);
+        else
+            job_list[njobs++].fname = argv[i];
+    }
+
+    if ((run || interpret) && (object || (run && interpret) || njobs > 1))
+        errorf("--run and --vm take one file and no -c\n");
+    if (server && (client || object || run || interpret || mem_report || time_report || njobs))
+        errorf("--server takes no files and no options but -j\n");
+    if (server)
+        serve(jobs);
+    /* they need the compile in this process */
+    if (run || interpret || mem_report || time_report)
+        client = false;
+    /* the interpreter compiles as it parses, it has nothing to spread */
+    if (jobs > 1 && !interpret)
+        pool = make_pool(jobs);
+    if (njobs == 0)
+        compile_file("stdin", stdin);
+    else if (pool && njobs > 1 && !client)
+        compile_files();
     else
-        for (i = 1; i < argc; i++)
-            compile(argv[i], fopen(argv[i], "r"));
+        for (i = 0; i < njobs; i++)
+            compile_file(job_list[i].fname, fopen(job_list[i].fname, "r"));
+    if (pool)
+        free_pool(pool);
+    free(job_list);
 
-    return 0;
+    return run_status;
 }
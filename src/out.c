@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include "out.h"
+#include "util.h"
+
+#define OUT_INIT_SIZE (128 * 1024)
+
+out_t *make_out(int fd)
+{
+    out_t *out = malloc(sizeof(*out));
+    out->fd = fd;
+    out->size = OUT_INIT_SIZE;
+    out->buf = malloc(out->size);
+    out->len = 0;
+    return out;
+}
+
+char *out_reserve(out_t *out, size_t n)
+{
+    if (out->len + n > out->size) {
+        while (out->len + n > out->size)
+            out->size *= 2;
+        out->buf = realloc(out->buf, out->size);
+    }
+    return out->buf + out->len;
+}
+
+void out_char(out_t *out, char c)
+{
+    if (out->len == out->size)
+        out_reserve(out, 1);
+    out->buf[out->len++] = c;
+}
+
+void out_mem(out_t *out, const char *s, size_t len)
+{
+    out_reserve(out, len);
+    memcpy(out->buf + out->len, s, len);
+    out->len += len;
+}
+
+void out_str(out_t *out, const char *s)
+{
+    out_mem(out, s, strlen(s));
+}
+
+char *put_long(char *p, long v)
+{
+    char tmp[24], *s = tmp + sizeof(tmp);
+    unsigned long u = v < 0 ? -(unsigned long) v : (unsigned long) v;
+
+    do {
+        *--s = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        *--s = '-';
+    memcpy(p, s, tmp + sizeof(tmp) - s);
+    return p + (tmp + sizeof(tmp) - s);
+}
+
+void out_long(out_t *out, long v)
+{
+    char *p = out_reserve(out, PUT_LONG_MAX);
+    out->len = put_long(p, v) - out->buf;
+}
+
+void out_format(out_t *out, const char *fmt, ...)
+{
+    va_list ap;
+    const char *s;
+
+    assert(out && fmt);
+    va_start(ap, fmt);
+    while (*fmt) {
+        for (s = fmt; *s && *s != '%'; s++)
+            ;
+        out_mem(out, fmt, s - fmt);
+        if (!*s)
+            break;
+        switch (s[1]) {
+        case 's':
+            out_str(out, va_arg(ap, const char *));
+            break;
+        case 'd':
+            out_long(out, va_arg(ap, int));
+            break;
+        case 'c':
+            out_char(out, (char) va_arg(ap, int));
+            break;
+        case '%':
+            out_char(out, '%');
+            break;
+        case 'l':
+            if (s[2] == 'd') {
+                out_long(out, va_arg(ap, long));
+                s++;
+                break;
+            }
+            /* fall through */
+        default:
+            errorf("unsupported conversion in %s\n", fmt);
+        }
+        fmt = s + 2;
+    }
+    va_end(ap);
+}
+
+void out_flush(out_t *out)
+{
+    const char *p = out->buf;
+    ssize_t n;
+
+    assert(out);
+    if (out->fd < 0)
+        return;
+    while (p < out->buf + out->len) {
+        n = write(out->fd, p, out->buf + out->len - p);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            errorf("write failed: %s\n", strerror(errno));
+        }
+        p += n;
+    }
+    out->len = 0;
+}
+
+void free_out(out_t *out)
+{
+    assert(out && out->len == 0);
+    free(out->buf);
+    free(out);
+}
@@ -0,0 +1,36 @@
+#ifndef OUT_H__
+#define OUT_H__
+
+#include <stddef.h>
+
+/* Assembly output collected in memory and written to fd in large chunks,
+ * with fd -1 it stays in buf until the owner takes it
+ */
+typedef struct out_t {
+    int fd;
+    char *buf;
+    size_t len;
+    size_t size;
+} out_t;
+
+/* main flushes between definitions once this much is pending */
+#define OUT_FLUSH_SIZE (64 * 1024)
+
+/* the longest put_long */
+#define PUT_LONG_MAX 20
+
+out_t *make_out(int fd);
+/* room for n more bytes at the returned pointer, the caller moves len */
+char *out_reserve(out_t *out, size_t n);
+/* write v in decimal at p, return the end */
+char *put_long(char *p, long v);
+void out_char(out_t *out, char c);
+void out_mem(out_t *out, const char *s, size_t len);
+void out_str(out_t *out, const char *s);
+void out_long(out_t *out, long v);
+/* a printf subset: %s, %d, %ld, %c and %% */
+void out_format(out_t *out, const char *fmt, ...);
+void out_flush(out_t *out);
+void free_out(out_t *out);
+
+#endif
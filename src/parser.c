@@ -3,20 +3,22 @@
 #include <assert.h>
 #include "parser.h"
 #include "util.h"
+#include "intern.h"
 
-ctype_t *ctype_void = &(ctype_t){CTYPE_VOID, 0};
-ctype_t *ctype_char = &(ctype_t){CTYPE_CHAR, 1};
-ctype_t *ctype_int = &(ctype_t){CTYPE_INT, 4};
-ctype_t *ctype_float = &(ctype_t){CTYPE_FLOAT, 4};
-ctype_t *ctype_double = &(ctype_t){CTYPE_DOUBLE, 8};
+ctype_t *ctype_void = &(ctype_t){.type = CTYPE_VOID, .size = 0};
+ctype_t *ctype_char = &(ctype_t){.type = CTYPE_CHAR, .size = 1};
+ctype_t *ctype_int = &(ctype_t){.type = CTYPE_INT, .size = 4};
+ctype_t *ctype_float = &(ctype_t){.type = CTYPE_FLOAT, .size = 4};
+ctype_t *ctype_double = &(ctype_t){.type = CTYPE_DOUBLE, .size = 8};
 
 /* I'm lazy */
 #define _FILE_ parser->lexer->fname
-#define _LINE_ parser->lexer->line
+#define _LINE_ lexer_line(parser->lexer)
 
 /* i/o functions */
 #define NEXT() (get_token(parser->lexer))
 #define PEEK() (peek_token(parser->lexer))
+#define PEEK_NTH(n) (peek_nth_token(parser->lexer, n))
 #define UNGET(token) (unget_token(token, parser->lexer))
 #define EXPECT_PUNCT(punct) \
     do { \
@@ -35,6 +37,12 @@ ctype_t *ctype_double = &(ctype_t){CTYPE_DOUBLE, 8};
     } while (0)
 #define TRY_KW(keyword) \
     (is_keyword(PEEK(), keyword) ? (NEXT(), true) : false)
+/* identifiers are interned, hash once and compare pointers */
+#define LOOKUP(name) (scope_lookup(parser->env, name))
+#define INSERT(name, val) (scope_insert(parser->env, name, val))
+/* node pool */
+#define ID(node) ((node) ? (node)->id : 0)
+#define KID(list, i) AST_KID(&parser->ast, list, i)
 
 /* type check functions */
 static bool is_punct(token_t *token, int punct)
@@ -127,6 +135,7 @@ bool is_ptr(ctype_t *ctype)
 
 static bool is_same_type(ctype_t *t, ctype_t *p)
 {
+    /* types are canonical */
     if (t == p)
         return true;
     /* TODO:
@@ -195,40 +204,183 @@ static char *punct2str(int punct)
 }
 
 /************************** type constructors *************************/
+/* Types are hash-consed: there is a single ctype_t for every (kind, pointee,
+ * length, signature), so types are compared by pointer and never modified
+ * once made.
+ */
 #define NEW_TYPE(ctype, tp, sz) \
     do { \
-        (ctype) = calloc(1, sizeof(ctype_t)); \
-        (ctype)->type = (tp); \
-        (ctype)->size = (sz); \
+        memset(&(ctype), 0, sizeof(ctype_t)); \
+        (ctype).type = (tp); \
+        (ctype).size = (sz); \
     } while (0)
 
-static ctype_t *make_ptr(ctype_t *p)
+#define HASH_MIX(h, v) ((h) ^ ((size_t) (v) + 0x9e3779b9 + ((h) << 6) + ((h) >> 2)))
+
+static size_t type_hash(ctype_t *ctype)
+{
+    size_t i, h = ctype->type;
+
+    h = HASH_MIX(h, (uintptr_t) ctype->ptr);
+    h = HASH_MIX(h, ctype->len);
+    h = HASH_MIX(h, (uintptr_t) ctype->ret);
+    h = HASH_MIX(h, ctype->is_va);
+    for (i = 0; i < vector_len(ctype->param_types); i++)
+        h = HASH_MIX(h, (uintptr_t) vector_get(ctype->param_types, i));
+    return h;
+}
+
+static bool type_equal(ctype_t *t, ctype_t *p)
+{
+    size_t i;
+
+    if (t->type != p->type || t->ptr != p->ptr || t->len != p->len
+            || t->ret != p->ret || t->is_va != p->is_va
+            || vector_len(t->param_types) != vector_len(p->param_types))
+        return false;
+    for (i = 0; i < vector_len(t->param_types); i++)
+        if (vector_get(t->param_types, i) != vector_get(p->param_types, i))
+            return false;
+    return true;
+}
+
+static void types_resize(parser_t *parser)
+{
+    ctype_t **old = parser->types;
+    size_t i, j, size = parser->types_size;
+
+    parser->types_size = size ? size * 2 : 64;
+    parser->types = calloc(parser->types_size, sizeof(ctype_t *));
+    for (i = 0; i < size; i++) {
+        if (!old[i])
+            continue;
+        for (j = type_hash(old[i]) & (parser->types_size - 1); parser->types[j];
+                j = (j + 1) & (parser->types_size - 1))
+            ;
+        parser->types[j] = old[i];
+    }
+    free(old);
+}
+
+/* return the canonical type equal to key, key itself is not kept */
+static ctype_t *intern_type(parser_t *parser, ctype_t *key)
 {
+    size_t i, j;
     ctype_t *ctype;
 
-    NEW_TYPE(ctype, CTYPE_PTR, 8);
-    ctype->ptr = p;
+    if (2 * (parser->ntypes + 1) > parser->types_size)
+        types_resize(parser);
+    for (i = type_hash(key) & (parser->types_size - 1); (ctype = parser->types[i]);
+            i = (i + 1) & (parser->types_size - 1))
+        if (type_equal(ctype, key))
+            return ctype;
+    ctype = arena_alloc(parser->types_arena, sizeof(ctype_t));
+    *ctype = *key;
+    if (key->param_types) {
+        ctype->param_types = make_arena_vector(parser->types_arena);
+        for (j = 0; j < vector_len(key->param_types); j++)
+            vector_append(ctype->param_types, vector_get(key->param_types, j));
+    }
+    parser->types[i] = ctype;
+    parser->ntypes++;
     return ctype;
 }
 
-static ctype_t *make_array(ctype_t *p, int len)
+static ctype_t *make_ptr(parser_t *parser, ctype_t *p)
 {
-    ctype_t *ctype;
+    ctype_t ctype;
+
+    NEW_TYPE(ctype, CTYPE_PTR, 8);
+    ctype.ptr = p;
+    return intern_type(parser, &ctype);
+}
+
+static ctype_t *make_array(parser_t *parser, ctype_t *p, int len)
+{
+    ctype_t ctype;
 
     NEW_TYPE(ctype, CTYPE_ARRAY, 8);
-    ctype->ptr = p;
-    ctype->len = len;
-    return ctype;
+    ctype.ptr = p;
+    ctype.len = len;
+    return intern_type(parser, &ctype);
+}
+
+static ctype_t *make_func(parser_t *parser, ctype_t *ret, vector_t *param_types, bool is_va)
+{
+    ctype_t ctype;
+
+    NEW_TYPE(ctype, CTYPE_PTR, 8);
+    ctype.ret = ret;
+    ctype.param_types = param_types;
+    ctype.is_va = is_va;
+    return intern_type(parser, &ctype);
+}
+
+/*************************** node pool **********************************/
+static node_t *ast_new_node(parser_t *parser)
+{
+    ast_t *ast = &parser->ast;
+    node_id id = ast->nnodes++;
+    node_t *node;
+
+    if ((id >> NODE_BLOCK_BITS) == ast->nblocks) {
+        ast->blocks = realloc(ast->blocks, sizeof(node_t *) * (ast->nblocks + 1));
+        ast->blocks[ast->nblocks++] = arena_alloc(parser->arena, sizeof(node_t) * NODE_BLOCK_SIZE);
+    }
+    /* the slot may hold a node of a released definition */
+    node = &ast->blocks[id >> NODE_BLOCK_BITS][id & (NODE_BLOCK_SIZE - 1)];
+    memset(node, 0, sizeof(node_t));
+    node->id = id;
+    return node;
+}
+
+/* Children of a list are pushed to the scratch stack while it is parsed,
+ * lists nested in it are finished first and popped off again.  The
+ * finished list is copied to kids, so siblings end up next to each other.
+ */
+static uint32_t list_begin(parser_t *parser)
+{
+    return parser->ast.nscratch;
+}
+
+static void list_push(parser_t *parser, node_t *node)
+{
+    ast_t *ast = &parser->ast;
+
+    if (ast->nscratch == ast->scratch_size) {
+        ast->scratch_size = ast->scratch_size ? ast->scratch_size * 2 : 64;
+        ast->scratch = realloc(ast->scratch, sizeof(node_id) * ast->scratch_size);
+    }
+    ast->scratch[ast->nscratch++] = ID(node);
+}
+
+static node_list_t list_end(parser_t *parser, uint32_t mark)
+{
+    ast_t *ast = &parser->ast;
+    node_list_t list;
+
+    list.start = ast->nkids;
+    list.len = ast->nscratch - mark;
+    if (ast->nkids + list.len > ast->kids_size) {
+        while (ast->nkids + list.len > ast->kids_size)
+            ast->kids_size = ast->kids_size ? ast->kids_size * 2 : 256;
+        ast->kids = realloc(ast->kids, sizeof(node_id) * ast->kids_size);
+    }
+    if (list.len)
+        memcpy(ast->kids + ast->nkids, ast->scratch + mark, sizeof(node_id) * list.len);
+    ast->nkids += list.len;
+    ast->nscratch = mark;
+    return list;
 }
 
 /*************************** node constructors **********************************/
 #define NEW_NODE(node, tp) \
     do { \
-        (node) = calloc(1, sizeof(node_t)); \
+        (node) = ast_new_node(parser); \
         (node)->type = tp; \
     } while (0)
 
-static node_t *make_var_decl(ctype_t *ctype, char *varname)
+static node_t *make_var_decl(parser_t *parser, ctype_t *ctype, char *varname)
 {
     node_t *node;
 
@@ -238,28 +390,28 @@ static node_t *make_var_decl(ctype_t *ctype, char *varname)
     return node;
 }
 
-static node_t *make_var_init(node_t *var, node_t *init)
+static node_t *make_var_init(parser_t *parser, node_t *var, node_t *init)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_VAR_INIT);
     node->binary_op = '=';
-    node->left = var;
-    node->right = init;
+    node->left = ID(var);
+    node->right = ID(init);
     return node;
 }
 
-static node_t *make_array_init(node_t *array, vector_t *array_init)
+static node_t *make_array_init(parser_t *parser, node_t *array, node_list_t array_init)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_ARRAY_INIT);
-    node->array = array;
+    node->array = ID(array);
     node->array_init = array_init;
     return node;
 }
 
-static node_t *make_func_call(ctype_t *ctype, char *func_name, vector_t *args)
+static node_t *make_func_call(parser_t *parser, ctype_t *ctype, char *func_name, node_list_t args)
 {
     node_t *node;
 
@@ -271,7 +423,7 @@ static node_t *make_func_call(ctype_t *ctype, char *func_name, vector_t *args)
     return node;
 }
 
-static node_t *make_compound_stmt(vector_t *stmts)
+static node_t *make_compound_stmt(parser_t *parser, node_list_t stmts)
 {
     node_t *node;
 
@@ -280,81 +432,86 @@ static node_t *make_compound_stmt(vector_t *stmts)
     return node;
 }
 
-static node_t *make_cast(ctype_t *ctype, node_t *expr)
+static node_t *make_cast(parser_t *parser, ctype_t *ctype, node_t *expr)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_CAST);
     node->ctype = ctype;
-    node->expr = expr;
+    node->expr = ID(expr);
     return node;
 }
 
-static node_t *make_arith_conv(ctype_t *ctype, node_t *expr)
+static node_t *make_arith_conv(parser_t *parser, ctype_t *ctype, node_t *expr)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_ARITH_CONV);
     node->ctype = ctype;
-    node->expr = expr;
+    node->expr = ID(expr);
     return node;
 }
 
-static node_t *make_unary(ctype_t *ctype, int op, node_t *operand)
+static node_t *make_unary(parser_t *parser, ctype_t *ctype, int op, node_t *operand)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_UNARY);
     node->ctype = ctype;
     node->unary_op = op;
-    node->operand = operand;
+    node->operand = ID(operand);
     return node;
 }
 
-static node_t *make_postfix(ctype_t *ctype, int op, node_t *operand)
+static node_t *make_postfix(parser_t *parser, ctype_t *ctype, int op, node_t *operand)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_POSTFIX);
     node->ctype = ctype;
     node->unary_op = op;
-    node->operand = operand;
+    node->operand = ID(operand);
     return node;
 }
 
-static node_t *make_binary(ctype_t *ctype, int op, node_t *left, node_t *right)
+static node_t *make_binary(parser_t *parser, ctype_t *ctype, int op, node_t *left, node_t *right)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_BINARY);
     node->ctype = ctype;
     node->binary_op = op;
-    node->left = left;
-    node->right = right;
+    node->left = ID(left);
+    node->right = ID(right);
     return node;
 }
 
-static node_t *make_ternary(ctype_t *ctype, node_t *cond, node_t *then, node_t *els)
+static node_t *make_ternary(parser_t *parser, ctype_t *ctype, node_t *cond, node_t *then, node_t *els)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_TERNARY);
     node->ctype = ctype;
-    node->cond = cond;
-    node->then = then;
-    node->els = els;
+    node->cond = ID(cond);
+    node->then = ID(then);
+    node->els = ID(els);
     return node;
 }
 
-static node_t *make_number(char *s)
+/* number tokens are not terminated, strto* read a copy */
+#define NUMBER_BUF_SIZE 64
+
+static node_t *make_number(parser_t *parser, const char *num, size_t len)
 {
     node_t *node;
-    char *end;
+    char buf[NUMBER_BUF_SIZE], *s = buf, *end;
 
     NEW_NODE(node, NODE_CONSTANT);
+    if (len >= sizeof(buf))
+        s = arena_alloc(parser->arena, len + 1);
+    memcpy(s, num, len);
+    s[len] = '\0';
     if (strpbrk(s, ".eE")) {
-        size_t len = strlen(s);
-        char *end;
         if (s[len - 1] == 'f' || s[len - 1] == 'F') {
             node->fval = strtof(s, &end);
             node->ctype = ctype_float;
@@ -373,7 +530,7 @@ static node_t *make_number(char *s)
     return node;
 }
 
-static node_t *make_char(int c)
+static node_t *make_char(parser_t *parser, int c)
 {
     node_t *node;
 
@@ -383,66 +540,67 @@ static node_t *make_char(int c)
     return node;
 }
 
-static node_t *make_string(char *s)
+static node_t *make_string(parser_t *parser, const char *s, size_t len)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_STRING);
-    node->ctype = make_ptr(ctype_char);
+    node->ctype = make_ptr(parser, ctype_char);
     node->sval = s;
+    node->slen = len;
     return node;
 }
 
-static node_t *make_if(node_t *cond, node_t *then, node_t *els)
+static node_t *make_if(parser_t *parser, node_t *cond, node_t *then, node_t *els)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_IF);
-    node->cond = cond;
-    node->then = then;
-    node->els = els;
+    node->cond = ID(cond);
+    node->then = ID(then);
+    node->els = ID(els);
     return node;
 }
 
-static node_t *make_for(node_t *init, node_t *cond, node_t *step, node_t *body)
+static node_t *make_for(parser_t *parser, node_t *init, node_t *cond, node_t *step, node_t *body)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_FOR);
-    node->for_init = init;
-    node->for_cond = cond;
-    node->for_step = step;
-    node->for_body = body;
+    node->for_init = ID(init);
+    node->for_cond = ID(cond);
+    node->for_step = ID(step);
+    node->for_body = ID(body);
     return node;
 }
 
-static node_t *make_do_while(node_t *cond, node_t *body)
+static node_t *make_do_while(parser_t *parser, node_t *cond, node_t *body)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_DO_WHILE);
-    node->while_cond = cond;
-    node->while_body = body;
+    node->while_cond = ID(cond);
+    node->while_body = ID(body);
     return node;
 }
 
-static node_t *make_while(node_t *cond, node_t *body)
+static node_t *make_while(parser_t *parser, node_t *cond, node_t *body)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_WHILE);
-    node->while_cond = cond;
-    node->while_body = body;
+    node->while_cond = ID(cond);
+    node->while_body = ID(body);
     return node;
 }
 
-static node_t *make_return(ctype_t *ctype, node_t *ret)
+static node_t *make_return(parser_t *parser, ctype_t *ctype, node_t *ret)
 {
     node_t *node;
 
     NEW_NODE(node, NODE_RETURN);
     node->ctype = ctype;
-    node->expr = ret;
+    node->expr = ID(ret);
     return node;
 }
 
@@ -456,11 +614,11 @@ static ctype_t *arith_conv(ctype_t *l, ctype_t *r)
     return ctype_int;
 }
 
-static node_t *conv(ctype_t *ctype, node_t *node)
+static node_t *conv(parser_t *parser, ctype_t *ctype, node_t *node)
 {
     if (is_same_type(ctype, node->ctype))
         return node;
-    return make_arith_conv(ctype, node);
+    return make_arith_conv(parser, ctype, node);
 }
 
 /* parse functions */
@@ -491,18 +649,18 @@ static node_t *parse_primary_expr(parser_t *parser)
     token = NEXT();
     switch (token->type) {
     case TK_ID:
-        primary = dict_lookup(parser->env, token->sval);
+        primary = LOOKUP(token->sval);
         if (!primary)
             errorf("\'%s\' undeclared in %s:%d\n", token->sval, _FILE_, _LINE_);
         break;
     case TK_NUMBER:
-        primary = make_number(token->sval);
+        primary = make_number(parser, token->sval, token->len);
         break;
     case TK_CHAR:
-        primary = make_char(token->ival);
+        primary = make_char(parser, token->ival);
         break;
     case TK_STRING:
-        primary = make_string(token->sval);
+        primary = make_string(parser, token->sval, token->len);
         break;
     default:
         errorf("expected expression in %s:%d\n", _FILE_, _LINE_);
@@ -515,31 +673,31 @@ static node_t *parse_primary_expr(parser_t *parser)
  *      assignment-expression
  *      argument-expression-list , assign-expression
  */
-static vector_t *parse_arg_expr_list(parser_t *parser, node_t *func)
+static node_list_t parse_arg_expr_list(parser_t *parser, node_t *func)
 {
-    vector_t *args;
+    uint32_t args;
     vector_t *types = func->ctype->param_types;
     size_t i;
 
+    args = list_begin(parser);
     if (types == NULL) {
         if (!TRY_PUNCT(')'))
             errorf("too many arguments to function \'%s\' in %s:%d\n", func->func_name, _FILE_, _LINE_);
-        return NULL;
+        return list_end(parser, args);
     }
     if (TRY_PUNCT(')'))
         errorf("too few arguments to function \'%s\' in %s:%d\n", func->func_name, _FILE_, _LINE_);
 
-    args = make_vector();
     /* TODO: conversion */
     for (i = 0; i < vector_len(types); i++) {
         ctype_t *type = vector_get(types, i);
         node_t *arg = parse_assign_expr(parser);
         if (is_arith_type(type) && is_arith_type(arg->ctype))
-            arg = conv(type, arg);
+            arg = conv(parser, type, arg);
         else if (!is_same_type(type, arg->ctype) && !is_null(arg))
             errorf("passing argument %d of \'%s\' makes %s from %s without a cast in %s:%d\n",
                     (int) i + 1, func->func_name, type2str(type), type2str(arg->ctype), _FILE_, _LINE_);
-        vector_append(args, arg);
+        list_push(parser, arg);
         if (i == vector_len(types) - 1 || is_punct(PEEK(), ')'))
             break;
         if (!TRY_PUNCT(','))
@@ -551,8 +709,8 @@ static vector_t *parse_arg_expr_list(parser_t *parser, node_t *func)
             node_t *arg = parse_assign_expr(parser);
             /* varaiable argument function converts float type arg to double; */
             if (arg->ctype == ctype_float)
-                arg = conv(ctype_double, arg);
-            vector_append(args, arg);
+                arg = conv(parser, ctype_double, arg);
+            list_push(parser, arg);
             if (is_punct(PEEK(), ')'))
                 break;
             if (!TRY_PUNCT(','))
@@ -564,7 +722,7 @@ static vector_t *parse_arg_expr_list(parser_t *parser, node_t *func)
     else if (TRY_PUNCT(','))
         errorf("too many arguments to function \'%s\' in %s:%d\n", func->func_name, _FILE_, _LINE_);
     EXPECT_PUNCT(')');
-    return args;
+    return list_end(parser, args);
 }
 
 /* postfix-expression:
@@ -598,10 +756,10 @@ static node_t *parse_postfix_expr(parser_t *parser)
                 errorf("array subscript is not an integer in %s:%d\n", _FILE_, _LINE_);
             EXPECT_PUNCT(']');
             if (is_array(post->ctype))
-                post = make_binary(make_ptr(post->ctype->ptr), '+', post, expr);
+                post = make_binary(parser, make_ptr(parser, post->ctype->ptr), '+', post, expr);
             else
-                post = make_binary(post->ctype, '+', post, expr);
-            post = make_unary(post->ctype->ptr, '*', post);
+                post = make_binary(parser, post->ctype, '+', post, expr);
+            post = make_unary(parser, post->ctype->ptr, '*', post);
 
         } else if (is_punct(token, '.'))
             errorf("TODO: struct or union in %s:%d\n", _FILE_, _LINE_);
@@ -615,14 +773,14 @@ static node_t *parse_postfix_expr(parser_t *parser)
             if (!is_arith_type(post->ctype) && !is_ptr(post->ctype))
                 errorf("invalid type argument of unary \'%s\' (have \'%s\') in %s:%d\n",
                         punct2str(token->ival), type2str(post->ctype), _FILE_, _LINE_);
-            post = make_postfix(post->ctype, token->ival, post);
+            post = make_postfix(parser, post->ctype, token->ival, post);
 
         } else if (is_punct(token, '(')) {
             /* TODO: function pointer */
             if (post->type != NODE_FUNC_DECL && post->type != NODE_FUNC_DEF)
                 errorf("called object is not a function or function pointer in %s:%d\n", _FILE_, _LINE_);
-            vector_t *args = parse_arg_expr_list(parser, post);
-            post = make_func_call(post->ctype, post->func_name, args);
+            node_list_t args = parse_arg_expr_list(parser, post);
+            post = make_func_call(parser, post->ctype, post->func_name, args);
         } else {
             UNGET(token);
             break;
@@ -656,36 +814,36 @@ static node_t *parse_unary_expr(parser_t *parser)
         if (!is_arith_type(expr->ctype) && !is_ptr(expr->ctype))
             errorf("invalid type argument of unary \'%s\' (have \'%s\') in %s:%d\n",
                     punct2str(token->ival), type2str(expr->ctype), _FILE_, _LINE_);
-        unary = make_unary(expr->ctype, token->ival, expr);
+        unary = make_unary(parser, expr->ctype, token->ival, expr);
 
     } else if (is_punct(token, '&')) {
         expr = parse_cast_expr(parser);
         if (!is_lvalue(expr) && expr->type != NODE_FUNC_DEF && expr->type != NODE_FUNC_DECL && !is_array(expr->ctype))
             errorf("lvalue required as unary \'&\' operand in %s:%d\n", _FILE_, _LINE_);
-        unary = make_unary(make_ptr(expr->ctype), '&', expr);
+        unary = make_unary(parser, make_ptr(parser, expr->ctype), '&', expr);
 
     } else if (is_punct(token, '*')) {
         expr = parse_cast_expr(parser);
         if (!is_ptr(expr->ctype))
             errorf("invalid type argument of unary \'*\' (have \'%s\') in %s:%d\n",
                     type2str(expr->ctype), _FILE_, _LINE_);
-        unary = make_unary(expr->ctype->ptr, '*', expr);
+        unary = make_unary(parser, expr->ctype->ptr, '*', expr);
 
     } else if (is_punct(token, '+') || is_punct(token, '-')) {
         expr = parse_cast_expr(parser);
         if (!is_arith_type(expr->ctype))
             errorf("wrong type argument to unary \'%c\' in %s:%d\n", token->ival, _FILE_, _LINE_);
-        unary = make_unary(expr->ctype, token->ival, expr);
+        unary = make_unary(parser, expr->ctype, token->ival, expr);
 
     } else if (is_punct(token, '~')) {
         expr = parse_cast_expr(parser);
         if (expr->ctype != ctype_int)
             errorf("wrong type argument to bit-complement in %s:%d\n", _FILE_, _LINE_);
-        unary = make_unary(expr->ctype, '~', expr);
+        unary = make_unary(parser, expr->ctype, '~', expr);
 
     } else if (is_punct(token, '!')) {
         expr = parse_cast_expr(parser);
-        unary = make_unary(ctype_int, '!', expr);
+        unary = make_unary(parser, ctype_int, '!', expr);
 
     /* TODO: sizeof */
     } else {
@@ -725,7 +883,7 @@ static ctype_t *parse_type_name(parser_t *parser)
         break;
     }
     while (TRY_PUNCT('*'))
-        ctype = make_ptr(ctype);
+        ctype = make_ptr(parser, ctype);
     return ctype;
 }
 
@@ -758,7 +916,7 @@ static node_t *parse_cast_expr(parser_t *parser)
         else if (is_ptr(ctype) && cast->ctype->size != ctype->size)
             errorf("cast to pointer from integer of different size in %s:%d\n", _FILE_, _LINE_);
         /* TODO */
-        return make_cast(ctype, cast);
+        return make_cast(parser, ctype, cast);
     }
     UNGET(token);
     return parse_unary_expr(parser);
@@ -770,25 +928,18 @@ static node_t *parse_cast_expr(parser_t *parser)
  *      multiplicative / cast-expression
  *      multiplicative % cast-expression
  */
-static node_t *parse_multiplicative_expr(parser_t *parser)
+static node_t *make_multiplicative_expr(parser_t *parser, int op, node_t *mul, node_t *cast)
 {
-    node_t *mul = parse_cast_expr(parser);
-    token_t *token;
+    ctype_t *ctype;
 
-    for (token = NEXT(); is_punct(token, '*') || is_punct(token, '/') || is_punct(token, '%'); token = NEXT()) {
-        node_t *cast = parse_cast_expr(parser);
-        ctype_t *ctype;
-        if (!(is_arith_type(mul->ctype) && is_arith_type(cast->ctype))
-                || (is_punct(token, '%') && (mul->ctype != ctype_int || cast->ctype != ctype_int)))
-            errorf("invalid operands to binary %c (have \'%s\' and \'%s\') in %s:%d\n",
-                    token->ival, type2str(mul->ctype), type2str(cast->ctype), _FILE_, _LINE_);
-        if ((is_punct(token, '/') || is_punct(token, '%')) && is_zero(cast))
-            errorf("division by zero in %s:%d\n", _FILE_, _LINE_);
-        ctype = arith_conv(mul->ctype, cast->ctype);
-        mul = make_binary(ctype, token->ival, conv(ctype, mul), conv(ctype, cast));
-    }
-    UNGET(token);
-    return mul;
+    if (!(is_arith_type(mul->ctype) && is_arith_type(cast->ctype))
+            || (op == '%' && (mul->ctype != ctype_int || cast->ctype != ctype_int)))
+        errorf("invalid operands to binary %c (have \'%s\' and \'%s\') in %s:%d\n",
+                op, type2str(mul->ctype), type2str(cast->ctype), _FILE_, _LINE_);
+    if ((op == '/' || op == '%') && is_zero(cast))
+        errorf("division by zero in %s:%d\n", _FILE_, _LINE_);
+    ctype = arith_conv(mul->ctype, cast->ctype);
+    return make_binary(parser, ctype, op, conv(parser, ctype, mul), conv(parser, ctype, cast));
 }
 
 /* additive-expression:
@@ -796,35 +947,28 @@ static node_t *parse_multiplicative_expr(parser_t *parser)
  *      additive-expression + multiplicative-expression
  *      additive-expression - multipilicative-expression
  */
-static node_t *parse_additive_expr(parser_t *parser)
-{
-    node_t *add = parse_multiplicative_expr(parser);
-    token_t *token;
-
-    for (token = NEXT(); is_punct(token, '+') || is_punct(token, '-'); token = NEXT()) {
-        node_t *mul = parse_multiplicative_expr(parser);
-        /* TODO: type check and more concise error message: pointer type */
-        /* pointer +- integer */
-        if (is_ptr(add->ctype) && mul->ctype == ctype_int) {
-            ctype_t *ctype = is_array(add->ctype) ? make_ptr(add->ctype->ptr) : add->ctype;
-            add = make_binary(ctype, token->ival, add, mul);
-        /* integer + pointer */
-        } else if (is_punct(token, '+') && add->ctype == ctype_int && is_ptr(mul->ctype)) {
-            ctype_t *ctype = is_array(mul->ctype) ? make_ptr(mul->ctype->ptr) : mul->ctype;
-            add = make_binary(ctype, '+', mul, add);
-        /* pointer - pointer */
-        } else if (is_punct(token, '-') && is_ptr(add->ctype) && is_same_type(add->ctype, mul->ctype))
-            add = make_binary(ctype_int, '-', add, mul);
-        /* number +- number */
-        else if (is_arith_type(add->ctype) && is_arith_type(mul->ctype)) {
-            ctype_t *ctype = arith_conv(add->ctype, mul->ctype);
-            add = make_binary(ctype, token->ival, conv(ctype, add), conv(ctype, mul));
-        } else
-            errorf("invalid operands to binary %c (have \'%s\' and \'%s\') in %s:%d\n",
-                    token->ival, type2str(add->ctype), type2str(mul->ctype), _FILE_, _LINE_);
+static node_t *make_additive_expr(parser_t *parser, int op, node_t *add, node_t *mul)
+{
+    /* TODO: type check and more concise error message: pointer type */
+    /* pointer +- integer */
+    if (is_ptr(add->ctype) && mul->ctype == ctype_int) {
+        ctype_t *ctype = is_array(add->ctype) ? make_ptr(parser, add->ctype->ptr) : add->ctype;
+        return make_binary(parser, ctype, op, add, mul);
+    /* integer + pointer */
+    } else if (op == '+' && add->ctype == ctype_int && is_ptr(mul->ctype)) {
+        ctype_t *ctype = is_array(mul->ctype) ? make_ptr(parser, mul->ctype->ptr) : mul->ctype;
+        return make_binary(parser, ctype, '+', mul, add);
+    /* pointer - pointer */
+    } else if (op == '-' && is_ptr(add->ctype) && is_same_type(add->ctype, mul->ctype))
+        return make_binary(parser, ctype_int, '-', add, mul);
+    /* number +- number */
+    else if (is_arith_type(add->ctype) && is_arith_type(mul->ctype)) {
+        ctype_t *ctype = arith_conv(add->ctype, mul->ctype);
+        return make_binary(parser, ctype, op, conv(parser, ctype, add), conv(parser, ctype, mul));
     }
-    UNGET(token);
-    return add;
+    errorf("invalid operands to binary %c (have \'%s\' and \'%s\') in %s:%d\n",
+            op, type2str(add->ctype), type2str(mul->ctype), _FILE_, _LINE_);
+    return NULL;
 }
 
 /* shift-expression:
@@ -832,20 +976,12 @@ static node_t *parse_additive_expr(parser_t *parser)
  *      shift-expression << additive-expression
  *      shift-expression >> additive-expression
  */
-static node_t *parse_shift_expr(parser_t *parser)
+static node_t *make_shift_expr(parser_t *parser, int op, node_t *shift, node_t *add)
 {
-    node_t *shift = parse_additive_expr(parser);
-    token_t *token;
-
-    for (token = NEXT(); is_punct(token, PUNCT_LSFT) || is_punct(token, PUNCT_RSFT); token = NEXT()) {
-        node_t *add = parse_additive_expr(parser);
-        if (shift->ctype != ctype_int || add->ctype != ctype_int)
-            errorf("invalid operands to binary %s (have \'%s\' and \'%s\') in %s:%d\n",
-                    punct2str(token->ival), type2str(shift->ctype), type2str(add->ctype));
-        shift = make_binary(ctype_int, token->ival, shift, add);
-    }
-    UNGET(token);
-    return shift;
+    if (shift->ctype != ctype_int || add->ctype != ctype_int)
+        errorf("invalid operands to binary %s (have \'%s\' and \'%s\') in %s:%d\n",
+                punct2str(op), type2str(shift->ctype), type2str(add->ctype), _FILE_, _LINE_);
+    return make_binary(parser, ctype_int, op, shift, add);
 }
 
 /* relational_expression:
@@ -855,35 +991,25 @@ static node_t *parse_shift_expr(parser_t *parser)
  *      relational-expression <= shift-expression
  *      relational-expression >= shift-expression
  */
-static node_t *parse_relational_expr(parser_t *parser)
-{
-    node_t *rel = parse_shift_expr(parser);
-    token_t *token;
-
-    for (token = NEXT();
-        is_punct(token, '<') || is_punct(token, '>') || is_punct(token, PUNCT_LE) || is_punct(token, PUNCT_GE);
-        token = NEXT()) {
-        node_t *shift = parse_shift_expr(parser);
-        /* TODO: refactory */
-        if (is_ptr(rel->ctype) && is_ptr(shift->ctype)) {
-            if (!is_same_type(rel->ctype, shift->ctype))
-                errorf("comparison of distinct pointer types lacks a cast in %s:%d\n", _FILE_, _LINE_);
-        } else if (!((is_arith_type(rel->ctype) && is_arith_type(shift->ctype))
-                    || (is_ptr(rel->ctype) && is_null(shift))
-                    || (is_ptr(shift->ctype) && is_null(rel)))) {
-            errorf("comparison between %s and %s in %s:%d\n",
-                    type2str(rel->ctype), type2str(shift->ctype), _FILE_, _LINE_);
-        }
+static node_t *make_relational_expr(parser_t *parser, int op, node_t *rel, node_t *shift)
+{
+    /* TODO: refactory */
+    if (is_ptr(rel->ctype) && is_ptr(shift->ctype)) {
+        if (!is_same_type(rel->ctype, shift->ctype))
+            errorf("comparison of distinct pointer types lacks a cast in %s:%d\n", _FILE_, _LINE_);
+    } else if (!((is_arith_type(rel->ctype) && is_arith_type(shift->ctype))
+                || (is_ptr(rel->ctype) && is_null(shift))
+                || (is_ptr(shift->ctype) && is_null(rel)))) {
+        errorf("comparison between %s and %s in %s:%d\n",
+                type2str(rel->ctype), type2str(shift->ctype), _FILE_, _LINE_);
+    }
 
-        if (is_arith_type(rel->ctype) && is_arith_type(shift->ctype)) {
-            ctype_t *ctype = arith_conv(rel->ctype, shift->ctype);
-            rel = conv(ctype, rel);
-            shift = conv(ctype, shift);
-        }
-        rel = make_binary(ctype_int, token->ival, rel, shift);
+    if (is_arith_type(rel->ctype) && is_arith_type(shift->ctype)) {
+        ctype_t *ctype = arith_conv(rel->ctype, shift->ctype);
+        rel = conv(parser, ctype, rel);
+        shift = conv(parser, ctype, shift);
     }
-    UNGET(token);
-    return rel;
+    return make_binary(parser, ctype_int, op, rel, shift);
 }
 
 /* equality-expression:
@@ -891,116 +1017,112 @@ static node_t *parse_relational_expr(parser_t *parser)
  *      equality-expression == relational-expression
  *      equality-expression != relational-expression
  */
-static node_t *parse_equality_expr(parser_t *parser)
-{
-    node_t *eq = parse_relational_expr(parser);
-    token_t *token;
-
-    for (token = NEXT(); is_punct(token, PUNCT_EQ) || is_punct(token, PUNCT_NE); token = NEXT()) {
-        node_t *rel = parse_relational_expr(parser);
-        /* both operands are pointers to qualified or unqualified versions of compatible types */
-        if (is_ptr(eq->ctype) && is_ptr(rel->ctype)) {
-            if (!is_same_type(eq->ctype, rel->ctype))
-                errorf("comparison of distinct pointer types lacks a cast in %s:%d\n", _FILE_, _LINE_);
-                    /* both operands have arithmetic type */
-        } else if (!((is_arith_type(eq->ctype) && is_arith_type(rel->ctype))
-                    /* one operand is a pointer and the other is a null pointer constant */
-                    || (is_ptr(eq->ctype) && is_null(rel))
-                    || (is_ptr(rel->ctype) && is_null(eq)))) {
-            errorf("comparison between %s and %s in %s:%d\n",
-                    type2str(eq->ctype), type2str(rel->ctype), _FILE_, _LINE_);
-        }
+static node_t *make_equality_expr(parser_t *parser, int op, node_t *eq, node_t *rel)
+{
+    /* both operands are pointers to qualified or unqualified versions of compatible types */
+    if (is_ptr(eq->ctype) && is_ptr(rel->ctype)) {
+        if (!is_same_type(eq->ctype, rel->ctype))
+            errorf("comparison of distinct pointer types lacks a cast in %s:%d\n", _FILE_, _LINE_);
+                /* both operands have arithmetic type */
+    } else if (!((is_arith_type(eq->ctype) && is_arith_type(rel->ctype))
+                /* one operand is a pointer and the other is a null pointer constant */
+                || (is_ptr(eq->ctype) && is_null(rel))
+                || (is_ptr(rel->ctype) && is_null(eq)))) {
+        errorf("comparison between %s and %s in %s:%d\n",
+                type2str(eq->ctype), type2str(rel->ctype), _FILE_, _LINE_);
+    }
 
-        if (is_arith_type(eq->ctype) && is_arith_type(rel->ctype)) {
-            ctype_t *ctype = arith_conv(eq->ctype, rel->ctype);
-            eq = conv(ctype, eq);
-            rel = conv(ctype, rel);
-        }
-        eq = make_binary(ctype_int, token->ival, eq, rel);
+    if (is_arith_type(eq->ctype) && is_arith_type(rel->ctype)) {
+        ctype_t *ctype = arith_conv(eq->ctype, rel->ctype);
+        eq = conv(parser, ctype, eq);
+        rel = conv(parser, ctype, rel);
     }
-    UNGET(token);
-    return eq;
+    return make_binary(parser, ctype_int, op, eq, rel);
 }
 
 /* AND-expression:
  *      equality-expression
  *      AND-expression & equality-expression
- */
-static node_t *parse_bit_and_expr(parser_t *parser)
-{
-    node_t *bitand = parse_equality_expr(parser);
-    while (TRY_PUNCT('&')) {
-        node_t *eq = parse_equality_expr(parser);
-        if (bitand->ctype != ctype_int || eq->ctype != ctype_int)
-            errorf("invalid operands to binary '&' (have \'%s\' and \'%s\') in %s:%d\n",
-                    type2str(bitand->ctype), type2str(eq->ctype), _FILE_, _LINE_);
-        bitand = make_binary(ctype_int, '&', bitand, eq);
-    }
-    return bitand;
-}
-
-/* exclusive-OR-expression:
+ *
+ * exclusive-OR-expression:
  *      AND-expression
  *      exclusive-OR-expression ^ AND-expression
- */
-static node_t *parse_bit_xor_expr(parser_t *parser)
-{
-    node_t *bitxor = parse_bit_and_expr(parser);
-    while (TRY_PUNCT('^')) {
-        node_t *bitand = parse_bit_and_expr(parser);
-        if (bitxor->ctype != ctype_int || bitand->ctype != ctype_int)
-            errorf("invalid operands to binary '^' (have \'%s\' and \'%s\') in %s:%d\n",
-                    type2str(bitxor->ctype), type2str(bitand->ctype), _FILE_, _LINE_);
-        bitxor = make_binary(ctype_int, '^', bitxor, bitand);
-    }
-    return bitxor;
-}
-
-/* inclusive-OR-expression:
+ *
+ * inclusive-OR-expression:
  *      exclusive-OR-expression
  *      inclusive-OR-expression | exclusive-OR-expression
  */
-static node_t *parse_bit_or_expr(parser_t *parser)
-{
-    node_t *bitor = parse_bit_xor_expr(parser);
-    while (TRY_PUNCT('|')) {
-        node_t *bitxor = parse_bit_xor_expr(parser);
-        if (bitor->ctype != ctype_int || bitxor->ctype != ctype_int)
-            errorf("invalid operands to binary '|' (have \'%s\' and \'%s\') in %s:%d\n",
-                    type2str(bitor->ctype), type2str(bitxor->ctype), _FILE_, _LINE_);
-        bitor = make_binary(ctype_int, '|', bitor, bitxor);
-    }
-    return bitor;
+static node_t *make_bit_expr(parser_t *parser, int op, node_t *left, node_t *right)
+{
+    if (left->ctype != ctype_int || right->ctype != ctype_int)
+        errorf("invalid operands to binary '%c' (have \'%s\' and \'%s\') in %s:%d\n",
+                op, type2str(left->ctype), type2str(right->ctype), _FILE_, _LINE_);
+    return make_binary(parser, ctype_int, op, left, right);
 }
 
 /* logical-AND-expression:
  *      inclusive-OR-expression
  *      logical-AND-expression && inclusive-OR-expression
+ *
+ * logical-OR-expression:
+ *      logical-AND-expression
+ *      logical-OR-expression || logical-AND-expression
  */
-static node_t *parse_log_and_expr(parser_t *parser)
+static node_t *make_log_expr(parser_t *parser, int op, node_t *left, node_t *right)
 {
-    node_t *logand = parse_bit_or_expr(parser);
-    while (TRY_PUNCT(PUNCT_AND)) {
-        node_t *bitor = parse_bit_or_expr(parser);
-        /* TODO: type check scalar check */
-        logand = make_binary(ctype_int, PUNCT_AND, logand, bitor);
-    }
-    return logand;
+    /* TODO: type check scalar type */
+    return make_binary(parser, ctype_int, op, left, right);
 }
 
-/* logical-OR-expression:
- *      logical-AND-expression
- *      logical-OR-expression || logical-AND-expression
+/* Binary operators from logical-OR (lowest) to multiplicative (highest)
+ * precedence, all left associative.
+ */
+static const struct {
+    int prec;
+    node_t *(*make)(parser_t *parser, int op, node_t *left, node_t *right);
+} binary_ops[PUNCT_IRSFT + 1] = {
+    [PUNCT_OR] = {1, make_log_expr},
+    [PUNCT_AND] = {2, make_log_expr},
+    ['|'] = {3, make_bit_expr},
+    ['^'] = {4, make_bit_expr},
+    ['&'] = {5, make_bit_expr},
+    [PUNCT_EQ] = {6, make_equality_expr},
+    [PUNCT_NE] = {6, make_equality_expr},
+    ['<'] = {7, make_relational_expr},
+    ['>'] = {7, make_relational_expr},
+    [PUNCT_LE] = {7, make_relational_expr},
+    [PUNCT_GE] = {7, make_relational_expr},
+    [PUNCT_LSFT] = {8, make_shift_expr},
+    [PUNCT_RSFT] = {8, make_shift_expr},
+    ['+'] = {9, make_additive_expr},
+    ['-'] = {9, make_additive_expr},
+    ['*'] = {10, make_multiplicative_expr},
+    ['/'] = {10, make_multiplicative_expr},
+    ['%'] = {10, make_multiplicative_expr}
+};
+
+static int binary_prec(token_t *token)
+{
+    if (!token || token->type != TK_PUNCT || token->ival < 0 || token->ival > PUNCT_IRSFT)
+        return 0;
+    return binary_ops[token->ival].prec;
+}
+
+/* Precedence climbing over binary_ops, parses every binary operator whose
+ * precedence is at least min_prec:
+ *      logical-OR-expression is parse_binary_expr(parser, 1)
  */
-static node_t *parse_log_or_expr(parser_t *parser)
+static node_t *parse_binary_expr(parser_t *parser, int min_prec)
 {
-    node_t *logor = parse_log_and_expr(parser);
-    while (TRY_PUNCT(PUNCT_OR)) {
-        node_t *logand = parse_log_and_expr(parser);
-        /* TODO: type check scalar type */
-        logor = make_binary(ctype_int, PUNCT_OR, logor, logand);
+    node_t *left = parse_cast_expr(parser);
+    int prec;
+
+    while ((prec = binary_prec(PEEK())) >= min_prec && prec > 0) {
+        int op = NEXT()->ival;
+        node_t *right = parse_binary_expr(parser, prec + 1);
+        left = binary_ops[op].make(parser, op, left, right);
     }
-    return logor;
+    return left;
 }
 
 /* conditional-expression:
@@ -1009,7 +1131,7 @@ static node_t *parse_log_or_expr(parser_t *parser)
  */
 static node_t *parse_cond_expr(parser_t *parser)
 {
-    node_t *cond = parse_log_or_expr(parser);
+    node_t *cond = parse_binary_expr(parser, 1);
     if (TRY_PUNCT('?')) {
         node_t *then = parse_expr(parser);
         EXPECT_PUNCT(':');
@@ -1017,11 +1139,11 @@ static node_t *parse_cond_expr(parser_t *parser)
         /* TODO: type */
         if (is_arith_type(then->ctype) && is_arith_type(els->ctype)) {
             ctype_t *ctype = arith_conv(then->ctype, els->ctype);
-            cond = make_ternary(ctype, cond, conv(ctype, then), conv(ctype, els));
+            cond = make_ternary(parser, ctype, cond, conv(parser, ctype, then), conv(parser, ctype, els));
         } else {
             if (!is_same_type(then->ctype, els->ctype) && !is_null(then) && !is_null(els))
                 errorf("type mismatch in conditional expression in %s:%d\n", _FILE_, _LINE_);
-            cond = make_ternary(then->ctype, cond, then, els);
+            cond = make_ternary(parser, then->ctype, cond, then, els);
         }
     }
     return cond;
@@ -1053,13 +1175,13 @@ static node_t *parse_assign_expr(parser_t *parser)
         if (is_ptr(node->ctype)) {
             /* ptr += int */
             if (op == '+' && assign->ctype == ctype_int)
-                assign = make_binary(node->ctype, '+', node, assign);
+                assign = make_binary(parser, node->ctype, '+', node, assign);
             /* ptr -= int */
             else if (op == '-' && assign->ctype == ctype_int)
-                assign = make_binary(node->ctype, '-', node, assign);
+                assign = make_binary(parser, node->ctype, '-', node, assign);
             /* ptr -= ptr */
             else if (op == '-' && is_same_type(node->ctype, assign->ctype))
-                assign = make_binary(ctype_int, '-', node, assign);
+                assign = make_binary(parser, ctype_int, '-', node, assign);
             else
                 errorf("invalid operands to binary %s (have \'%s\' and \'%s\') in %s:%d\n",
                         punct2str(token->ival), type2str(node->ctype), type2str(assign->ctype), _FILE_, _LINE_);
@@ -1070,7 +1192,7 @@ static node_t *parse_assign_expr(parser_t *parser)
             if (op == '/' && is_zero(assign))
                 errorf("division by zero in %s:%d\n", _FILE_, _LINE_);
             ctype_t *ctype = arith_conv(node->ctype, assign->ctype);
-            assign = make_binary(node->ctype, op, conv(ctype, node), conv(ctype, assign));
+            assign = make_binary(parser, node->ctype, op, conv(parser, ctype, node), conv(parser, ctype, assign));
         } else {
             /* %= &= ^= |= <<= >>= */
             if (node->ctype != ctype_int || assign->ctype != ctype_int)
@@ -1078,15 +1200,15 @@ static node_t *parse_assign_expr(parser_t *parser)
                         punct2str(token->ival), type2str(node->ctype), type2str(assign->ctype), _FILE_, _LINE_);
             if (op == '%' && is_zero(assign))
                 errorf("division by zero in %s:%d\n", _FILE_, _LINE_);
-            assign = make_binary(node->ctype, op, node, assign);
+            assign = make_binary(parser, node->ctype, op, node, assign);
         }
     }
     if (is_arith_type(node->ctype) && is_arith_type(assign->ctype))
-        return make_binary(node->ctype, '=', node, conv(node->ctype, assign));
+        return make_binary(parser, node->ctype, '=', node, conv(parser, node->ctype, assign));
     if (!is_same_type(node->ctype, assign->ctype) && !is_null(assign))
         errorf("assignment make %s from %s without a cast in %s:%d\n",
                 type2str(node->ctype), type2str(assign->ctype), _FILE_, _LINE_);
-    return make_binary(node->ctype, '=', node, assign);
+    return make_binary(parser, node->ctype, '=', node, assign);
 }
 
 /* expression:
@@ -1100,7 +1222,7 @@ static node_t *parse_expr(parser_t *parser)
     node = parse_assign_expr(parser);
     while (TRY_PUNCT(',')) {
         node_t *expr = parse_assign_expr(parser);
-        node = make_binary(expr->ctype, ',', node, expr);
+        node = make_binary(parser, expr->ctype, ',', node, expr);
     }
     return node;
 }
@@ -1142,22 +1264,20 @@ static ctype_t *parse_decl_spec(parser_t *parser)
  *      parameter-declaration
  *      parameter-list , parameter-declaration
  */
-static vector_t *parse_param_list(parser_t *parser)
+static node_list_t parse_param_list(parser_t *parser)
 {
-    vector_t *params;
-    token_t *token;
+    uint32_t params = list_begin(parser);
 
-    token = NEXT();
-    if (is_keyword(token, KW_VOID) && is_punct(PEEK(), ')'))
-        return NULL;
-    UNGET(token);
-    params = make_vector();
+    if (is_keyword(PEEK(), KW_VOID) && is_punct(PEEK_NTH(1), ')')) {
+        NEXT();
+        return list_end(parser, params);
+    }
     do {
         ctype_t *ctype = parse_decl_spec(parser);
         node_t *node = parse_declarator(parser, ctype);
-        vector_append(params, node);
+        list_push(parser, node);
     } while (TRY_PUNCT(','));
-    return params;
+    return list_end(parser, params);
 }
 
 static node_t *parse_func_decl(parser_t *parser, ctype_t *ctype, char *func_name)
@@ -1165,19 +1285,19 @@ static node_t *parse_func_decl(parser_t *parser, ctype_t *ctype, char *func_name
     node_t *decl;
     size_t i;
 
-    decl = calloc(1, sizeof(*decl));
-    decl->type = NODE_FUNC_DECL;
+    vector_t *param_types = NULL;
+
+    NEW_NODE(decl, NODE_FUNC_DECL);
     decl->func_name = func_name;
-    decl->ctype = make_ptr(NULL);
-    decl->ctype->ret = ctype;
-    /* TODO: variable argument list */
-    decl->ctype->is_va = false;
     decl->params = parse_param_list(parser);
-    if (decl->params) {
-        decl->ctype->param_types = make_vector();
-        for (i = 0; i < vector_len(decl->params); i++)
-            vector_append(decl->ctype->param_types, ((node_t *) vector_get(decl->params, i))->ctype);
+    if (decl->params.len) {
+        param_types = parser->param_types;
+        param_types->top = 0;
+        for (i = 0; i < decl->params.len; i++)
+            vector_append(param_types, KID(decl->params, i)->ctype);
     }
+    /* TODO: variable argument list */
+    decl->ctype = make_func(parser, ctype, param_types, false);
     EXPECT_PUNCT(')');
     return decl;
 }
@@ -1187,7 +1307,7 @@ static node_t *parse_array_decl(parser_t *parser, ctype_t *ctype, char *varname)
     node_t *decl;
 
     if (TRY_PUNCT(']')) {
-        decl = make_var_decl(make_array(ctype, 0), varname);
+        decl = make_var_decl(parser, make_array(parser, ctype, 0), varname);
         /* TODO: function declartion argument list */
         if (!is_punct(PEEK(), '='))
             errorf("array size missing in \'%s\' in %s:%d\n", varname, _FILE_, _LINE_);
@@ -1199,7 +1319,7 @@ static node_t *parse_array_decl(parser_t *parser, ctype_t *ctype, char *varname)
         if (is_zero(len))
             errorf("array size is zero in %s:%d\n", _FILE_, _LINE_);
         EXPECT_PUNCT(']');
-        decl = make_var_decl(make_array(ctype, len->ival), varname);
+        decl = make_var_decl(parser, make_array(parser, ctype, len->ival), varname);
     }
     return decl;
 }
@@ -1219,18 +1339,23 @@ static node_t *parse_direct_decl(parser_t *parser, ctype_t *ctype)
 {
     node_t *decl;
     token_t *token;
+    char *name;
 
+    /* TODO: suffixes after a parenthesized declarator */
     if (TRY_PUNCT('(')) {
         decl = parse_declarator(parser, ctype);
         EXPECT_PUNCT(')');
-    } else if ((token = NEXT())->type != TK_ID)
+        return decl;
+    }
+    if ((token = NEXT())->type != TK_ID)
         errorf("expected identifier in %s:%d\n", _FILE_, _LINE_);
+    name = (char *) token->sval;
     if (TRY_PUNCT('('))
-        decl = parse_func_decl(parser, ctype, token->sval);
+        decl = parse_func_decl(parser, ctype, name);
     else if (TRY_PUNCT('[')) {
-        decl = parse_array_decl(parser, ctype, token->sval);
+        decl = parse_array_decl(parser, ctype, name);
     } else {
-        decl = make_var_decl(ctype, token->sval);
+        decl = make_var_decl(parser, ctype, name);
     }
     return decl;
 }
@@ -1240,30 +1365,18 @@ static node_t *parse_direct_decl(parser_t *parser, ctype_t *ctype)
  */
 static node_t *parse_declarator(parser_t *parser, ctype_t *ctype)
 {
-    int n;
     node_t *node;
 
-    for (n = 0; TRY_PUNCT('*'); n++)
-        ;
+    while (TRY_PUNCT('*'))
+        ctype = make_ptr(parser, ctype);
     node = parse_direct_decl(parser, ctype);
-    if (node->type == NODE_VAR_DECL)
-        ctype = is_array(node->ctype) ? node->ctype->ptr : node->ctype;
-    else
-        ctype = node->ctype->ret;
-    while (n-- > 0)
-        ctype = make_ptr(ctype);
     if (node->type == NODE_VAR_DECL) {
         if (is_array(node->ctype)) {
-            if (ctype == ctype_void)
+            if (node->ctype->ptr == ctype_void)
                 errorf("declaration of \'%s\' as array of voids in %s:%d\n", node->varname, _FILE_, _LINE_);
-            node->ctype->ptr = ctype;
-        } else {
-            if (ctype == ctype_void)
-                errorf("variable \'%s\' declared void in %s:%d\n", node->varname, _FILE_, _LINE_);
-            node->ctype = ctype;
-        }
-    } else
-        node->ctype->ret = ctype;
+        } else if (node->ctype == ctype_void)
+            errorf("variable \'%s\' declared void in %s:%d\n", node->varname, _FILE_, _LINE_);
+    }
     return node;
 }
 
@@ -1280,33 +1393,34 @@ static node_t *parse_initializer(parser_t *parser, node_t *decl)
     if (!is_array(decl->ctype)) {
         node_t *init = parse_assign_expr(parser);
         if (is_arith_type(decl->ctype) && is_arith_type(init->ctype))
-            return make_var_init(decl, conv(decl->ctype, init));
+            return make_var_init(parser, decl, conv(parser, decl->ctype, init));
         if (!(is_same_type(init->ctype, decl->ctype)
                     || (is_ptr(decl->ctype) && is_null(init))))
             errorf("initialization makes %s from %s without a cast in %s:%d\n",
                     type2str(decl->ctype), type2str(init->ctype), _FILE_, _LINE_);
-        return make_var_init(decl, init);
+        return make_var_init(parser, decl, init);
     }
     /* TODO:
      *      multidimensional array
      *      structure */
-    vector_t *init = make_vector();
+    uint32_t init = list_begin(parser);
+    node_list_t list;
     if (PEEK()->type == TK_STRING) {
         token_t *string = NEXT();
         if (decl->ctype->ptr != ctype_char)
             errorf("invalid initializer in %s:%d\n", _FILE_, _LINE_);
         /* char s[]; */
-        size_t len = strlen(string->sval);
+        size_t len = string->len;
         if (decl->ctype->len == 0)
-            decl->ctype->len = len + 1;
-        else if (decl->ctype->len < len)
+            decl->ctype = make_array(parser, decl->ctype->ptr, len + 1);
+        else if ((size_t) decl->ctype->len < len)
             errorf("initializer-string for array of chars is too long in %s:%d\n", _FILE_, _LINE_);
 
         size_t i;
         /* Exclude the terminating '\0' */
         for (i = 0; i < len; i++)
-            vector_append(init, make_char(string->sval[i]));
-        return make_array_init(decl, init);
+            list_push(parser, make_char(parser, string->sval[i]));
+        return make_array_init(parser, decl, list_end(parser, init));
     }
 
     if (!TRY_PUNCT('{'))
@@ -1314,19 +1428,20 @@ static node_t *parse_initializer(parser_t *parser, node_t *decl)
     do {
         node_t *expr = parse_assign_expr(parser);
         if (is_arith_type(decl->ctype->ptr) && is_arith_type(expr->ctype))
-            expr = conv(decl->ctype->ptr, expr);
+            expr = conv(parser, decl->ctype->ptr, expr);
         else if (!(is_same_type(decl->ctype->ptr, expr->ctype)
                     || (is_ptr(decl->ctype->ptr) && is_null(expr))))
             errorf("initialization makes %s from %s without a cast in %s:%d\n",
                     type2str(decl->ctype->ptr), type2str(expr->ctype), _FILE_, _LINE_);
-        vector_append(init, expr);
+        list_push(parser, expr);
     } while (TRY_PUNCT(','));
     EXPECT_PUNCT('}');
+    list = list_end(parser, init);
     if (decl->ctype->len == 0)
-        decl->ctype->len = vector_len(init);
-    else if (decl->ctype->len < vector_len(init))
+        decl->ctype = make_array(parser, decl->ctype->ptr, list.len);
+    else if ((uint32_t) decl->ctype->len < list.len)
         errorf("excess elements in array initializer in %s:%d\n", _FILE_, _LINE_);
-    return make_array_init(decl, init);
+    return make_array_init(parser, decl, list);
 }
 
 /* init-declarator:
@@ -1336,7 +1451,7 @@ static node_t *parse_initializer(parser_t *parser, node_t *decl)
 static node_t *parse_init_decl(parser_t *parser, ctype_t *ctype)
 {
     node_t *decl = parse_declarator(parser, ctype);
-    if (!dict_insert(parser->env, decl->varname, decl, true))
+    if (!INSERT(decl->varname, decl))
         errorf("redeclaration of \'%s\' in %s:%d\n", decl->varname, _FILE_, _LINE_);
     if (TRY_PUNCT('=')) {
         decl = parse_initializer(parser, decl);
@@ -1353,7 +1468,7 @@ static node_t *parse_init_decl_list(parser_t *parser, ctype_t *ctype)
     node_t *list = parse_init_decl(parser, ctype);
     while (TRY_PUNCT(',')) {
         node_t *declarator = parse_init_decl(parser, ctype);
-        list = make_binary(NULL, ',', list, declarator);
+        list = make_binary(parser, NULL, ',', list, declarator);
     }
     return list;
 }
@@ -1393,7 +1508,7 @@ static node_t *parse_if_stmt(parser_t *parser)
     then = parse_stmt(parser);
     if (TRY_KW(KW_ELSE))
         els = parse_stmt(parser);
-    return make_if(cond, then, els);
+    return make_if(parser, cond, then, els);
 }
 
 /* iteration-statment:
@@ -1423,7 +1538,7 @@ static node_t *parse_for_stmt(parser_t *parser)
         EXPECT_PUNCT(')');
     }
     body = parse_stmt(parser);
-    return make_for(init, cond, step, body);
+    return make_for(parser, init, cond, step, body);
 }
 
 /* iteration-statement
@@ -1442,7 +1557,7 @@ static node_t *parse_do_while_stmt(parser_t *parser)
     cond = parse_expr(parser);
     EXPECT_PUNCT(')');
     EXPECT_PUNCT(';');
-    return make_do_while(cond, body);
+    return make_do_while(parser, cond, body);
 }
 
 /* iteration-statement:
@@ -1459,7 +1574,7 @@ static node_t *parse_while_stmt(parser_t *parser)
     cond = parse_expr(parser);
     EXPECT_PUNCT(')');
     body = parse_stmt(parser);
-    return make_while(cond, body);
+    return make_while(parser, cond, body);
 }
 
 /* jump-statement:
@@ -1472,19 +1587,19 @@ static node_t *parse_return_stmt(parser_t *parser)
     if (TRY_PUNCT(';')) {
         if (parser->ret != ctype_void)
             errorf("\'return\' with no value, in function returning non-void in %s:%d\n", _FILE_, _LINE_);
-        return make_return(ctype_void, NULL);
+        return make_return(parser, ctype_void, NULL);
     }
     if (parser->ret == ctype_void)
         errorf("\'return\' with a value, in function returning void in %s:%d\n", _FILE_, _LINE_);
 
     expr = parse_expr(parser);
     if (is_arith_type(expr->ctype) && is_arith_type(parser->ret))
-        expr = conv(parser->ret, expr);
+        expr = conv(parser, parser->ret, expr);
     else if (!is_same_type(expr->ctype, parser->ret) && !is_null(expr))
             errorf("return makes %s from %s without a cast in %s:%d\n",
                     type2str(parser->ret), type2str(expr->ctype), _FILE_, _LINE_);
     EXPECT_PUNCT(';');
-    return make_return(parser->ret, expr);
+    return make_return(parser, parser->ret, expr);
 }
 
 /* block-item:
@@ -1504,18 +1619,14 @@ static node_t *parse_block_item(parser_t *parser)
  */
 static node_t *parse_compound_stmt(parser_t *parser)
 {
-    vector_t *stmts = make_vector();
+    uint32_t stmts = list_begin(parser);
 
     for (;;) {
         if (TRY_PUNCT('}'))
             break;
-        vector_append(stmts, parse_block_item(parser));
+        list_push(parser, parse_block_item(parser));
     }
-    if (!vector_len(stmts)) {
-        free_vector(stmts, NULL);
-        stmts = NULL;
-    }
-    return make_compound_stmt(stmts);
+    return make_compound_stmt(parser, list_end(parser, stmts));
 }
 
 /* statement:
@@ -1533,13 +1644,11 @@ static node_t *parse_stmt(parser_t *parser)
 
     if (token->type == TK_KEYWORD || token->type == TK_PUNCT)
         switch (token->ival) {
-        case '{': {
-            dict_t *env = parser->env;
-            parser->env = make_dict(env);
+        case '{':
+            scope_enter(parser->env);
             stmt = parse_compound_stmt(parser);
-            parser->env = env;
+            scope_exit(parser->env);
             return stmt;
-        }
         case KW_FOR:
             return parse_for_stmt(parser);
         case KW_DO:
@@ -1569,86 +1678,176 @@ static node_t *parse_stmt(parser_t *parser)
  */
 static node_t *parse_func_def(parser_t *parser)
 {
-    dict_t *env;
-    node_t *func;
+    node_t *func, *body;
     ctype_t *ctype;
     size_t i;
 
-    env = parser->env;
-    parser->env = make_dict(env);
     ctype = parse_decl_spec(parser);
     func = parse_declarator(parser, ctype);
     if (func->type != NODE_FUNC_DECL)
         errorf("expected function definition in %s:%d\n", _FILE_, _LINE_);
-    if (!dict_insert(env, func->func_name, func, true))
+    if (!INSERT(func->func_name, func))
         errorf("redefinition of function \'%s\' in %s:%d\n", func->func_name, _FILE_, _LINE_);
     func->type = NODE_FUNC_DEF;
     parser->ret = func->ctype->ret;
-    for (i = 0; i < vector_len(func->params); i++) {
-        node_t *param = vector_get(func->params, i);
+    scope_enter(parser->env);
+    for (i = 0; i < func->params.len; i++) {
+        node_t *param = KID(func->params, i);
         /* TODO: pointer to func as param */
-        if (!dict_insert(parser->env, param->varname, param, true))
+        if (!INSERT(param->varname, param))
             errorf("redefinition of parameter \'%s\' in %s:%d\n", param->varname, _FILE_, _LINE_);
     }
     EXPECT_PUNCT('{');
-    func->func_body = parse_compound_stmt(parser);
-    parser->env = env;
+    body = parse_compound_stmt(parser);
+    func->func_body = ID(body);
+    scope_exit(parser->env);
     parser->ret = NULL;
     return func;
 }
 
+/* The previous definition has been emitted, only its own node is still
+ * referenced from the symbol table.  It is the first node of the
+ * definition, everything allocated after it is reused.
+ */
+static void release_def(parser_t *parser)
+{
+    node_t *def = parser->def;
+
+    def->params = (node_list_t){0, 0};
+    def->func_body = 0;
+    parser->ast.nnodes = def->id + 1;
+    parser->ast.nkids = 0;
+    parser->def = NULL;
+}
+
+/* Like release_def for a run of definitions.  Their own nodes are moved
+ * next to each other at the place of the first one and rebound in the
+ * symbol table, everything after them is reused.
+ */
+void release_defs(parser_t *parser, node_t **defs, size_t n)
+{
+    ast_t *ast = &parser->ast;
+    node_id first;
+    node_t *node;
+    size_t i;
+
+    assert(parser && parser->keep);
+    if (n == 0)
+        return;
+    first = defs[0]->id;
+    /* ids only grow, so a slot is overwritten after its node has moved */
+    for (i = 0; i < n; i++) {
+        node = AST_NODE(ast, first + i);
+        if (node != defs[i]) {
+            *node = *defs[i];
+            node->id = first + i;
+            scope_replace(parser->env, node->func_name, node);
+        }
+        node->params = (node_list_t){0, 0};
+        node->func_body = 0;
+    }
+    ast->nnodes = first + n;
+    ast->nkids = 0;
+    parser->def = NULL;
+}
+
 node_t *get_node(parser_t *parser)
 {
+    /* no token of the previous definition is referenced any more */
+    release_tokens(parser->lexer);
+    if (parser->def && !parser->keep)
+        release_def(parser);
     if (!PEEK())
         return NULL;
     /* TODO: global variable */
-    return parse_func_def(parser);
+    parser->def = parse_func_def(parser);
+    return parser->def;
 }
 
-static node_t *make_puts(void)
+static node_t *make_puts(parser_t *parser)
 {
     node_t *func_puts;
+    vector_t *param_types;
 
     NEW_NODE(func_puts, NODE_FUNC_DEF);
-    func_puts->ctype = make_ptr(NULL);
-    func_puts->ctype->ret = ctype_int;
-    func_puts->ctype->is_va = false;
-    func_puts->ctype->param_types = make_vector();
-    vector_append(func_puts->ctype->param_types, make_ptr(ctype_char));
-    func_puts->func_name = "puts";
-    func_puts->params = NULL;
-    func_puts->func_body = NULL;
+    param_types = parser->param_types;
+    param_types->top = 0;
+    vector_append(param_types, make_ptr(parser, ctype_char));
+    func_puts->ctype = make_func(parser, ctype_int, param_types, false);
+    func_puts->func_name = intern(&parser->lexer->interns, "puts", 4);
     return func_puts;
 }
 
-static node_t *make_printf(void)
+static node_t *make_printf(parser_t *parser)
 {
     node_t *func_printf;
+    vector_t *param_types;
 
     NEW_NODE(func_printf, NODE_FUNC_DEF);
-    func_printf->ctype = make_ptr(NULL);
-    func_printf->ctype->ret = ctype_int;
-    func_printf->ctype->is_va = true;
-    func_printf->ctype->param_types = make_vector();
-    vector_append(func_printf->ctype->param_types, make_ptr(ctype_char));
-    func_printf->func_name = "printf";
-    func_printf->params = NULL;
-    func_printf->func_body = NULL;
+    param_types = parser->param_types;
+    param_types->top = 0;
+    vector_append(param_types, make_ptr(parser, ctype_char));
+    func_printf->ctype = make_func(parser, ctype_int, param_types, true);
+    func_printf->func_name = intern(&parser->lexer->interns, "printf", 6);
     return func_printf;
 }
 
-static void builtin_init(dict_t *env)
+static void builtin_init(parser_t *parser)
 {
-    dict_insert(env, "puts", make_puts(), true);
-    dict_insert(env, "printf", make_printf(), true);
+    node_t *func;
+
+    func = make_puts(parser);
+    INSERT(func->func_name, func);
+    func = make_printf(parser);
+    INSERT(func->func_name, func);
 }
 
 void parser_init(parser_t *parser, lexer_t *lexer)
 {
     assert(parser && lexer);
     parser->lexer = lexer;
-    parser->env = make_dict(NULL);
+    /* the AST lives as long as the source buffer it points into */
+    parser->arena = lexer->arena;
+    parser->types_arena = make_arena();
+    parser->param_types = make_vector();
+    parser->env = make_scope();
     parser->ret = NULL;
+    parser->def = NULL;
+    parser->keep = false;
+    parser->types = NULL;
+    parser->ntypes = parser->types_size = 0;
+    memset(&parser->ast, 0, sizeof(parser->ast));
+    /* reserve the null node */
+    ast_new_node(parser);
 
-    builtin_init(parser->env);
+    builtin_init(parser);
+}
+
+void parser_close(parser_t *parser)
+{
+    ast_t *ast = &parser->ast;
+
+    free(ast->blocks);
+    free(ast->kids);
+    free(ast->scratch);
+    free(parser->types);
+    free_arena(parser->types_arena);
+    free_vector(parser->param_types, NULL);
+    free_scope(parser->env);
+}
+
+void parser_reset(parser_t *parser)
+{
+    ast_t *ast = &parser->ast;
+
+    assert(parser);
+    /* the nodes were in the arena of the lexer */
+    ast->nblocks = ast->nnodes = 0;
+    ast->nkids = ast->nscratch = 0;
+    scope_reset(parser->env);
+    parser->ret = NULL;
+    parser->def = NULL;
+    parser->keep = false;
+    ast_new_node(parser);
+    builtin_init(parser);
 }
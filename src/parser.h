@@ -2,9 +2,11 @@
 #define PARSER_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "lexer.h"
 #include "vector.h"
-#include "dict.h"
+#include "scope.h"
+#include "arena.h"
 
 enum {
     CTYPE_VOID,
@@ -55,8 +57,20 @@ enum {
     NODE_ARITH_CONV
 };
 
+/* Nodes refer to each other by their index in the node pool of ast_t,
+ * 0 is the null node.
+ */
+typedef uint32_t node_id;
+
+/* a run of children stored contiguously in ast_t.kids */
+typedef struct node_list_t {
+    uint32_t start;
+    uint32_t len;
+} node_list_t;
+
 typedef struct node_t {
     int type;
+    node_id id;
     ctype_t *ctype;
     union {
         /* int, char */
@@ -68,7 +82,8 @@ typedef struct node_t {
         };
         /* string */
         struct {
-            char *sval;
+            const char *sval;
+            size_t slen;
             char *slabel;
         };
         /* variable */
@@ -83,19 +98,19 @@ typedef struct node_t {
         };
         /* array init */
         struct {
-            struct node_t *array;
-            vector_t *array_init;
+            node_id array;
+            node_list_t array_init;
         };
         /* unary or postfix++ -- */
         struct {
             int unary_op;
-            struct node_t *operand;
+            node_id operand;
         };
         /* binary operator */
         struct {
             int binary_op;
-            struct node_t *left;
-            struct node_t *right;
+            node_id left;
+            node_id right;
         };
         /* function */
         struct {
@@ -103,43 +118,82 @@ typedef struct node_t {
             /* save parameters for env when function declaration
              * save args when functions call
              */
-            vector_t *params;
+            node_list_t params;
             union {
-                struct node_t *func_body;
+                node_id func_body;
                 bool is_va;
             };
         };
         /* if or ternary ? : */
         struct {
-            struct node_t *cond;
-            struct node_t *then;
-            struct node_t *els;
+            node_id cond;
+            node_id then;
+            node_id els;
         };
         /* for */
         struct {
-            struct node_t *for_init;
-            struct node_t *for_cond;
-            struct node_t *for_step;
-            struct node_t *for_body;
+            node_id for_init;
+            node_id for_cond;
+            node_id for_step;
+            node_id for_body;
         };
         /* while/do while */
         struct {
-            struct node_t *while_cond;
-            struct node_t *while_body;
+            node_id while_cond;
+            node_id while_body;
         };
         /* compound statements */
-        vector_t *stmts;
+        node_list_t stmts;
         /* return/cast/conv */
-        struct node_t *expr;
+        node_id expr;
     };
 } node_t;
 
+#define NODE_BLOCK_BITS 8
+#define NODE_BLOCK_SIZE (1 << NODE_BLOCK_BITS)
+
+typedef struct ast_t {
+    /* node pool, blocks are never moved so node_t pointers stay valid */
+    node_t **blocks;
+    uint32_t nblocks;
+    uint32_t nnodes;
+    /* child lists */
+    node_id *kids;
+    uint32_t nkids;
+    uint32_t kids_size;
+    /* children of the lists being parsed, see list_end */
+    node_id *scratch;
+    uint32_t nscratch;
+    uint32_t scratch_size;
+} ast_t;
+
+#define AST_NODE(ast, id) \
+    ((id) ? &(ast)->blocks[(id) >> NODE_BLOCK_BITS][(id) & (NODE_BLOCK_SIZE - 1)] : NULL)
+#define AST_KID(ast, list, i) AST_NODE(ast, (ast)->kids[(list).start + (i)])
+
 typedef struct parser_t {
     lexer_t *lexer;
-    /* current env */
-    dict_t *env;
+    /* nodes and vectors */
+    arena_t *arena;
+    /* types, they outlive the file for parser_reset */
+    arena_t *types_arena;
+    ast_t ast;
+    /* canonical types, open addressing */
+    ctype_t **types;
+    size_t ntypes;
+    size_t types_size;
+    /* symbols of all open scopes */
+    scope_t *env;
     /* current func return type for parse_return_stmt */
     ctype_t *ret;
+    /* parameter types of a declarator, intern_type copies them */
+    vector_t *param_types;
+    /* last definition returned by get_node */
+    node_t *def;
+    /* keep every definition instead of reusing its nodes for the next,
+     * until they are given back by release_defs
+     */
+    bool keep;
 } parser_t;
 
 extern ctype_t *ctype_void;
@@ -152,6 +206,16 @@ bool is_ptr(ctype_t *ctype);
 bool is_array(ctype_t *ctype);
 
 void parser_init(parser_t *parser, lexer_t *lexer);
+/* parse the file lexer was reset to, keeping the types of the last */
+void parser_reset(parser_t *parser);
+void parser_close(parser_t *parser);
+/* The definition is valid until the next call unless keep is set, its
+ * subtree is reused then
+ */
 node_t *get_node(parser_t *parser);
+/* defs, the definitions got since keep was set, are done with, their
+ * subtrees are reused.  Only the node of each stays, it may move.
+ */
+void release_defs(parser_t *parser, node_t **defs, size_t n);
 
 #endif
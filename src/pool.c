@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "pool.h"
+#include "util.h"
+
+#define DEQUE_INIT_SIZE 64
+
+/* index of the running thread in the pool, the thread that made it is 0 */
+static __thread int self;
+
+typedef struct worker_arg_t {
+    pool_t *pool;
+    int id;
+} worker_arg_t;
+
+static void push(deque_t *deque, task_t *tasks, size_t n)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail + n > deque->size) {
+        /* reuse what thieves have taken before growing */
+        memmove(deque->tasks, deque->tasks + deque->head, sizeof(task_t) * (deque->tail - deque->head));
+        deque->tail -= deque->head;
+        deque->head = 0;
+        while (deque->tail + n > deque->size)
+            deque->size = deque->size ? deque->size * 2 : DEQUE_INIT_SIZE;
+        deque->tasks = realloc(deque->tasks, sizeof(task_t) * deque->size);
+    }
+    memcpy(deque->tasks + deque->tail, tasks, sizeof(task_t) * n);
+    deque->tail += n;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+/* the newest task of the owner or the oldest one for a thief */
+static bool take(deque_t *deque, bool steal, task_t *task)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) {
+        *task = steal ? deque->tasks[deque->head++] : deque->tasks[--deque->tail];
+        if (deque->head == deque->tail)
+            deque->head = deque->tail = 0;
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/* run a task of our own deque or one stolen from another */
+static bool run_one(pool_t *pool)
+{
+    task_t task;
+    int i;
+
+    if (!take(&pool->deques[self], false, &task)) {
+        for (i = 1; i < pool->nworkers; i++)
+            if (take(&pool->deques[(self + i) % pool->nworkers], true, &task))
+                break;
+        if (i == pool->nworkers)
+            return false;
+    }
+    __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    task.fn(task.arg, task.i);
+    if (__atomic_sub_fetch(task.pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return true;
+}
+
+static void *worker(void *p)
+{
+    worker_arg_t *arg = p;
+    pool_t *pool = arg->pool;
+
+    self = arg->id;
+    free(arg);
+    for (;;) {
+        if (run_one(pool))
+            continue;
+        pthread_mutex_lock(&pool->lock);
+        while (!__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) && !pool->stop)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+pool_t *make_pool(int nworkers)
+{
+    pool_t *pool = malloc(sizeof(pool_t));
+    worker_arg_t *arg;
+    int i;
+
+    assert(nworkers > 0);
+    pool->nworkers = nworkers;
+    pool->deques = calloc(nworkers, sizeof(deque_t));
+    pool->threads = malloc(sizeof(pthread_t) * nworkers);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pool->queued = 0;
+    pool->stop = false;
+    for (i = 0; i < nworkers; i++)
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    for (i = 1; i < nworkers; i++) {
+        arg = malloc(sizeof(worker_arg_t));
+        arg->pool = pool;
+        arg->id = i;
+        if (pthread_create(&pool->threads[i], NULL, worker, arg))
+            errorf("Can't create thread\n");
+    }
+    return pool;
+}
+
+void pool_for(pool_t *pool, size_t n, void (*fn)(void *arg, size_t i), void *arg)
+{
+    task_t *tasks;
+    size_t i, pending = n;
+
+    if (n == 0)
+        return;
+    tasks = malloc(sizeof(task_t) * n);
+    /* the last one is popped first, the first ones are stolen first */
+    for (i = 0; i < n; i++)
+        tasks[i] = (task_t){fn, arg, n - 1 - i, &pending};
+    /* counted first, a thief decrements it as soon as the tasks are seen */
+    __atomic_add_fetch(&pool->queued, n, __ATOMIC_SEQ_CST);
+    push(&pool->deques[self], tasks, n);
+    free(tasks);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    while (__atomic_load_n(&pending, __ATOMIC_SEQ_CST)) {
+        if (run_one(pool))
+            continue;
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pending, __ATOMIC_SEQ_CST)
+                && !__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST))
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void free_pool(pool_t *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 1; i < pool->nworkers; i++)
+        pthread_join(pool->threads[i], NULL);
+    for (i = 0; i < pool->nworkers; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,45 @@
+#ifndef POOL_H__
+#define POOL_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef struct task_t {
+    void (*fn)(void *arg, size_t i);
+    void *arg;
+    size_t i;
+    /* tasks of the same pool_for not finished yet */
+    size_t *pending;
+} task_t;
+
+/* tasks[head..tail), the owner pushes and pops at tail, thieves take head */
+typedef struct deque_t {
+    pthread_mutex_t lock;
+    task_t *tasks;
+    size_t head;
+    size_t tail;
+    size_t size;
+} deque_t;
+
+/* Work-stealing thread pool.  Worker 0 is the thread that made the pool,
+ * a thread waiting in pool_for runs tasks meanwhile, so tasks may call
+ * pool_for themselves.
+ */
+typedef struct pool_t {
+    int nworkers;
+    deque_t *deques;
+    pthread_t *threads;
+    /* idle workers sleep on wake until a task is queued or stop is set */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    size_t queued;
+    bool stop;
+} pool_t;
+
+pool_t *make_pool(int nworkers);
+/* run fn(arg, i) for i in [0, n) on the pool, return when all are done */
+void pool_for(pool_t *pool, size_t n, void (*fn)(void *arg, size_t i), void *arg);
+void free_pool(pool_t *pool);
+
+#endif
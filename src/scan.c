@@ -0,0 +1,89 @@
+#include "scan.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define IS_SPACE(c) ((c) == ' ' || (unsigned char) ((c) - '\t') <= '\r' - '\t')
+#define IS_DIGIT(c) ((unsigned char) ((c) - '0') <= 9)
+#define IS_ALPHA(c) ((unsigned char) (((c) | 0x20) - 'a') <= 'z' - 'a')
+#define IS_IDENT(c) (IS_ALPHA(c) || IS_DIGIT(c) || (c) == '_')
+#define IS_STRING(c) ((c) != '\"' && (c) != '\\')
+
+#ifdef __SSE2__
+/* The classes are tested 16 bytes at a time. Unsigned x - lo <= hi - lo is
+ * computed as min(x - lo, hi - lo) == x - lo, SSE2 has no unsigned compare.
+ */
+#define SPLAT(c) _mm_set1_epi8((char) (c))
+#define IN_RANGE(x, lo, hi) \
+    _mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(x, SPLAT(lo)), SPLAT((hi) - (lo))), \
+            _mm_sub_epi8(x, SPLAT(lo)))
+
+static inline __m128i match_space(__m128i x)
+{
+    return _mm_or_si128(_mm_cmpeq_epi8(x, SPLAT(' ')), IN_RANGE(x, '\t', '\r'));
+}
+
+static inline __m128i match_digit(__m128i x)
+{
+    return IN_RANGE(x, '0', '9');
+}
+
+static inline __m128i match_ident(__m128i x)
+{
+    __m128i alpha = IN_RANGE(_mm_or_si128(x, SPLAT(0x20)), 'a', 'z');
+    return _mm_or_si128(_mm_or_si128(alpha, match_digit(x)), _mm_cmpeq_epi8(x, SPLAT('_')));
+}
+
+static inline __m128i match_string(__m128i x)
+{
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(x, SPLAT('\"')), _mm_cmpeq_epi8(x, SPLAT('\\')));
+    return _mm_xor_si128(special, SPLAT(0xff));
+}
+
+/* Return the first mismatch of the whole 16-byte blocks, the scalar loop
+ * after it handles the tail.
+ */
+#define SCAN_BLOCKS(p, end, match) \
+    do { \
+        for (; (end) - (p) >= 16; (p) += 16) { \
+            int mask = _mm_movemask_epi8(match(_mm_loadu_si128((const __m128i *) (p)))); \
+            if (mask != 0xffff) \
+                return (p) + __builtin_ctz(~mask); \
+        } \
+    } while (0)
+#else
+#define SCAN_BLOCKS(p, end, match)
+#endif
+
+const char *scan_space(const char *p, const char *end)
+{
+    SCAN_BLOCKS(p, end, match_space);
+    for (; p < end && IS_SPACE(*p); p++)
+        ;
+    return p;
+}
+
+const char *scan_ident(const char *p, const char *end)
+{
+    SCAN_BLOCKS(p, end, match_ident);
+    for (; p < end && IS_IDENT(*p); p++)
+        ;
+    return p;
+}
+
+const char *scan_digit(const char *p, const char *end)
+{
+    SCAN_BLOCKS(p, end, match_digit);
+    for (; p < end && IS_DIGIT(*p); p++)
+        ;
+    return p;
+}
+
+const char *scan_string(const char *p, const char *end)
+{
+    SCAN_BLOCKS(p, end, match_string);
+    for (; p < end && IS_STRING(*p); p++)
+        ;
+    return p;
+}
@@ -0,0 +1,17 @@
+#ifndef SCAN_H__
+#define SCAN_H__
+
+/* Each function returns the first position in [p, end) whose byte does not
+ * belong to the class, or end.
+ */
+
+/* ' ', '\t', '\n', '\v', '\f', '\r' */
+const char *scan_space(const char *p, const char *end);
+/* [0-9A-Za-z_] */
+const char *scan_ident(const char *p, const char *end);
+/* [0-9] */
+const char *scan_digit(const char *p, const char *end);
+/* anything but '"' and '\\' */
+const char *scan_string(const char *p, const char *end);
+
+#endif
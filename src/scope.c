@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <assert.h>
+#include "scope.h"
+#include "intern.h"
+
+#define NO_BINDING ((size_t) -1)
+#define SCOPE_INIT_SIZE 16
+
+scope_t *make_scope(void)
+{
+    scope_t *scope = malloc(sizeof(*scope));
+    scope->names = make_dict(NULL);
+    scope->log = NULL;
+    scope->nlog = scope->log_size = 0;
+    scope->marks = NULL;
+    scope->depth = scope->marks_size = 0;
+    return scope;
+}
+
+void scope_enter(scope_t *scope)
+{
+    assert(scope);
+    if (scope->depth == scope->marks_size) {
+        scope->marks_size = scope->marks_size ? scope->marks_size * 2 : SCOPE_INIT_SIZE;
+        scope->marks = realloc(scope->marks, sizeof(size_t) * scope->marks_size);
+    }
+    scope->marks[scope->depth++] = scope->nlog;
+}
+
+void scope_exit(scope_t *scope)
+{
+    size_t mark;
+    binding_t *b;
+
+    assert(scope && scope->depth > 0);
+    mark = scope->marks[--scope->depth];
+    while (scope->nlog > mark) {
+        b = &scope->log[--scope->nlog];
+        b->sym->top = b->shadowed;
+    }
+}
+
+void *scope_lookup(scope_t *scope, const char *name)
+{
+    symbol_t *sym;
+
+    assert(scope && name);
+    sym = dict_lookup_hash(scope->names, name, intern_hash(name));
+    if (!sym || sym->top == NO_BINDING)
+        return NULL;
+    return scope->log[sym->top].val;
+}
+
+bool scope_insert(scope_t *scope, char *name, void *val)
+{
+    symbol_t *sym;
+    binding_t *b;
+    size_t h;
+
+    assert(scope && name);
+    h = intern_hash(name);
+    sym = dict_lookup_hash(scope->names, name, h);
+    if (!sym) {
+        sym = malloc(sizeof(*sym));
+        sym->top = NO_BINDING;
+        dict_insert_hash(scope->names, name, h, sym, false);
+    } else if (sym->top != NO_BINDING
+            && (scope->depth == 0 || sym->top >= scope->marks[scope->depth - 1]))
+        return false;
+
+    if (scope->nlog == scope->log_size) {
+        scope->log_size = scope->log_size ? scope->log_size * 2 : SCOPE_INIT_SIZE;
+        scope->log = realloc(scope->log, sizeof(binding_t) * scope->log_size);
+    }
+    b = &scope->log[scope->nlog];
+    b->sym = sym;
+    b->val = val;
+    b->shadowed = sym->top;
+    sym->top = scope->nlog++;
+    return true;
+}
+
+void scope_replace(scope_t *scope, const char *name, void *val)
+{
+    symbol_t *sym;
+
+    assert(scope && name);
+    sym = dict_lookup_hash(scope->names, name, intern_hash(name));
+    assert(sym && sym->top != NO_BINDING);
+    scope->log[sym->top].val = val;
+}
+
+void scope_reset(scope_t *scope)
+{
+    assert(scope);
+    while (scope->nlog > 0)
+        scope->log[--scope->nlog].sym->top = NO_BINDING;
+    scope->depth = 0;
+}
+
+void free_scope(scope_t *scope)
+{
+    assert(scope);
+    free_dict(scope->names, NULL, free);
+    free(scope->log);
+    free(scope->marks);
+    free(scope);
+}
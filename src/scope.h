@@ -0,0 +1,49 @@
+#ifndef SCOPE_H__
+#define SCOPE_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "dict.h"
+
+/* Flat symbol table: one hash table maps each name to the stack of its
+ * bindings, and an undo log pops the bindings of a scope when it exits.
+ * Names must come from intern.
+ */
+typedef struct symbol_t {
+    /* innermost binding, index into the log */
+    size_t top;
+} symbol_t;
+
+typedef struct binding_t {
+    symbol_t *sym;
+    void *val;
+    /* binding of the same name this one hides */
+    size_t shadowed;
+} binding_t;
+
+typedef struct scope_t {
+    /* name -> symbol_t */
+    dict_t *names;
+    /* bindings of all open scopes, innermost last */
+    binding_t *log;
+    size_t nlog;
+    size_t log_size;
+    /* log length when each open scope was entered */
+    size_t *marks;
+    size_t depth;
+    size_t marks_size;
+} scope_t;
+
+scope_t *make_scope(void);
+void scope_enter(scope_t *scope);
+void scope_exit(scope_t *scope);
+void *scope_lookup(scope_t *scope, const char *name);
+/* fail if name is already bound in the innermost scope */
+bool scope_insert(scope_t *scope, char *name, void *val);
+/* bind name to val in place of its innermost binding */
+void scope_replace(scope_t *scope, const char *name, void *val);
+/* drop every binding, the names stay for the next file */
+void scope_reset(scope_t *scope);
+void free_scope(scope_t *scope);
+
+#endif
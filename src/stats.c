@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+#define CALIBRATE_ROUNDS 64
+#define TOP_FUNCS 10
+
+static const char *phase_names[PHASE_NUM] = {
+    "other", "lex", "parse", "codegen", "output"
+};
+
+static double clock_seconds(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define WALL() clock_seconds(CLOCK_MONOTONIC)
+/* of this thread, with -j each file is compiled on one */
+#define CPU() clock_seconds(CLOCK_THREAD_CPUTIME_ID)
+
+void stats_init(stats_t *stats, arena_t *arena)
+{
+    int i;
+    double start;
+
+    assert(stats);
+    *stats = (stats_t){0};
+    stats->arena = arena;
+    start = WALL();
+    for (i = 0; i < CALIBRATE_ROUNDS; i++)
+        CPU();
+    stats->overhead = (WALL() - start) / CALIBRATE_ROUNDS;
+    stats->phase = PHASE_NONE;
+    stats->wall = WALL();
+    stats->cpu = CPU();
+}
+
+int stats_switch(stats_t *stats, int phase)
+{
+    int prev = stats->phase;
+    double wall = WALL(), cpu = CPU();
+    phase_t *p = &stats->phases[prev];
+
+    /* the clocks of this switch are not part of the phase being left */
+    p->wall += wall - stats->wall > stats->overhead ? wall - stats->wall - stats->overhead : 0;
+    p->cpu += cpu - stats->cpu > stats->overhead ? cpu - stats->cpu - stats->overhead : 0;
+    if (stats->arena) {
+        p->nallocs += stats->arena->nallocs - stats->nallocs;
+        p->bytes += stats->arena->used - stats->bytes;
+        stats->nallocs = stats->arena->nallocs;
+        stats->bytes = stats->arena->used;
+    }
+    stats->phase = phase;
+    stats->nswitches++;
+    stats->wall = WALL();
+    stats->cpu = CPU();
+    return prev;
+}
+
+void stats_func(stats_t *stats, const char *name)
+{
+    assert(stats && stats->phase == PHASE_CODEGEN);
+    stats_add_func(stats, name, WALL() - stats->wall);
+}
+
+void stats_add_func(stats_t *stats, const char *name, double wall)
+{
+    func_time_t *f;
+
+    assert(stats);
+    if (stats->nfuncs == stats->funcs_size) {
+        stats->funcs_size = stats->funcs_size ? stats->funcs_size * 2 : 64;
+        stats->funcs = realloc(stats->funcs, sizeof(func_time_t) * stats->funcs_size);
+    }
+    f = &stats->funcs[stats->nfuncs++];
+    f->name = name;
+    f->wall = wall;
+}
+
+double stats_clock(void)
+{
+    return WALL();
+}
+
+static int cmp_func_time(const void *a, const void *b)
+{
+    const func_time_t *x = a, *y = b;
+
+    return (x->wall < y->wall) - (x->wall > y->wall);
+}
+
+void stats_time_report(FILE *fp, const char *fname, stats_t *stats)
+{
+    int i;
+    size_t n;
+    phase_t total = {0};
+
+    assert(fp && stats);
+    STATS_SWITCH(stats, PHASE_NONE);
+    fprintf(fp, "%s: execution times (seconds)\n", fname);
+    fprintf(fp, "  %-10s %12s %12s\n", "phase", "wall", "thread cpu");
+    for (i = PHASE_LEX; i < PHASE_NUM; i++) {
+        fprintf(fp, "  %-10s %12.6f %12.6f\n", phase_names[i],
+                stats->phases[i].wall, stats->phases[i].cpu);
+        total.wall += stats->phases[i].wall;
+        total.cpu += stats->phases[i].cpu;
+    }
+    fprintf(fp, "  %-10s %12.6f %12.6f\n", "total", total.wall, total.cpu);
+    fprintf(fp, "  %zu phase switches, %.0fns of timer overhead each taken off\n",
+            stats->nswitches, stats->overhead * 1e9);
+
+    qsort(stats->funcs, stats->nfuncs, sizeof(func_time_t), cmp_func_time);
+    n = stats->nfuncs < TOP_FUNCS ? stats->nfuncs : TOP_FUNCS;
+    if (n)
+        fprintf(fp, "%s: most expensive functions by codegen time\n", fname);
+    for (i = 0; i < (int) n; i++)
+        fprintf(fp, "  %12.6f  %s\n", stats->funcs[i].wall, stats->funcs[i].name);
+}
+
+void stats_mem_report(FILE *fp, const char *fname, stats_t *stats)
+{
+    int i;
+    struct rusage usage;
+
+    assert(fp && stats);
+    STATS_SWITCH(stats, PHASE_NONE);
+    fprintf(fp, "%s: arena allocations, heap buffers are only in peak rss\n", fname);
+    fprintf(fp, "  %-10s %12s %12s\n", "phase", "count", "bytes");
+    for (i = PHASE_LEX; i < PHASE_NUM; i++)
+        fprintf(fp, "  %-10s %12zu %12zu\n", phase_names[i],
+                stats->phases[i].nallocs, stats->phases[i].bytes);
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(fp, "  peak rss %ldKB\n", usage.ru_maxrss);
+}
+
+void stats_close(stats_t *stats)
+{
+    assert(stats);
+    free(stats->funcs);
+}
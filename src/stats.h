@@ -0,0 +1,70 @@
+#ifndef STATS_H__
+#define STATS_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include "arena.h"
+
+/* Phases of a compilation for -ftime-report/-fmem-report.  Lexing is
+ * pulled by the parser, so time spent in lex_token is taken out of parse.
+ * CPU time is that of the compiling thread.  Memory is counted in the
+ * arena only, the heap buffers of codegen and output (instructions,
+ * labels, object file sections) show up in the peak RSS alone.
+ */
+enum {
+    PHASE_NONE,
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_CODEGEN,
+    PHASE_OUTPUT,
+    PHASE_NUM
+};
+
+typedef struct phase_t {
+    double wall;
+    double cpu;
+    /* arena allocations */
+    size_t nallocs;
+    size_t bytes;
+} phase_t;
+
+typedef struct func_time_t {
+    const char *name;
+    double wall;
+} func_time_t;
+
+typedef struct stats_t {
+    phase_t phases[PHASE_NUM];
+    int phase;
+    /* clocks and arena counters when phase was entered */
+    double wall;
+    double cpu;
+    size_t nallocs;
+    size_t bytes;
+    arena_t *arena;
+    /* cost of reading both clocks, taken off every phase switch */
+    double overhead;
+    size_t nswitches;
+    /* codegen time of each definition */
+    func_time_t *funcs;
+    size_t nfuncs;
+    size_t funcs_size;
+} stats_t;
+
+/* only call into stats when a report was asked for */
+#define STATS_SWITCH(stats, phase) ((stats) ? stats_switch(stats, phase) : PHASE_NONE)
+
+void stats_init(stats_t *stats, arena_t *arena);
+/* account the time since the last switch to the current phase, return it */
+int stats_switch(stats_t *stats, int phase);
+/* record the time since entering PHASE_CODEGEN for function name */
+void stats_func(stats_t *stats, const char *name);
+/* record wall seconds of codegen for function name, timed by the caller */
+void stats_add_func(stats_t *stats, const char *name, double wall);
+/* wall clock in seconds */
+double stats_clock(void);
+void stats_time_report(FILE *fp, const char *fname, stats_t *stats);
+void stats_mem_report(FILE *fp, const char *fname, stats_t *stats);
+void stats_close(stats_t *stats);
+
+#endif
@@ -5,13 +5,20 @@
 #include "util.h"
 #include "buffer.h"
 
+__thread FILE *error_out;
+__thread jmp_buf *error_jmp;
+
 void _errorf(char *file, int line, const char *fmt, ...)
 {
     va_list ap;
-    fprintf(stderr, "%s:%d [ERROR]: ", file, line);
+    FILE *fp = error_jmp ? error_out : stderr;
+
+    fprintf(fp, "%s:%d [ERROR]: ", file, line);
     va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
+    vfprintf(fp, fmt, ap);
     va_end(ap);
+    if (error_jmp)
+        longjmp(*error_jmp, 1);
     exit(1);
 }
 
@@ -32,13 +39,14 @@ char *format(const char *fmt, ...)
     return s;
 }
 
-char *unescape(const char *str)
+char *unescape(const char *str, size_t len)
 {
     buffer_t *buf;
     char *s;
+    const char *end = str + len;
 
     buf = make_buffer();
-    for (; *str; str++) {
+    for (; str < end; str++) {
         switch (*str) {
         case '\"':
             buffer_push(buf, "\\\"", 2);
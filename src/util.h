@@ -1,10 +1,20 @@
 #ifndef UTIL_H__
 #define UTIL_H__
 
+#include <stdio.h>
+#include <stddef.h>
+#include <setjmp.h>
+
 #define errorf(fmt, ...) _errorf(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
 
-void _errorf(char *file, int line, const char *fmt, ...);
+/* A thread that takes errors back instead of exiting sets both, errorf
+ * then writes to error_out and jumps to error_jmp.
+ */
+extern __thread FILE *error_out;
+extern __thread jmp_buf *error_jmp;
+
+void _errorf(char *file, int line, const char *fmt, ...) __attribute__((noreturn));
 char *format(const char *fmt, ...);
-char *unescape(const char *str);
+char *unescape(const char *str, size_t len);
 
 #endif
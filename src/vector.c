@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "vector.h"
 
@@ -10,6 +11,18 @@ vector_t *make_vector(void)
     vec->item = malloc(sizeof(void *) * VECTOR_INIT_SIZE);
     vec->top = 0;
     vec->size = VECTOR_INIT_SIZE;
+    vec->arena = NULL;
+    return vec;
+}
+
+/* Storage is taken from the arena, growing leaves the old items behind */
+vector_t *make_arena_vector(arena_t *arena)
+{
+    vector_t *vec = arena_alloc(arena, sizeof(*vec));
+    vec->item = arena_alloc(arena, sizeof(void *) * VECTOR_INIT_SIZE);
+    vec->top = 0;
+    vec->size = VECTOR_INIT_SIZE;
+    vec->arena = arena;
     return vec;
 }
 
@@ -18,7 +31,12 @@ void vector_append(vector_t *vec, void *val)
     assert(vec);
     if (vec->top == vec->size) {
         vec->size += vec->size >> 1;
-        vec->item = realloc(vec->item, vec->size * sizeof(void *));
+        if (vec->arena) {
+            void **item = arena_alloc(vec->arena, vec->size * sizeof(void *));
+            memcpy(item, vec->item, vec->top * sizeof(void *));
+            vec->item = item;
+        } else
+            vec->item = realloc(vec->item, vec->size * sizeof(void *));
     }
     vec->item[vec->top++] = val;
 }
@@ -43,6 +61,8 @@ void free_vector(vector_t *vec, void (*free_item)(void *))
     if (free_item)
         for (i = 0; i < vector_len(vec); i++)
             (*free_item)(vec->item[i]);
+    if (vec->arena)
+        return;
     free(vec->item);
     free(vec);
 }
@@ -2,16 +2,20 @@
 #define VECTOR_H__
 
 #include <stddef.h>
+#include "arena.h"
 
 typedef struct vetcor_t {
     void **item;
     size_t top;
     size_t size;
+    /* NULL: heap vector */
+    arena_t *arena;
 } vector_t;
 
 #define vector_len(v) ((v) ? (v)->top : 0)
 
 vector_t *make_vector(void);
+vector_t *make_arena_vector(arena_t *arena);
 void vector_append(vector_t *v, void *val);
 void *vector_pop(vector_t *v);
 void *vector_get(vector_t *v, size_t idx);
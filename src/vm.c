@@ -0,0 +1,480 @@
+#define _GNU_SOURCE /* RTLD_DEFAULT */
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <dlfcn.h>
+#include "vm.h"
+#include "util.h"
+
+/* registers, bytes of memory frames and calls of all active functions */
+#define VM_REGS (1 << 20)
+#define VM_MEMORY (8 << 20)
+#define VM_CALLS (1 << 18)
+
+typedef struct vm_frame_t {
+    vm_inst_t *pc;
+    value_t *regs;
+    char *fp;
+} vm_frame_t;
+
+typedef long (*libc_func_t)(long, long, long, long, long, long, ...);
+
+/* Integer arguments go in the six general registers, float ones in
+ * %xmm0-7.  All of them are passed, %al is 8 for a variadic callee.
+ */
+static void call_libc(vm_func_t *f, vm_call_t *call, value_t *args)
+{
+    long x[6] = {0};
+    double d[8] = {0};
+    int i, nx = 0, nd = 0;
+    long ret;
+
+    for (i = 0; i < call->nargs; i++) {
+        /* a float is in the low bits, as movss leaves it */
+        if (call->fmask & (1u << i))
+            memcpy(&d[nd++], &args[i], sizeof(double));
+        else
+            x[nx++] = args[i].i;
+    }
+#define ARGS x[0], x[1], x[2], x[3], x[4], x[5], d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]
+    switch (call->ret) {
+    case VM_RET_FLOAT:
+        args[0].f = ((float (*)(long, long, long, long, long, long, ...)) f->addr)(ARGS);
+        return;
+    case VM_RET_DOUBLE:
+        args[0].d = ((double (*)(long, long, long, long, long, long, ...)) f->addr)(ARGS);
+        return;
+    }
+    ret = ((libc_func_t) f->addr)(ARGS);
+#undef ARGS
+    if (call->ret == VM_RET_INT)
+        args[0].i = (int) ret;
+    else if (call->ret == VM_RET_CHAR)
+        args[0].i = (signed char) ret;
+    else
+        args[0].i = ret;
+}
+
+/* resolve the functions that are not defined against the running libc */
+static void resolve(vm_t *vm)
+{
+    vm_inst_t *inst;
+    vm_func_t *f;
+    vm_call_t *call;
+    int i, nx;
+
+    for (inst = vm->code; inst < vm->code + vm->ncode; inst++) {
+        if (inst->op != VM_CALL)
+            continue;
+        f = &vm->funcs[inst->b];
+        if (f->defined)
+            continue;
+        if (!f->addr && !(f->addr = dlsym(RTLD_DEFAULT, f->name)))
+            errorf("undefined symbol %s\n", f->name);
+        call = &vm->calls[inst->c];
+        for (i = nx = 0; i < call->nargs; i++)
+            if (!(call->fmask & (1u << i)))
+                nx++;
+        if (nx > 6 || call->nargs - nx > 8)
+            errorf("too many arguments to function \'%s\'\n", f->name);
+        inst->op = VM_CALLC;
+    }
+}
+
+#define A (R[pc->a])
+#define B (R[pc->b])
+#define C (R[pc->c])
+
+/* direct threading: each handler jumps to the next one itself */
+#define DISPATCH() goto *pc->handler
+#define NEXT() \
+    do { \
+        pc++; \
+        DISPATCH(); \
+    } while (0)
+#define BRANCH(cond) \
+    do { \
+        pc += (cond) ? pc->c : 1; \
+        DISPATCH(); \
+    } while (0)
+
+#define LOAD(type, addr) \
+    do { \
+        type v; \
+        memcpy(&v, addr, sizeof(v)); \
+        A.i = v; \
+    } while (0)
+
+static int execute(vm_t *vm, vm_func_t *main)
+{
+    static const void *labels[VM_NOPS] = {
+        [VM_MOV] = &&op_mov, [VM_LI] = &&op_li, [VM_LK] = &&op_lk, [VM_LS] = &&op_ls,
+        [VM_LEA] = &&op_lea,
+        [VM_ADD] = &&op_add, [VM_SUB] = &&op_sub, [VM_MUL] = &&op_mul, [VM_DIV] = &&op_div,
+        [VM_MOD] = &&op_mod, [VM_SHL] = &&op_shl, [VM_SHR] = &&op_shr, [VM_AND] = &&op_and,
+        [VM_OR] = &&op_or, [VM_XOR] = &&op_xor, [VM_ADDI] = &&op_addi, [VM_MULI] = &&op_muli,
+        [VM_SARI] = &&op_sari,
+        [VM_NEG] = &&op_neg, [VM_NOT] = &&op_not, [VM_LNOT] = &&op_lnot, [VM_I2C] = &&op_i2c,
+        [VM_PADDI] = &&op_paddi, [VM_IDX1] = &&op_idx1, [VM_IDX4] = &&op_idx4,
+        [VM_IDX8] = &&op_idx8, [VM_PSUB] = &&op_psub,
+        [VM_FADD] = &&op_fadd, [VM_FSUB] = &&op_fsub, [VM_FMUL] = &&op_fmul,
+        [VM_FDIV] = &&op_fdiv, [VM_FNEG] = &&op_fneg,
+        [VM_DADD] = &&op_dadd, [VM_DSUB] = &&op_dsub, [VM_DMUL] = &&op_dmul,
+        [VM_DDIV] = &&op_ddiv, [VM_DNEG] = &&op_dneg,
+        [VM_I2F] = &&op_i2f, [VM_I2D] = &&op_i2d, [VM_F2I] = &&op_f2i, [VM_D2I] = &&op_d2i,
+        [VM_F2D] = &&op_f2d, [VM_D2F] = &&op_d2f,
+        [VM_EQ] = &&op_eq, [VM_NE] = &&op_ne, [VM_LT] = &&op_lt, [VM_LE] = &&op_le,
+        [VM_GT] = &&op_gt, [VM_GE] = &&op_ge,
+        [VM_FEQ] = &&op_feq, [VM_FNE] = &&op_fne, [VM_FLT] = &&op_flt, [VM_FLE] = &&op_fle,
+        [VM_FGT] = &&op_fgt, [VM_FGE] = &&op_fge,
+        [VM_DEQ] = &&op_deq, [VM_DNE] = &&op_dne, [VM_DLT] = &&op_dlt, [VM_DLE] = &&op_dle,
+        [VM_DGT] = &&op_dgt, [VM_DGE] = &&op_dge,
+        [VM_FTST] = &&op_ftst, [VM_DTST] = &&op_dtst,
+        [VM_LDB] = &&op_ldb, [VM_LDW] = &&op_ldw, [VM_LDQ] = &&op_ldq,
+        [VM_STB] = &&op_stb, [VM_STW] = &&op_stw, [VM_STQ] = &&op_stq,
+        [VM_LDLB] = &&op_ldlb, [VM_LDLW] = &&op_ldlw, [VM_LDLQ] = &&op_ldlq,
+        [VM_STLB] = &&op_stlb, [VM_STLW] = &&op_stlw, [VM_STLQ] = &&op_stlq,
+        [VM_LDXB] = &&op_ldxb, [VM_LDXW] = &&op_ldxw, [VM_LDXQ] = &&op_ldxq,
+        [VM_STXB] = &&op_stxb, [VM_STXW] = &&op_stxw, [VM_STXQ] = &&op_stxq,
+        [VM_JMP] = &&op_jmp, [VM_JZ] = &&op_jz, [VM_JNZ] = &&op_jnz,
+        [VM_JEQ] = &&op_jeq, [VM_JNE] = &&op_jne, [VM_JLT] = &&op_jlt, [VM_JLE] = &&op_jle,
+        [VM_JGT] = &&op_jgt, [VM_JGE] = &&op_jge,
+        [VM_CALL] = &&op_call, [VM_CALLC] = &&op_callc, [VM_RET] = &&op_ret
+    };
+    value_t *regs, *R, *consts = vm->consts;
+    char *memory, *fp, *data = vm->data->stack;
+    vm_frame_t *calls, *sp;
+    vm_inst_t *code = vm->code, *pc;
+    vm_func_t *f;
+    size_t i;
+    int status;
+
+    for (i = 0; i < vm->ncode; i++)
+        code[i].handler = labels[code[i].op];
+
+    R = regs = malloc(sizeof(value_t) * VM_REGS);
+    /* doubles in memory are 8 byte aligned, as on the native stack */
+    memory = aligned_alloc(16, VM_MEMORY);
+    sp = calls = malloc(sizeof(vm_frame_t) * VM_CALLS);
+    fp = memory + main->frame;
+    if (main->nregs > VM_REGS || main->frame > VM_MEMORY)
+        errorf("vm: stack overflow\n");
+    pc = code + main->start;
+    DISPATCH();
+
+op_mov:
+    A = B;
+    NEXT();
+op_li:
+    A.i = pc->c;
+    NEXT();
+op_lk:
+    A = consts[pc->c];
+    NEXT();
+op_ls:
+    A.p = data + pc->c;
+    NEXT();
+op_lea:
+    A.p = fp + pc->c;
+    NEXT();
+
+    /* ints wrap around at 32 bits */
+op_add:
+    A.i = (int) (B.i + C.i);
+    NEXT();
+op_sub:
+    A.i = (int) (B.i - C.i);
+    NEXT();
+op_mul:
+    A.i = (int) (B.i * C.i);
+    NEXT();
+op_div:
+    A.i = (int) B.i / (int) C.i;
+    NEXT();
+op_mod:
+    A.i = (int) B.i % (int) C.i;
+    NEXT();
+op_shl:
+    A.i = (int) ((unsigned) B.i << (C.i & 31));
+    NEXT();
+op_shr:
+    A.i = (int) B.i >> (C.i & 31);
+    NEXT();
+op_and:
+    A.i = B.i & C.i;
+    NEXT();
+op_or:
+    A.i = B.i | C.i;
+    NEXT();
+op_xor:
+    A.i = B.i ^ C.i;
+    NEXT();
+op_addi:
+    A.i = (int) (B.i + pc->c);
+    NEXT();
+op_muli:
+    A.i = (int) (B.i * pc->c);
+    NEXT();
+op_sari:
+    A.i = (int) (B.i >> pc->c);
+    NEXT();
+op_neg:
+    A.i = (int) -B.i;
+    NEXT();
+op_not:
+    A.i = ~B.i;
+    NEXT();
+op_lnot:
+    A.i = !B.i;
+    NEXT();
+op_i2c:
+    A.i = (signed char) B.i;
+    NEXT();
+
+op_paddi:
+    A.p = B.p + pc->c;
+    NEXT();
+op_idx1:
+    A.p = B.p + C.i;
+    NEXT();
+op_idx4:
+    A.p = B.p + C.i * 4;
+    NEXT();
+op_idx8:
+    A.p = B.p + C.i * 8;
+    NEXT();
+op_psub:
+    A.i = B.p - C.p;
+    NEXT();
+
+op_fadd:
+    A.f = B.f + C.f;
+    NEXT();
+op_fsub:
+    A.f = B.f - C.f;
+    NEXT();
+op_fmul:
+    A.f = B.f * C.f;
+    NEXT();
+op_fdiv:
+    A.f = B.f / C.f;
+    NEXT();
+op_fneg:
+    A.f = -B.f;
+    NEXT();
+op_dadd:
+    A.d = B.d + C.d;
+    NEXT();
+op_dsub:
+    A.d = B.d - C.d;
+    NEXT();
+op_dmul:
+    A.d = B.d * C.d;
+    NEXT();
+op_ddiv:
+    A.d = B.d / C.d;
+    NEXT();
+op_dneg:
+    A.d = -B.d;
+    NEXT();
+op_i2f:
+    A.f = (int) B.i;
+    NEXT();
+op_i2d:
+    A.d = (int) B.i;
+    NEXT();
+op_f2i:
+    A.i = (int) B.f;
+    NEXT();
+op_d2i:
+    A.i = (int) B.d;
+    NEXT();
+op_f2d:
+    A.d = B.f;
+    NEXT();
+op_d2f:
+    A.f = B.d;
+    NEXT();
+
+op_eq:
+    A.i = B.i == C.i;
+    NEXT();
+op_ne:
+    A.i = B.i != C.i;
+    NEXT();
+op_lt:
+    A.i = B.i < C.i;
+    NEXT();
+op_le:
+    A.i = B.i <= C.i;
+    NEXT();
+op_gt:
+    A.i = B.i > C.i;
+    NEXT();
+op_ge:
+    A.i = B.i >= C.i;
+    NEXT();
+op_feq:
+    A.i = B.f == C.f;
+    NEXT();
+op_fne:
+    A.i = B.f != C.f;
+    NEXT();
+op_flt:
+    A.i = B.f < C.f;
+    NEXT();
+op_fle:
+    A.i = B.f <= C.f;
+    NEXT();
+op_fgt:
+    A.i = B.f > C.f;
+    NEXT();
+op_fge:
+    A.i = B.f >= C.f;
+    NEXT();
+op_deq:
+    A.i = B.d == C.d;
+    NEXT();
+op_dne:
+    A.i = B.d != C.d;
+    NEXT();
+op_dlt:
+    A.i = B.d < C.d;
+    NEXT();
+op_dle:
+    A.i = B.d <= C.d;
+    NEXT();
+op_dgt:
+    A.i = B.d > C.d;
+    NEXT();
+op_dge:
+    A.i = B.d >= C.d;
+    NEXT();
+op_ftst:
+    A.i = B.f != 0;
+    NEXT();
+op_dtst:
+    A.i = B.d != 0;
+    NEXT();
+
+    /* a float is loaded as the int of its bits */
+op_ldb:
+    LOAD(signed char, B.p + pc->c);
+    NEXT();
+op_ldw:
+    LOAD(int, B.p + pc->c);
+    NEXT();
+op_ldq:
+    LOAD(long, B.p + pc->c);
+    NEXT();
+op_stb:
+    memcpy(A.p + pc->c, &B, 1);
+    NEXT();
+op_stw:
+    memcpy(A.p + pc->c, &B, 4);
+    NEXT();
+op_stq:
+    memcpy(A.p + pc->c, &B, 8);
+    NEXT();
+op_ldlb:
+    LOAD(signed char, fp + pc->c);
+    NEXT();
+op_ldlw:
+    LOAD(int, fp + pc->c);
+    NEXT();
+op_ldlq:
+    LOAD(long, fp + pc->c);
+    NEXT();
+op_stlb:
+    memcpy(fp + pc->c, &A, 1);
+    NEXT();
+op_stlw:
+    memcpy(fp + pc->c, &A, 4);
+    NEXT();
+op_stlq:
+    memcpy(fp + pc->c, &A, 8);
+    NEXT();
+op_ldxb:
+    LOAD(signed char, B.p + C.i);
+    NEXT();
+op_ldxw:
+    LOAD(int, B.p + C.i * 4);
+    NEXT();
+op_ldxq:
+    LOAD(long, B.p + C.i * 8);
+    NEXT();
+op_stxb:
+    memcpy(A.p + B.i, &C, 1);
+    NEXT();
+op_stxw:
+    memcpy(A.p + B.i * 4, &C, 4);
+    NEXT();
+op_stxq:
+    memcpy(A.p + B.i * 8, &C, 8);
+    NEXT();
+
+op_jmp:
+    BRANCH(1);
+op_jz:
+    BRANCH(!A.i);
+op_jnz:
+    BRANCH(A.i);
+op_jeq:
+    BRANCH(A.i == B.i);
+op_jne:
+    BRANCH(A.i != B.i);
+op_jlt:
+    BRANCH(A.i < B.i);
+op_jle:
+    BRANCH(A.i <= B.i);
+op_jgt:
+    BRANCH(A.i > B.i);
+op_jge:
+    BRANCH(A.i >= B.i);
+
+op_call:
+    f = &vm->funcs[pc->b];
+    if (sp == calls + VM_CALLS)
+        errorf("vm: stack overflow\n");
+    sp->pc = pc + 1;
+    sp->regs = R;
+    sp->fp = fp;
+    sp++;
+    R += pc->a;
+    fp += f->frame;
+    if (R + f->nregs > regs + VM_REGS || fp > memory + VM_MEMORY)
+        errorf("vm: stack overflow\n");
+    pc = code + f->start;
+    DISPATCH();
+op_callc:
+    call_libc(&vm->funcs[pc->b], &vm->calls[pc->c], &A);
+    NEXT();
+op_ret:
+    R[0] = A;
+    if (sp == calls) {
+        status = R[0].i;
+        goto done;
+    }
+    sp--;
+    pc = sp->pc;
+    R = sp->regs;
+    fp = sp->fp;
+    DISPATCH();
+
+done:
+    free(regs);
+    free(memory);
+    free(calls);
+    return status;
+}
+
+int vm_run(vm_t *vm)
+{
+    void *val;
+
+    assert(vm);
+    if (!(val = dict_lookup(vm->names, "main")) || !vm->funcs[(uintptr_t) val - 1].defined)
+        errorf("undefined symbol main\n");
+    resolve(vm);
+    return execute(vm, &vm->funcs[(uintptr_t) val - 1]);
+}
@@ -0,0 +1,235 @@
+#ifndef VM_H__
+#define VM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "parser.h"
+#include "buffer.h"
+#include "dict.h"
+
+/* a register or a constant */
+typedef union value_t {
+    /* int and char sign extended, pointer difference */
+    long i;
+    float f;
+    double d;
+    char *p;
+} value_t;
+
+/* R[x] is register x of the running function, fp its frame in memory */
+enum {
+    /* R[a] = R[b] */
+    VM_MOV,
+    /* R[a] = c */
+    VM_LI,
+    /* R[a] = consts[c] */
+    VM_LK,
+    /* R[a] = data + c */
+    VM_LS,
+    /* R[a] = fp + c */
+    VM_LEA,
+
+    /* int, R[a] = R[b] op R[c] */
+    VM_ADD,
+    VM_SUB,
+    VM_MUL,
+    VM_DIV,
+    VM_MOD,
+    VM_SHL,
+    VM_SHR,
+    VM_AND,
+    VM_OR,
+    VM_XOR,
+    /* int, R[a] = R[b] op c */
+    VM_ADDI,
+    VM_MULI,
+    VM_SARI,
+    /* int, R[a] = op R[b] */
+    VM_NEG,
+    VM_NOT,
+    VM_LNOT,
+    VM_I2C,
+
+    /* pointer, R[a] = R[b] + c, R[b] + R[c] * n and R[b] - R[c] */
+    VM_PADDI,
+    VM_IDX1,
+    VM_IDX4,
+    VM_IDX8,
+    VM_PSUB,
+
+    /* float and double, as int */
+    VM_FADD,
+    VM_FSUB,
+    VM_FMUL,
+    VM_FDIV,
+    VM_FNEG,
+    VM_DADD,
+    VM_DSUB,
+    VM_DMUL,
+    VM_DDIV,
+    VM_DNEG,
+    /* conversions, R[a] = R[b] */
+    VM_I2F,
+    VM_I2D,
+    VM_F2I,
+    VM_D2I,
+    VM_F2D,
+    VM_D2F,
+
+    /* R[a] = R[b] op R[c], int or pointer, float and double */
+    VM_EQ,
+    VM_NE,
+    VM_LT,
+    VM_LE,
+    VM_GT,
+    VM_GE,
+    VM_FEQ,
+    VM_FNE,
+    VM_FLT,
+    VM_FLE,
+    VM_FGT,
+    VM_FGE,
+    VM_DEQ,
+    VM_DNE,
+    VM_DLT,
+    VM_DLE,
+    VM_DGT,
+    VM_DGE,
+    /* R[a] = R[b] != 0 */
+    VM_FTST,
+    VM_DTST,
+
+    /* R[a] = *(R[b] + c) of 1, 4 or 8 bytes */
+    VM_LDB,
+    VM_LDW,
+    VM_LDQ,
+    /* *(R[a] + c) = R[b] */
+    VM_STB,
+    VM_STW,
+    VM_STQ,
+    /* R[a] = *(fp + c) */
+    VM_LDLB,
+    VM_LDLW,
+    VM_LDLQ,
+    /* *(fp + c) = R[a] */
+    VM_STLB,
+    VM_STLW,
+    VM_STLQ,
+    /* R[a] = R[b][R[c]], the element as big as the load */
+    VM_LDXB,
+    VM_LDXW,
+    VM_LDXQ,
+    /* R[a][R[b]] = R[c] */
+    VM_STXB,
+    VM_STXW,
+    VM_STXQ,
+
+    /* pc += c */
+    VM_JMP,
+    /* if R[a] == 0 or R[a] != 0, pc += c */
+    VM_JZ,
+    VM_JNZ,
+    /* if R[a] op R[b], pc += c, int or pointer */
+    VM_JEQ,
+    VM_JNE,
+    VM_JLT,
+    VM_JLE,
+    VM_JGT,
+    VM_JGE,
+
+    /* call funcs[b] with the arguments in R[a]..., the result is left in
+     * R[a], calls[c] describes the call
+     */
+    VM_CALL,
+    /* the same for a libc function, VM_CALL is turned into it by vm_run */
+    VM_CALLC,
+    /* return R[a] */
+    VM_RET,
+    VM_NOPS
+};
+
+typedef struct vm_inst_t {
+    union {
+        long op;
+        /* the label of op in the interpreter once the code is threaded */
+        const void *handler;
+    };
+    uint16_t a;
+    uint16_t b;
+    int32_t c;
+} vm_inst_t;
+
+typedef struct vm_func_t {
+    char *name;
+    bool defined;
+    /* the first instruction */
+    size_t start;
+    /* registers, including those of the arguments */
+    int nregs;
+    /* bytes of locals in memory below fp */
+    int frame;
+    /* libc function */
+    void *addr;
+} vm_func_t;
+
+enum {
+    VM_RET_INT,
+    VM_RET_CHAR,
+    VM_RET_PTR,
+    VM_RET_FLOAT,
+    VM_RET_DOUBLE
+};
+
+/* how to pass the arguments of a call to libc */
+typedef struct vm_call_t {
+    int nargs;
+    /* bit n is set if argument n is a float or double */
+    uint32_t fmask;
+    int ret;
+} vm_call_t;
+
+/* A program compiled to a register machine, run in the compiler itself.
+ * Each function has its own window of registers, the arguments of a
+ * call are placed at the start of the window of the callee.  Locals
+ * whose address is taken and arrays live in a memory frame laid out as
+ * the stack frame of the native code.
+ */
+typedef struct vm_t {
+    vm_inst_t *code;
+    size_t ncode;
+    size_t code_size;
+    value_t *consts;
+    size_t nconsts;
+    size_t consts_size;
+    /* string literals */
+    buffer_t *data;
+    /* index + 1 in funcs */
+    dict_t *names;
+    vm_func_t *funcs;
+    size_t nfuncs;
+    size_t funcs_size;
+    vm_call_t *calls;
+    size_t ncalls;
+    size_t calls_size;
+
+    /* scratch of vm_add */
+    ast_t *ast;
+    /* register + 1 or -offset in memory of each variable by node id */
+    int *loc;
+    size_t loc_size;
+    /* first free register */
+    int top;
+    int nregs;
+    /* bytes of memory in use, as offset of gen.c */
+    int offset;
+    int frame;
+} vm_t;
+
+void vm_init(vm_t *vm);
+/* compile a definition */
+void vm_add(vm_t *vm, ast_t *ast, node_t *node);
+/* call main, return what it returns */
+int vm_run(vm_t *vm);
+void vm_close(vm_t *vm);
+
+#endif
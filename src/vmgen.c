@@ -0,0 +1,1125 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+#include "vm.h"
+#include "util.h"
+
+#define VM_INIT_SIZE 64
+
+/* dict values are counts + 1, NULL is not found */
+#define TO_VAL(n) ((void *) (uintptr_t) ((n) + 1))
+#define FROM_VAL(v) ((size_t) (uintptr_t) (v) - 1)
+
+#define GROW(array, n, size) \
+    do { \
+        if ((n) == (size)) { \
+            (size) = (size) ? (size) * 2 : VM_INIT_SIZE; \
+            (array) = realloc(array, sizeof(*(array)) * (size)); \
+        } \
+    } while (0)
+
+#define NODE(id) AST_NODE(vm->ast, id)
+#define KID(list, i) AST_KID(vm->ast, list, i)
+
+/* memory operand of a load or store */
+typedef struct place_t {
+    int base;
+    int index;
+    int off;
+} place_t;
+
+/* the end of a list of jumps, chained through their c until patched */
+#define NO_JUMP (-1)
+/* vm->loc of a variable whose address is taken before it is placed */
+#define LOC_ADDRESSED INT_MIN
+
+static int expr(vm_t *vm, node_t *node, int dst);
+static void stmt(vm_t *vm, node_t *node);
+
+static bool is_float(ctype_t *ctype)
+{
+    return ctype == ctype_float || ctype == ctype_double;
+}
+
+static int align(int m, int n)
+{
+    int mod = m % n;
+    return mod == 0 ? m : m - mod + n;
+}
+
+void vm_init(vm_t *vm)
+{
+    assert(vm);
+    memset(vm, 0, sizeof(*vm));
+    vm->data = make_buffer();
+    vm->names = make_dict(NULL);
+}
+
+void vm_close(vm_t *vm)
+{
+    assert(vm);
+    free(vm->code);
+    free(vm->consts);
+    free_buffer(vm->data);
+    free_dict(vm->names, NULL, NULL);
+    free(vm->funcs);
+    free(vm->calls);
+    free(vm->loc);
+}
+
+static int emit(vm_t *vm, int op, int a, int b, long c)
+{
+    vm_inst_t *inst;
+
+    GROW(vm->code, vm->ncode, vm->code_size);
+    inst = &vm->code[vm->ncode];
+    inst->op = op;
+    inst->a = a;
+    inst->b = b;
+    inst->c = c;
+    return vm->ncode++;
+}
+
+static int new_reg(vm_t *vm)
+{
+    if (vm->top == UINT16_MAX)
+        errorf("too many registers in a function\n");
+    if (++vm->top > vm->nregs)
+        vm->nregs = vm->top;
+    return vm->top - 1;
+}
+
+/* dst, or a new register if it is -1 */
+static int target(vm_t *vm, int dst)
+{
+    return dst >= 0 ? dst : new_reg(vm);
+}
+
+/* the value in r, moved to dst if one is wanted */
+static int move(vm_t *vm, int r, int dst)
+{
+    if (dst < 0 || dst == r)
+        return r;
+    emit(vm, VM_MOV, dst, r, 0);
+    return dst;
+}
+
+static int konst(vm_t *vm, value_t v)
+{
+    GROW(vm->consts, vm->nconsts, vm->consts_size);
+    vm->consts[vm->nconsts] = v;
+    return vm->nconsts++;
+}
+
+static size_t func_index(vm_t *vm, char *name)
+{
+    vm_func_t *f;
+    void *val;
+
+    if ((val = dict_lookup(vm->names, name)))
+        return FROM_VAL(val);
+    GROW(vm->funcs, vm->nfuncs, vm->funcs_size);
+    f = &vm->funcs[vm->nfuncs];
+    memset(f, 0, sizeof(*f));
+    f->name = name;
+    dict_insert(vm->names, name, TO_VAL(vm->nfuncs), false);
+    return vm->nfuncs++;
+}
+
+/* jumps */
+
+static int jump(vm_t *vm, int op, int a, int b)
+{
+    return emit(vm, op, a, b, NO_JUMP);
+}
+
+static void patch(vm_t *vm, int list, int target)
+{
+    int next;
+
+    for (; list != NO_JUMP; list = next) {
+        next = vm->code[list].c;
+        vm->code[list].c = target - list;
+    }
+}
+
+#define patch_here(vm, list) patch(vm, list, (int) (vm)->ncode)
+
+static int concat(vm_t *vm, int l1, int l2)
+{
+    int j;
+
+    if (l1 == NO_JUMP)
+        return l2;
+    for (j = l1; vm->code[j].c != NO_JUMP; j = vm->code[j].c)
+        ;
+    vm->code[j].c = l2;
+    return l1;
+}
+
+/* VM_EQ ... VM_GE order */
+static int cmp_index(int op)
+{
+    switch (op) {
+    case PUNCT_EQ:
+        return 0;
+    case PUNCT_NE:
+        return 1;
+    case '<':
+        return 2;
+    case PUNCT_LE:
+        return 3;
+    case '>':
+        return 4;
+    case PUNCT_GE:
+        return 5;
+    }
+    return -1;
+}
+
+/* !(a op b) of ints */
+static int cmp_negate(int i)
+{
+    return i < 2 ? i ^ 1 : 7 - i;
+}
+
+static bool is_var(node_t *node)
+{
+    return node->type == NODE_VAR_DECL || node->type == NODE_VAR;
+}
+
+/* memory */
+
+/* the load or store from op of a value of ctype */
+static int mem_op(int op, ctype_t *ctype)
+{
+    switch (ctype->size) {
+    case 1:
+        return op;
+    case 4:
+        return op + 1;
+    default:
+        return op + 2;
+    }
+}
+
+/* R[a] = base + index * size */
+static int idx_op(ctype_t *ptr)
+{
+    switch (ptr->ptr->size) {
+    case 1:
+        return VM_IDX1;
+    case 4:
+        return VM_IDX4;
+    case 8:
+        return VM_IDX8;
+    }
+    errorf("invalid pointer arithmetic\n");
+    return -1;
+}
+
+/* ptr +- constant folded into an offset */
+static bool const_offset(vm_t *vm, node_t *node, int *off)
+{
+    node_t *right;
+
+    if (node->type != NODE_BINARY || (node->binary_op != '+' && node->binary_op != '-')
+            || !is_ptr(NODE(node->left)->ctype))
+        return false;
+    right = NODE(node->right);
+    if (right->type != NODE_CONSTANT || is_ptr(right->ctype) || labs(right->ival) >= (1 << 24))
+        return false;
+    *off = right->ival * NODE(node->left)->ctype->ptr->size;
+    if (node->binary_op == '-')
+        *off = -*off;
+    return true;
+}
+
+/* ptr + int with an element of 1, 4 or 8 bytes */
+static bool indexed(vm_t *vm, node_t *node)
+{
+    node_t *left;
+
+    if (node->type != NODE_BINARY || node->binary_op != '+')
+        return false;
+    left = NODE(node->left);
+    if (!is_ptr(left->ctype) || is_ptr(NODE(node->right)->ctype))
+        return false;
+    return left->ctype->ptr->size == 1 || left->ctype->ptr->size == 4
+        || left->ctype->ptr->size == 8;
+}
+
+/* The address ptr points to as base + index * size + off, base is -1 if
+ * it is in the frame and index -1 if there is none.
+ */
+static void address(vm_t *vm, node_t *ptr, place_t *m)
+{
+    int loc;
+
+    m->index = -1;
+    m->off = 0;
+    if (const_offset(vm, ptr, &m->off))
+        ptr = NODE(ptr->left);
+    /* an array parameter is a pointer in a register */
+    if (is_var(ptr) && is_array(ptr->ctype) && (loc = vm->loc[ptr->id]) < 0) {
+        m->base = -1;
+        m->off += loc;
+        return;
+    }
+    if (m->off == 0 && indexed(vm, ptr)) {
+        m->base = expr(vm, NODE(ptr->left), -1);
+        m->index = expr(vm, NODE(ptr->right), -1);
+        return;
+    }
+    m->base = expr(vm, ptr, -1);
+}
+
+static void load(vm_t *vm, int d, place_t *m, ctype_t *ctype)
+{
+    if (m->index >= 0)
+        emit(vm, mem_op(VM_LDXB, ctype), d, m->base, m->index);
+    else if (m->base < 0)
+        emit(vm, mem_op(VM_LDLB, ctype), d, 0, m->off);
+    else
+        emit(vm, mem_op(VM_LDB, ctype), d, m->base, m->off);
+}
+
+static void store(vm_t *vm, int r, place_t *m, ctype_t *ctype)
+{
+    if (m->index >= 0)
+        emit(vm, mem_op(VM_STXB, ctype), m->base, m->index, r);
+    else if (m->base < 0)
+        emit(vm, mem_op(VM_STLB, ctype), r, 0, m->off);
+    else
+        emit(vm, mem_op(VM_STB, ctype), m->base, r, m->off);
+}
+
+static void store_local(vm_t *vm, int r, int loc, ctype_t *ctype)
+{
+    store(vm, r, &(place_t){-1, -1, loc}, ctype);
+}
+
+/* variables */
+
+/* scalars live in registers unless their address is taken */
+static void declare(vm_t *vm, node_t *var)
+{
+    int loc = vm->loc[var->id];
+    int size;
+
+    assert(is_var(var));
+    /* a variable used as a statement */
+    if (loc != 0 && loc != LOC_ADDRESSED)
+        return;
+    if (!is_array(var->ctype) && loc != LOC_ADDRESSED) {
+        vm->loc[var->id] = new_reg(vm) + 1;
+        return;
+    }
+    size = var->ctype->size;
+    if (is_array(var->ctype))
+        vm->offset = align(vm->offset + var->ctype->ptr->size * var->ctype->len, size);
+    else
+        vm->offset = align(vm->offset + size, size);
+    if (vm->offset > vm->frame)
+        vm->frame = vm->offset;
+    vm->loc[var->id] = -vm->offset;
+}
+
+static int var(vm_t *vm, node_t *node, int dst)
+{
+    int loc = vm->loc[node->id];
+    int d;
+
+    assert(loc && loc != LOC_ADDRESSED);
+    if (loc > 0)
+        return move(vm, loc - 1, dst);
+    d = target(vm, dst);
+    if (is_array(node->ctype))
+        emit(vm, VM_LEA, d, 0, loc);
+    else
+        load(vm, d, &(place_t){-1, -1, loc}, node->ctype);
+    return d;
+}
+
+/* the register of an lvalue, or -1 and where it is in memory */
+static int lvalue(vm_t *vm, node_t *node, place_t *m)
+{
+    int loc;
+
+    if (is_var(node)) {
+        loc = vm->loc[node->id];
+        assert(loc && loc != LOC_ADDRESSED);
+        if (loc > 0)
+            return loc - 1;
+        *m = (place_t){-1, -1, loc};
+        return -1;
+    }
+    assert(node->type == NODE_UNARY && node->unary_op == '*');
+    address(vm, NODE(node->operand), m);
+    return -1;
+}
+
+/* conversions */
+
+static int convert(vm_t *vm, int r, ctype_t *from, ctype_t *to, int dst)
+{
+    int d;
+
+    if (from == to || !(is_float(from) || is_float(to) || to == ctype_char))
+        return move(vm, r, dst);
+    d = target(vm, dst);
+    if (from == ctype_float && to == ctype_double)
+        emit(vm, VM_F2D, d, r, 0);
+    else if (from == ctype_double && to == ctype_float)
+        emit(vm, VM_D2F, d, r, 0);
+    else if (is_float(to))
+        emit(vm, to == ctype_float ? VM_I2F : VM_I2D, d, r, 0);
+    else {
+        if (is_float(from)) {
+            emit(vm, from == ctype_float ? VM_F2I : VM_D2I, d, r, 0);
+            r = d;
+        }
+        if (to == ctype_char)
+            emit(vm, VM_I2C, d, r, 0);
+    }
+    return d;
+}
+
+/* expressions
+ *
+ * expr leaves the value in dst, or anywhere if dst is -1: a register of
+ * a variable or one above all registers in use, which stays in use.
+ */
+
+static int constant(vm_t *vm, node_t *node, int dst)
+{
+    value_t v;
+    int d = target(vm, dst);
+
+    if (!is_float(node->ctype) && node->ival >= INT32_MIN && node->ival <= INT32_MAX) {
+        emit(vm, VM_LI, d, 0, node->ival);
+        return d;
+    }
+    memset(&v, 0, sizeof(v));
+    if (node->ctype == ctype_float)
+        v.f = node->fval;
+    else if (node->ctype == ctype_double)
+        v.d = node->fval;
+    else
+        v.i = node->ival;
+    emit(vm, VM_LK, d, 0, konst(vm, v));
+    return d;
+}
+
+static int string(vm_t *vm, node_t *node, int dst)
+{
+    int d = target(vm, dst);
+
+    emit(vm, VM_LS, d, 0, vm->data->top);
+    buffer_push(vm->data, node->sval, node->slen);
+    buffer_push(vm->data, "", 1);
+    return d;
+}
+
+/* d = r +- 1 of ctype */
+static void step(vm_t *vm, int d, int r, ctype_t *ctype, int sign)
+{
+    value_t one;
+    int t;
+
+    if (is_ptr(ctype)) {
+        emit(vm, VM_PADDI, d, r, sign * ctype->ptr->size);
+    } else if (is_float(ctype)) {
+        memset(&one, 0, sizeof(one));
+        if (ctype == ctype_float)
+            one.f = 1;
+        else
+            one.d = 1;
+        t = new_reg(vm);
+        emit(vm, VM_LK, t, 0, konst(vm, one));
+        if (ctype == ctype_float)
+            emit(vm, sign > 0 ? VM_FADD : VM_FSUB, d, r, t);
+        else
+            emit(vm, sign > 0 ? VM_DADD : VM_DSUB, d, r, t);
+    } else {
+        emit(vm, VM_ADDI, d, r, sign);
+        if (ctype == ctype_char)
+            emit(vm, VM_I2C, d, d, 0);
+    }
+}
+
+/* ++ and --, the value before the step if post */
+static int inc_dec(vm_t *vm, node_t *node, bool post, int dst)
+{
+    node_t *lval = NODE(node->operand);
+    int sign = node->unary_op == PUNCT_INC ? 1 : -1;
+    int save = vm->top;
+    int r, d, old, val;
+    place_t m;
+
+    if ((r = lvalue(vm, lval, &m)) >= 0) {
+        if (!post) {
+            step(vm, r, r, lval->ctype, sign);
+            vm->top = save;
+            return move(vm, r, dst);
+        }
+        d = target(vm, dst);
+        emit(vm, VM_MOV, d, r, 0);
+        step(vm, r, r, lval->ctype, sign);
+        vm->top = d >= save ? d + 1 : save;
+        return d;
+    }
+    old = new_reg(vm);
+    load(vm, old, &m, lval->ctype);
+    val = post ? new_reg(vm) : old;
+    step(vm, val, old, lval->ctype, sign);
+    store(vm, val, &m, lval->ctype);
+    vm->top = save;
+    d = target(vm, dst);
+    return move(vm, post ? old : val, d);
+}
+
+static int unary(vm_t *vm, node_t *node, int dst)
+{
+    node_t *operand = NODE(node->operand);
+    ctype_t *ctype = operand->ctype;
+    int save = vm->top;
+    int r, d, loc;
+    place_t m;
+
+    switch (node->unary_op) {
+    case PUNCT_INC:
+    case PUNCT_DEC:
+        return inc_dec(vm, node, false, dst);
+
+    case '+':
+        return expr(vm, operand, dst);
+
+    case '&':
+        if (operand->type == NODE_UNARY && operand->unary_op == '*')
+            return expr(vm, NODE(operand->operand), dst);
+        if (!is_var(operand))
+            errorf("invalid operand of \'&\'\n");
+        if ((loc = vm->loc[operand->id]) > 0)
+            return move(vm, loc - 1, dst);
+        d = target(vm, dst);
+        emit(vm, VM_LEA, d, 0, loc);
+        return d;
+
+    case '*':
+        address(vm, operand, &m);
+        vm->top = save;
+        d = target(vm, dst);
+        load(vm, d, &m, node->ctype);
+        return d;
+    }
+
+    r = expr(vm, operand, -1);
+    if (node->unary_op == '!' && is_float(ctype)) {
+        d = new_reg(vm);
+        emit(vm, ctype == ctype_float ? VM_FTST : VM_DTST, d, r, 0);
+        r = d;
+    }
+    vm->top = save;
+    d = target(vm, dst);
+    switch (node->unary_op) {
+    case '-':
+        if (ctype == ctype_float)
+            emit(vm, VM_FNEG, d, r, 0);
+        else if (ctype == ctype_double)
+            emit(vm, VM_DNEG, d, r, 0);
+        else
+            emit(vm, VM_NEG, d, r, 0);
+        break;
+    case '~':
+        emit(vm, VM_NOT, d, r, 0);
+        break;
+    case '!':
+        emit(vm, VM_LNOT, d, r, 0);
+        break;
+
+    default:
+        errorf("invalid unary op %c\n", node->unary_op);
+    }
+    return d;
+}
+
+/* d = left op right */
+static int binary(vm_t *vm, int op, node_t *node, int dst)
+{
+    int save = vm->top;
+    int b, c, d;
+
+    b = expr(vm, NODE(node->left), -1);
+    c = expr(vm, NODE(node->right), -1);
+    vm->top = save;
+    d = target(vm, dst);
+    emit(vm, op, d, b, c);
+    return d;
+}
+
+static int ptr_arith(vm_t *vm, node_t *node, int dst)
+{
+    ctype_t *ctype = NODE(node->left)->ctype;
+    int save = vm->top;
+    int b, c, d, off;
+
+    /* ptr - ptr */
+    if (is_ptr(NODE(node->right)->ctype)) {
+        d = binary(vm, VM_PSUB, node, dst);
+        emit(vm, VM_SARI, d, d, __builtin_ctz(ctype->ptr->size));
+        return d;
+    }
+    if (const_offset(vm, node, &off)) {
+        b = expr(vm, NODE(node->left), -1);
+        vm->top = save;
+        d = target(vm, dst);
+        emit(vm, VM_PADDI, d, b, off);
+        return d;
+    }
+    if (node->binary_op == '+')
+        return binary(vm, idx_op(ctype), node, dst);
+    b = expr(vm, NODE(node->left), -1);
+    c = expr(vm, NODE(node->right), -1);
+    d = new_reg(vm);
+    emit(vm, VM_NEG, d, c, 0);
+    vm->top = save;
+    c = d;
+    d = target(vm, dst);
+    emit(vm, idx_op(ctype), d, b, c);
+    return d;
+}
+
+/* left op right in ctype, the type of the operands */
+static int arith_op(vm_t *vm, node_t *node, ctype_t *ctype, int dst)
+{
+    node_t *right = NODE(node->right);
+    int save = vm->top;
+    int op, b, d;
+
+    switch (node->binary_op) {
+    case '+':
+        op = VM_ADD;
+        break;
+    case '-':
+        op = VM_SUB;
+        break;
+    case '*':
+        op = VM_MUL;
+        break;
+    case '/':
+        op = VM_DIV;
+        break;
+    case '%':
+        op = VM_MOD;
+        break;
+    case PUNCT_LSFT:
+        op = VM_SHL;
+        break;
+    case PUNCT_RSFT:
+        op = VM_SHR;
+        break;
+    case '&':
+        op = VM_AND;
+        break;
+    case '|':
+        op = VM_OR;
+        break;
+    case '^':
+        op = VM_XOR;
+        break;
+
+    default:
+        errorf("invalid arith binary op %c\n", node->binary_op);
+        return -1;
+    }
+    if (is_float(ctype)) {
+        op = op - VM_ADD + (ctype == ctype_float ? VM_FADD : VM_DADD);
+    } else if ((op == VM_ADD || op == VM_SUB || op == VM_MUL) && right->type == NODE_CONSTANT
+            && labs(right->ival) <= INT32_MAX) {
+        b = expr(vm, NODE(node->left), -1);
+        vm->top = save;
+        d = target(vm, dst);
+        if (op == VM_MUL)
+            emit(vm, VM_MULI, d, b, right->ival);
+        else
+            emit(vm, VM_ADDI, d, b, op == VM_ADD ? right->ival : -right->ival);
+        return d;
+    }
+    return binary(vm, op, node, dst);
+}
+
+static int arith(vm_t *vm, node_t *node, int dst)
+{
+    /* the operands of x op= y have the type of x op y, not of x */
+    ctype_t *ctype = NODE(node->left)->ctype;
+    int save = vm->top;
+    int r, d;
+
+    if (is_ptr(ctype))
+        return ptr_arith(vm, node, dst);
+    if (ctype == node->ctype)
+        return arith_op(vm, node, ctype, dst);
+    r = arith_op(vm, node, ctype, -1);
+    vm->top = save;
+    d = convert(vm, r, ctype, node->ctype, dst);
+    if (d >= save)
+        vm->top = d + 1;
+    return d;
+}
+
+static int compare(vm_t *vm, node_t *node, int dst)
+{
+    ctype_t *ctype = NODE(node->left)->ctype;
+    int op = cmp_index(node->binary_op);
+
+    if (ctype == ctype_float)
+        op += VM_FEQ;
+    else if (ctype == ctype_double)
+        op += VM_DEQ;
+    else
+        op += VM_EQ;
+    return binary(vm, op, node, dst);
+}
+
+static int cond(vm_t *vm, node_t *node, bool when);
+
+/* && and || as a value */
+static int logical(vm_t *vm, node_t *node, int dst)
+{
+    int d = target(vm, dst);
+    int f, done;
+
+    f = cond(vm, node, false);
+    emit(vm, VM_LI, d, 0, 1);
+    done = jump(vm, VM_JMP, 0, 0);
+    patch_here(vm, f);
+    emit(vm, VM_LI, d, 0, 0);
+    patch_here(vm, done);
+    return d;
+}
+
+static int assign(vm_t *vm, node_t *node, int dst)
+{
+    node_t *left = NODE(node->left);
+    int save, r, v;
+    place_t m;
+
+    if (is_var(left) && vm->loc[left->id] > 0) {
+        v = vm->loc[left->id] - 1;
+        expr(vm, NODE(node->right), v);
+        return move(vm, v, dst);
+    }
+    /* the value first, as gen.c does */
+    r = expr(vm, NODE(node->right), dst);
+    save = vm->top;
+    lvalue(vm, left, &m);
+    store(vm, r, &m, left->ctype);
+    vm->top = save;
+    return r;
+}
+
+/* the value is not used */
+static void effect(vm_t *vm, node_t *node)
+{
+    int save = vm->top;
+
+    if (node->type == NODE_POSTFIX) {
+        inc_dec(vm, node, false, -1);
+    } else if (node->type == NODE_BINARY && node->binary_op == ',') {
+        effect(vm, NODE(node->left));
+        effect(vm, NODE(node->right));
+    } else
+        expr(vm, node, -1);
+    vm->top = save;
+}
+
+static int ternary(vm_t *vm, node_t *node, int dst)
+{
+    int d = target(vm, dst);
+    int f, done;
+
+    f = cond(vm, NODE(node->cond), false);
+    expr(vm, NODE(node->then), d);
+    done = jump(vm, VM_JMP, 0, 0);
+    patch_here(vm, f);
+    expr(vm, NODE(node->els), d);
+    patch_here(vm, done);
+    return d;
+}
+
+static int call(vm_t *vm, node_t *node, int dst)
+{
+    int base = vm->top;
+    int i, n = node->params.len;
+    uint32_t fmask = 0;
+    vm_call_t *c;
+    node_t *arg;
+
+    /* the window of the callee, the result is left in the first register */
+    for (i = 0; i < (n ? n : 1); i++)
+        new_reg(vm);
+    /* right to left, as gen.c does */
+    for (i = n - 1; i >= 0; i--) {
+        arg = KID(node->params, i);
+        if (is_float(arg->ctype)) {
+            if (i >= 32)
+                errorf("too many arguments to function \'%s\'\n", node->func_name);
+            fmask |= 1u << i;
+        }
+        expr(vm, arg, base + i);
+    }
+    GROW(vm->calls, vm->ncalls, vm->calls_size);
+    c = &vm->calls[vm->ncalls];
+    c->nargs = n;
+    c->fmask = fmask;
+    if (node->ctype == ctype_int)
+        c->ret = VM_RET_INT;
+    else if (node->ctype == ctype_char)
+        c->ret = VM_RET_CHAR;
+    else if (node->ctype == ctype_float)
+        c->ret = VM_RET_FLOAT;
+    else if (node->ctype == ctype_double)
+        c->ret = VM_RET_DOUBLE;
+    else
+        c->ret = VM_RET_PTR;
+    emit(vm, VM_CALL, base, func_index(vm, node->func_name), vm->ncalls++);
+    vm->top = base + 1;
+    return move(vm, base, dst);
+}
+
+static int expr(vm_t *vm, node_t *node, int dst)
+{
+    int save = vm->top;
+    int d;
+
+    assert(node);
+    switch (node->type) {
+    case NODE_CONSTANT:
+        return constant(vm, node, dst);
+    case NODE_STRING:
+        return string(vm, node, dst);
+    case NODE_POSTFIX:
+        return inc_dec(vm, node, true, dst);
+    case NODE_UNARY:
+        return unary(vm, node, dst);
+    case NODE_TERNARY:
+        return ternary(vm, node, dst);
+    case NODE_FUNC_CALL:
+        return call(vm, node, dst);
+    case NODE_VAR_DECL:
+    case NODE_VAR:
+        return var(vm, node, dst);
+    case NODE_CAST:
+        return expr(vm, NODE(node->expr), dst);
+    case NODE_ARITH_CONV:
+        d = expr(vm, NODE(node->expr), -1);
+        vm->top = save;
+        d = convert(vm, d, NODE(node->expr)->ctype, node->ctype, dst);
+        if (d >= save)
+            vm->top = d + 1;
+        return d;
+
+    case NODE_BINARY:
+        switch (node->binary_op) {
+        case '=':
+            return assign(vm, node, dst);
+        case ',':
+            effect(vm, NODE(node->left));
+            return expr(vm, NODE(node->right), dst);
+        case PUNCT_AND:
+        case PUNCT_OR:
+            return logical(vm, node, dst);
+        case '<': case '>': case PUNCT_LE: case PUNCT_GE: case PUNCT_EQ: case PUNCT_NE:
+            return compare(vm, node, dst);
+        default:
+            return arith(vm, node, dst);
+        }
+
+    default:
+        errorf("invalid node type\n");
+    }
+    return -1;
+}
+
+/* A jump list taken if node is true when when is, otherwise falls through */
+static int cond(vm_t *vm, node_t *node, bool when)
+{
+    int save = vm->top;
+    int list, other, op, b, c, r;
+
+    switch (node->type) {
+    case NODE_UNARY:
+        if (node->unary_op == '!')
+            return cond(vm, NODE(node->operand), !when);
+        break;
+
+    case NODE_CONSTANT:
+        if (!is_float(node->ctype))
+            return (node->ival != 0) == when ? jump(vm, VM_JMP, 0, 0) : NO_JUMP;
+        break;
+
+    case NODE_BINARY:
+        switch (node->binary_op) {
+        case PUNCT_AND:
+        case PUNCT_OR:
+            /* A && B is true if both are, A || B is false if both are */
+            if (when == (node->binary_op == PUNCT_AND)) {
+                other = cond(vm, NODE(node->left), !when);
+                list = cond(vm, NODE(node->right), when);
+                patch_here(vm, other);
+                return list;
+            }
+            list = cond(vm, NODE(node->left), when);
+            return concat(vm, list, cond(vm, NODE(node->right), when));
+
+        case '<': case '>': case PUNCT_LE: case PUNCT_GE: case PUNCT_EQ: case PUNCT_NE:
+            if (is_float(NODE(node->left)->ctype))
+                break;
+            b = expr(vm, NODE(node->left), -1);
+            c = expr(vm, NODE(node->right), -1);
+            vm->top = save;
+            op = cmp_index(node->binary_op);
+            return jump(vm, VM_JEQ + (when ? op : cmp_negate(op)), b, c);
+        }
+        break;
+    }
+
+    r = expr(vm, node, -1);
+    if (is_float(node->ctype)) {
+        c = new_reg(vm);
+        emit(vm, node->ctype == ctype_float ? VM_FTST : VM_DTST, c, r, 0);
+        r = c;
+    }
+    vm->top = save;
+    return jump(vm, when ? VM_JNZ : VM_JZ, r, 0);
+}
+
+/* statements */
+
+static void init(vm_t *vm, node_t *node)
+{
+    node_t *var = NODE(node->left);
+    int loc = vm->loc[var->id];
+    int save = vm->top;
+    int r;
+
+    if (loc > 0) {
+        expr(vm, NODE(node->right), loc - 1);
+        return;
+    }
+    r = expr(vm, NODE(node->right), -1);
+    store_local(vm, r, loc, var->ctype);
+    vm->top = save;
+}
+
+static void array_init(vm_t *vm, node_t *node)
+{
+    node_t *array = NODE(node->array);
+    ctype_t *ctype = array->ctype->ptr;
+    int loc = vm->loc[array->id];
+    int save = vm->top;
+    int i, r;
+
+    for (i = 0; i < (int) node->array_init.len; i++, loc += ctype->size) {
+        r = expr(vm, KID(node->array_init, i), -1);
+        store_local(vm, r, loc, ctype);
+        vm->top = save;
+    }
+    if (i < array->ctype->len) {
+        r = new_reg(vm);
+        emit(vm, VM_LI, r, 0, 0);
+        for (; i < array->ctype->len; i++, loc += ctype->size)
+            store_local(vm, r, loc, ctype);
+        vm->top = save;
+    }
+}
+
+static void declare_stmt(vm_t *vm, node_t *node)
+{
+    switch (node->type) {
+    case NODE_BINARY:
+        /* init-decl-list */
+        if (node->binary_op == ',' && node->ctype == NULL) {
+            declare_stmt(vm, NODE(node->left));
+            declare_stmt(vm, NODE(node->right));
+        }
+        break;
+    case NODE_VAR_INIT:
+        declare(vm, NODE(node->left));
+        break;
+    case NODE_ARRAY_INIT:
+        declare(vm, NODE(node->array));
+        break;
+    case NODE_VAR_DECL:
+        declare(vm, node);
+        break;
+    }
+}
+
+static void compound(vm_t *vm, node_t *node)
+{
+    int save = vm->top;
+    int offset = vm->offset;
+    size_t i;
+
+    for (i = 0; i < node->stmts.len; i++)
+        declare_stmt(vm, KID(node->stmts, i));
+    for (i = 0; i < node->stmts.len; i++)
+        stmt(vm, KID(node->stmts, i));
+    vm->top = save;
+    vm->offset = offset;
+}
+
+static void if_stmt(vm_t *vm, node_t *node)
+{
+    int f, done;
+
+    f = cond(vm, NODE(node->cond), false);
+    stmt(vm, NODE(node->then));
+    if (NODE(node->els)) {
+        done = jump(vm, VM_JMP, 0, 0);
+        patch_here(vm, f);
+        stmt(vm, NODE(node->els));
+        patch_here(vm, done);
+    } else
+        patch_here(vm, f);
+}
+
+/* the test at the bottom, as gen.c does */
+static void loop(vm_t *vm, node_t *cond_node, node_t *body, node_t *step, bool test_first)
+{
+    int test = NO_JUMP, start;
+
+    if (test_first)
+        test = jump(vm, VM_JMP, 0, 0);
+    start = vm->ncode;
+    stmt(vm, body);
+    if (step)
+        effect(vm, step);
+    patch_here(vm, test);
+    if (cond_node)
+        patch(vm, cond(vm, cond_node, true), start);
+    else
+        patch(vm, jump(vm, VM_JMP, 0, 0), start);
+}
+
+static void stmt(vm_t *vm, node_t *node)
+{
+    int save = vm->top;
+    int r;
+
+    if (!node)
+        return;
+    switch (node->type) {
+    case NODE_COMPOUND_STMT:
+        compound(vm, node);
+        break;
+    case NODE_IF:
+        if_stmt(vm, node);
+        break;
+    case NODE_FOR:
+        if (NODE(node->for_init))
+            effect(vm, NODE(node->for_init));
+        loop(vm, NODE(node->for_cond), NODE(node->for_body), NODE(node->for_step), true);
+        break;
+    case NODE_WHILE:
+        loop(vm, NODE(node->while_cond), NODE(node->while_body), NULL, true);
+        break;
+    case NODE_DO_WHILE:
+        loop(vm, NODE(node->while_cond), NODE(node->while_body), NULL, false);
+        break;
+    case NODE_RETURN:
+        r = node->expr ? expr(vm, NODE(node->expr), -1) : 0;
+        emit(vm, VM_RET, r, 0, 0);
+        vm->top = save;
+        break;
+    case NODE_VAR_DECL:
+    case NODE_VAR:
+        break;
+    case NODE_VAR_INIT:
+        init(vm, node);
+        break;
+    case NODE_ARRAY_INIT:
+        array_init(vm, node);
+        break;
+    case NODE_BINARY:
+        if (node->binary_op == ',' && node->ctype == NULL) {
+            stmt(vm, NODE(node->left));
+            stmt(vm, NODE(node->right));
+            break;
+        }
+        /* fall through */
+    default:
+        effect(vm, node);
+        break;
+    }
+}
+
+/* mark the variables whose address is taken, they go to memory */
+static void mark_addressed(vm_t *vm, node_id start)
+{
+    node_id id;
+    node_t *node, *operand;
+
+    for (id = start; id < vm->ast->nnodes; id++) {
+        node = NODE(id);
+        if (node->type != NODE_UNARY || node->unary_op != '&')
+            continue;
+        operand = NODE(node->operand);
+        if (is_var(operand))
+            vm->loc[operand->id] = LOC_ADDRESSED;
+    }
+}
+
+void vm_add(vm_t *vm, ast_t *ast, node_t *node)
+{
+    vm_func_t *f;
+    node_t *param;
+    node_id start;
+    size_t i, index;
+    int r;
+
+    assert(vm && ast && node && node->type == NODE_FUNC_DEF);
+    vm->ast = ast;
+    /* the parameters are made before the definition */
+    start = node->id;
+    for (i = 0; i < node->params.len; i++)
+        if (KID(node->params, i)->id < start)
+            start = KID(node->params, i)->id;
+    if (ast->nnodes > vm->loc_size) {
+        vm->loc_size = ast->nnodes * 2;
+        vm->loc = realloc(vm->loc, sizeof(int) * vm->loc_size);
+    }
+    memset(vm->loc + start, 0, sizeof(int) * (ast->nnodes - start));
+    mark_addressed(vm, start);
+
+    /* defined before the body, it may call itself */
+    index = func_index(vm, node->func_name);
+    f = &vm->funcs[index];
+    f->defined = true;
+    f->start = vm->ncode;
+    vm->top = vm->nregs = 0;
+    vm->offset = vm->frame = 0;
+    for (i = 0; i < node->params.len; i++) {
+        param = KID(node->params, i);
+        r = new_reg(vm);
+        if (vm->loc[param->id] != LOC_ADDRESSED) {
+            vm->loc[param->id] = r + 1;
+            continue;
+        }
+        declare(vm, param);
+        store_local(vm, r, vm->loc[param->id], param->ctype);
+    }
+    stmt(vm, NODE(node->func_body));
+    /* falling off the end returns 0 */
+    emit(vm, VM_LI, 0, 0, 0);
+    emit(vm, VM_RET, 0, 0, 0);
+
+    /* funcs may have moved */
+    f = &vm->funcs[index];
+    f->nregs = vm->nregs ? vm->nregs : 1;
+    f->frame = align(vm->frame, 16);
+}
@@ -0,0 +1,67 @@
+#!/bin/sh
+# Golden comparison of the ways scc compiles and runs the same programs:
+# scc -j 4 on all of them must write the .s and .o that scc writes for
+# each alone, and scc --run and scc --vm must print what the program built
+# by gcc prints and exit with its status.
+#
+#       test/check.sh [scc] [programs...]
+#
+# Defaults to ./scc on test/heart.c and test/nqueen.c.  When GEN (by
+# default bench/bin/gen, make check builds it) is there, the -j comparison
+# also covers a program of LINES lines of each of its shapes; those are not
+# run, most of them loop for too long.
+
+SCC=$(realpath "${1:-./scc}") || exit 1
+[ $# -gt 0 ] && shift
+PROGS=${*:-"test/heart.c test/nqueen.c"}
+GEN=${GEN:-bench/bin/gen}
+LINES=${LINES:-2000}
+CC=${CC:-gcc}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+mkdir "$TMP/src" "$TMP/serial" "$TMP/jobs" "$TMP/run" || exit 1
+for prog in $PROGS; do
+    cp "$prog" "$TMP/src/" || exit 1
+done
+RUNS=$(cd "$TMP/src" && echo *.c)
+if [ $# -eq 0 ] && [ -x "$GEN" ]; then
+    for shape in mixed nest expr funcs locals; do
+        "$GEN" "$shape" "$LINES" > "$TMP/src/gen-$shape.c" || exit 1
+    done
+fi
+
+status=0
+fail() {
+    echo "$1" >&2
+    status=1
+}
+
+cd "$TMP/serial" || exit 1
+for src in ../src/*.c; do
+    "$SCC" "$src" && "$SCC" -c "$src" || exit 1
+done
+cd ../jobs || exit 1
+"$SCC" -j 4 ../src/*.c && "$SCC" -j 4 -c ../src/*.c || exit 1
+for out in ../serial/*; do
+    cmp -s "$out" "$(basename "$out")" || fail "$(basename "$out"): scc -j 4 differs from scc"
+done
+
+cd ../run || exit 1
+for src in $RUNS; do
+    name=$(basename "$src" .c)
+    $CC -no-pie -o "$name" "../serial/$name.s" 2>/dev/null || exit 1
+    "./$name" > native.out
+    native=$?
+    "$SCC" --run "../src/$src" > run.out
+    run=$?
+    "$SCC" --vm "../src/$src" > vm.out
+    vm=$?
+    cmp -s native.out run.out || fail "$name: scc --run output differs from the native program"
+    cmp -s native.out vm.out || fail "$name: scc --vm output differs from the native program"
+    [ $run -eq $native ] || fail "$name: scc --run exits with $run, the native program with $native"
+    [ $vm -eq $native ] || fail "$name: scc --vm exits with $vm, the native program with $native"
+done
+
+[ $status -eq 0 ] && echo "check: ok"
+exit $status
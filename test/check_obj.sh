@@ -0,0 +1,51 @@
+#!/bin/sh
+# Check the encoder of scc -c against as: the .text and .rodata bytes and
+# the relocations of both objects of each program must be the same.
+#
+#       test/check_obj.sh [scc] [programs...]
+#
+# Defaults to ./scc on test/heart.c and test/nqueen.c, and when GEN (by
+# default bench/bin/gen, make check-obj builds it) is there, a program of
+# LINES lines of each of its shapes too.
+
+SCC=$(realpath "${1:-./scc}") || exit 1
+[ $# -gt 0 ] && shift
+PROGS=${*:-"test/heart.c test/nqueen.c"}
+GEN=${GEN:-bench/bin/gen}
+LINES=${LINES:-2000}
+AS=${AS:-as}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+for prog in $PROGS; do
+    cp "$prog" "$TMP/" || exit 1
+done
+if [ $# -eq 0 ] && [ -x "$GEN" ]; then
+    for shape in mixed nest expr funcs locals; do
+        "$GEN" "$shape" "$LINES" > "$TMP/$shape.c" || exit 1
+    done
+fi
+
+cd "$TMP" || exit 1
+status=0
+for src in *.c; do
+    name=$(basename "$src" .c)
+    "$SCC" "$src" && $AS -o "$name.as.o" "$name.s" || exit 1
+    "$SCC" -c "$src" || exit 1
+    for obj in "$name.as.o" "$name.o"; do
+        for sec in .text .rodata; do
+            objcopy -O binary --only-section=$sec "$obj" "$obj$sec" || exit 1
+        done
+        readelf -rW "$obj" | sed 's/ at offset 0x[0-9a-f]*//' > "$obj.rela"
+    done
+    ok=true
+    for part in .text .rodata .rela; do
+        if ! cmp -s "$name.as.o$part" "$name.o$part"; then
+            echo "$name: $part of scc -c differs from as" >&2
+            ok=false
+            status=1
+        fi
+    done
+    $ok && echo "$name: ok"
+done
+exit $status
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <assert.h>
+#include "../src/dict.h"
+
+#define NKEYS 10000
+
+#define VAL(i) ((void *) (long) ((i) + 1))
+
+static char keys[NKEYS][16];
+
+static void make_keys(void)
+{
+    int i;
+
+    for (i = 0; i < NKEYS; i++)
+        snprintf(keys[i], sizeof(keys[i]), "k%d", i);
+}
+
+/* A hash that puts key i in group g of a table of 2 groups.  Keys of the
+ * same group collide until it is full, then spill into the other.
+ */
+static size_t group_hash(int i, int g)
+{
+    return (size_t) (i & 0x7f) | (size_t) g << 7 | (size_t) (i >> 7) << 8;
+}
+
+static void test_insert(void)
+{
+    dict_t *dict = make_dict(NULL);
+
+    assert(dict_insert(dict, keys[0], VAL(0), true));
+    assert(dict_lookup(dict, keys[0]) == VAL(0));
+    assert(dict_lookup(dict, keys[1]) == NULL);
+    /* flag == true keeps the value that is there */
+    assert(!dict_insert(dict, keys[0], VAL(1), true));
+    assert(dict_lookup(dict, keys[0]) == VAL(0));
+    /* flag == false replaces it */
+    assert(dict_insert(dict, keys[0], VAL(1), false));
+    assert(dict_lookup(dict, keys[0]) == VAL(1));
+    assert(dict->used == 1);
+    /* equal keys at different addresses */
+    assert(dict_lookup(dict, "k0") == VAL(1));
+    free_dict(dict, NULL, NULL);
+}
+
+static void test_delete(void)
+{
+    dict_t *dict = make_dict(NULL);
+
+    dict_insert(dict, keys[0], VAL(0), true);
+    dict_insert(dict, keys[1], VAL(1), true);
+    assert(dict_delete(dict, keys[0]) == VAL(0));
+    assert(dict_lookup(dict, keys[0]) == NULL);
+    assert(dict_lookup(dict, keys[1]) == VAL(1));
+    assert(dict_delete(dict, keys[0]) == NULL);
+    assert(dict->used == 1);
+    /* a group with an empty slot needs no tombstone */
+    assert(dict->deleted == 0);
+    assert(dict_insert(dict, keys[0], VAL(2), true));
+    assert(dict_lookup(dict, keys[0]) == VAL(2));
+    free_dict(dict, NULL, NULL);
+}
+
+static void test_tombstone(void)
+{
+    dict_t *dict = make_dict(NULL);
+    int i;
+
+    /* 16 fill group 0, the 17th goes on to group 1 */
+    for (i = 0; i < 17; i++)
+        assert(dict_insert_hash(dict, keys[i], group_hash(i, 0), VAL(i), true));
+    assert(dict->mask + 1 == 2 * DICT_GROUP);
+    for (i = 0; i < 17; i++)
+        assert(dict_lookup_hash(dict, keys[i], group_hash(i, 0)) == VAL(i));
+
+    /* a slot of the full group becomes a tombstone, the probe for the
+     * key behind it must not stop there
+     */
+    assert(dict_delete_hash(dict, keys[0], group_hash(0, 0)) == VAL(0));
+    assert(dict->deleted == 1);
+    assert(dict->used == 16);
+    assert(dict_lookup_hash(dict, keys[0], group_hash(0, 0)) == NULL);
+    assert(dict_lookup_hash(dict, keys[16], group_hash(16, 0)) == VAL(16));
+
+    /* the tombstone is taken again */
+    assert(dict_insert_hash(dict, keys[17], group_hash(17, 0), VAL(17), true));
+    assert(dict->deleted == 0);
+    assert(dict_lookup_hash(dict, keys[17], group_hash(17, 0)) == VAL(17));
+    assert(dict_lookup_hash(dict, keys[16], group_hash(16, 0)) == VAL(16));
+
+    /* group 1 still has empty slots */
+    assert(dict_delete_hash(dict, keys[16], group_hash(16, 0)) == VAL(16));
+    assert(dict->deleted == 0);
+    free_dict(dict, NULL, NULL);
+}
+
+/* Keys move out of the full group 0 into group 1 and leave tombstones,
+ * until they are dropped by rehashing at the same size.
+ */
+static void test_churn(void)
+{
+    dict_t *dict = make_dict(NULL);
+    int i;
+
+    for (i = 0; i < 16; i++)
+        dict_insert_hash(dict, keys[i], group_hash(i, 0), VAL(i), true);
+    assert(dict->mask + 1 == 2 * DICT_GROUP);
+    dict_delete_hash(dict, keys[0], group_hash(0, 0));
+    dict_delete_hash(dict, keys[1], group_hash(1, 0));
+    for (i = 2; i < 15; i++) {
+        assert(dict_delete_hash(dict, keys[i], group_hash(i, 0)) == VAL(i));
+        assert(dict_insert_hash(dict, keys[100 + i], group_hash(100 + i, 1), VAL(100 + i), true));
+        assert(dict->used == 14);
+        assert(dict->deleted == (i < 14 ? (size_t) i + 1 : 0));
+    }
+    assert(dict->mask + 1 == 2 * DICT_GROUP);
+    for (i = 0; i < 16; i++)
+        assert(dict_lookup_hash(dict, keys[i], group_hash(i, 0)) == (i < 15 ? NULL : VAL(i)));
+    for (i = 2; i < 15; i++)
+        assert(dict_lookup_hash(dict, keys[100 + i], group_hash(100 + i, 1)) == VAL(100 + i));
+    free_dict(dict, NULL, NULL);
+}
+
+static void test_grow(void)
+{
+    dict_t *dict = make_dict(NULL);
+    int i;
+
+    for (i = 0; i < NKEYS; i++)
+        assert(dict_insert(dict, keys[i], VAL(i), true));
+    assert(dict->used == NKEYS);
+    assert(dict->used * 8 <= (dict->mask + 1) * 7);
+    for (i = 0; i < NKEYS; i++)
+        assert(dict_lookup(dict, keys[i]) == VAL(i));
+
+    for (i = 0; i < NKEYS; i += 2)
+        assert(dict_delete(dict, keys[i]) == VAL(i));
+    for (i = 0; i < NKEYS; i++)
+        assert(dict_lookup(dict, keys[i]) == (i % 2 ? VAL(i) : NULL));
+    for (i = 0; i < NKEYS; i += 2)
+        assert(dict_insert(dict, keys[i], VAL(i), true));
+    for (i = 0; i < NKEYS; i++)
+        assert(dict_lookup(dict, keys[i]) == VAL(i));
+    assert(dict->used == NKEYS);
+    free_dict(dict, NULL, NULL);
+}
+
+static void test_link(void)
+{
+    dict_t *outer = make_dict(NULL);
+    dict_t *inner = make_dict(outer);
+
+    dict_insert(outer, keys[0], VAL(0), true);
+    dict_insert(outer, keys[1], VAL(1), true);
+    dict_insert(inner, keys[1], VAL(2), true);
+    assert(dict_lookup(inner, keys[0]) == VAL(0));
+    assert(dict_lookup(inner, keys[1]) == VAL(2));
+    /* delete only looks at the dict itself */
+    assert(dict_delete(inner, keys[0]) == NULL);
+    assert(dict_delete(inner, keys[1]) == VAL(2));
+    assert(dict_lookup(inner, keys[1]) == VAL(1));
+    free_dict(inner, NULL, NULL);
+    free_dict(outer, NULL, NULL);
+}
+
+int main(void)
+{
+    make_keys();
+    test_insert();
+    test_delete();
+    test_tombstone();
+    test_churn();
+    test_grow();
+    test_link();
+    printf("dict: ok\n");
+    return 0;
+}
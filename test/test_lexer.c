@@ -22,31 +22,26 @@ int main(void)
     };
 
     lexer_init(&lexer, "stdin", stdin);
-    for (token = get_token(&lexer); token; token = get_token(&lexer))
+    for (token = get_token(&lexer); token; token = get_token(&lexer)) {
         switch (token->type) {
         case TK_KEYWORD:
             printf("type: keyword, val: %s\n", kw[token->ival]);
-            free_token(token, 0);
             break;
 
         case TK_ID:
-            printf("type: identifier, val: %s\n", token->sval);
-            free_token(token, 1);
+            printf("type: identifier, val: %.*s\n", (int) token->len, token->sval);
             break;
 
         case TK_NUMBER:
-            printf("type: number, val: %s\n", token->sval);
-            free_token(token, 1);
+            printf("type: number, val: %.*s\n", (int) token->len, token->sval);
             break;
 
         case TK_CHAR:
             printf("type: character, val: %c\n", token->ival);
-            free_token(token, 0);
             break;
 
         case TK_STRING:
-            printf("type: string, val: %s\n", token->sval);
-            free_token(token, 1);
+            printf("type: string, val: %.*s\n", (int) token->len, token->sval);
             break;
 
         case TK_PUNCT:
@@ -55,12 +50,13 @@ int main(void)
                 printf("%c\n", token->ival);
             else
                 printf("%d\n", token->ival);
-            free_token(token, 0);
             break;
 
         default:
             fprintf(stderr, "unknown token type: %d\n", token->type);
         }
+        release_tokens(&lexer);
+    }
 
     return 0;
 }